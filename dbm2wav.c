@@ -59,6 +59,9 @@ int SongEnd = 0;
 int TrailingFrames = 0;
 
 
+const char* ResamplerNames[] = { "linear", "cubic", "sinc", "nearest", NULL };
+
+
 
 static int little_endian_host(void)
 {
@@ -131,7 +134,15 @@ void buffer_endian_swap(int16_t *buffer, int samples)
 
 int main(int argc, char *argv[])
 {
-	if (argc == 3)
+	uint32_t resampler = DB3_RESAMPLER_LINEAR;
+
+	if (argc == 4)
+	{
+		while (ResamplerNames[resampler] && strcmp(argv[3], ResamplerNames[resampler])) resampler++;
+		if (!ResamplerNames[resampler]) argc = 0;
+	}
+
+	if ((argc == 3) || (argc == 4))
 	{
 		struct DB3Module *m;
 		void *engine;
@@ -139,7 +150,7 @@ int main(int argc, char *argv[])
 
 		if (m = DB3_Load(argv[1], &error))
 		{
-			if (engine = DB3_NewEngine(m, 44100, RENDER_BUFFER_FRAMES))
+			if (engine = DB3_NewEngineEx(m, 44100, RENDER_BUFFER_FRAMES, resampler))
 			{
 				FILE *wav;
 				int16_t *rendbuf;
@@ -192,7 +203,7 @@ int main(int argc, char *argv[])
 		}
 		else printf("dbm2wav: Loading \"%s\" failed: %s.\n", argv[1], ErrorReasons[error]);
 	}
-	else printf("dbm2wav: Usage: dbm2wav <module> <wavefile>\n");
+	else printf("dbm2wav: Usage: dbm2wav <module> <wavefile> [linear|cubic|sinc|nearest]\n");
 
 	return 0;
 }
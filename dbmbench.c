@@ -0,0 +1,156 @@
+/* 
+  libdigibooster3 example
+  dbm2wav: renders DigiBooster 3 module to WAVE file
+*/
+
+
+/*
+  Copyright (c) 2014, Grzegorz Kraszewski
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met: 
+
+  1. Redistributions of source code must retain the above copyright notice, this
+     list of conditions and the following disclaimer. 
+  2. Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution. 
+
+  This software is provided by the copyright holders and contributors "as is" and
+  any express or implied warranties, including, but not limited to the implied
+  warranties of merchantability and fitness for a particular purpose are
+  disclaimed. In no event shall the copyright owner or contributors be liable for
+  any direct, indirect, incidental, special, exemplary, or consequential damages
+  (including, but not limited to, procurement of substitute goods or services;
+  loss of use, data, or profits; or business interruption) however caused and
+  on any theory of liability, whether in contract  strict liability or tort
+  (including negligence or otherwise) arising in any way out of the use of this
+  software, even if advised of the possibility of such damage.
+*/
+
+
+/* Measures rendering speed of a module with every resampler, without and with loop images, mip
+   levels and one-shot cache. */
+
+#ifndef TARGET_WIN32
+#include "libdigibooster3.h"
+#else
+#include "../libdigibooster3/libdigibooster3.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+#define BENCH_MIXFREQ           44100
+#define BENCH_BUFFER_FRAMES     4096
+#define BENCH_MAX_SECONDS       600         // longer modules are measured on first 10 minutes
+#define BENCH_ONESHOT_CACHE     (16 << 20)  // cache budget of the last pass
+
+
+const char* ErrorReasons[] = {
+	"no error",
+	"can't open file",
+	"out of memory",
+	"module corrupted",
+	"unsupported format version",
+	"data read error",
+	"wrong chunk order in the module"
+};
+
+
+const char* ResamplerNames[] = { "linear", "cubic", "sinc", "nearest" };
+const char* PassNames[] = { "", "+loop", "+loop+mip", "+loop+mip+cache" };
+
+
+
+// Renders the module once with given resampler and one-shot cache budget, returns CPU time in
+// seconds or a negative number when the engine can't be created. Rendered frames are stored in
+// 'total'.
+
+double bench_resampler(struct DB3Module *m, uint32_t resampler, uint32_t cache, int16_t *buffer, uint32_t *total)
+{
+	void *engine;
+	clock_t start;
+	uint32_t frames;
+
+	if (!(engine = DB3_NewEngineEx(m, BENCH_MIXFREQ, BENCH_BUFFER_FRAMES, resampler))) return -1.0;
+	DB3_SetOneShotCache(engine, cache);
+
+	*total = 0;
+	start = clock();
+
+	do
+	{
+		frames = DB3_Mix(engine, BENCH_BUFFER_FRAMES, buffer);
+		*total += frames;
+	}
+	while ((frames == BENCH_BUFFER_FRAMES) && (*total < BENCH_MAX_SECONDS * BENCH_MIXFREQ));
+
+	DB3_DisposeEngine(engine);
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+	if (argc == 2)
+	{
+		struct DB3Module *m;
+		int16_t *buffer;
+		int error;
+
+		if (m = DB3_Load(argv[1], &error))
+		{
+			if (buffer = malloc(BENCH_BUFFER_FRAMES << 2))
+			{
+				uint32_t resampler;
+				int pass, error = DB3_ERROR_NONE;
+
+				printf("resampler              audio [s]    cpu [s]    realtime\n");
+
+				// The second pass plays loop images, the third one adds mip levels, the fourth
+				// one the one-shot cache.
+
+				for (pass = 0; pass < 4; pass++)
+				{
+					if (pass == 1) error = DB3_UnrollLoops(m);
+					if (pass == 2) error = DB3_BuildMipLevels(m);
+
+					if (error != DB3_ERROR_NONE)
+					{
+						printf("%-22s out of memory\n", PassNames[pass]);
+						break;
+					}
+
+					for (resampler = DB3_RESAMPLER_LINEAR; resampler <= DB3_RESAMPLER_NEAREST; resampler++)
+					{
+						uint32_t total;
+						double seconds;
+						char name[32];
+
+						sprintf(name, "%s%s", ResamplerNames[resampler], PassNames[pass]);
+						seconds = bench_resampler(m, resampler, (pass == 3) ? BENCH_ONESHOT_CACHE : 0, buffer, &total);
+
+						if (seconds < 0.0) printf("%-22s out of memory\n", name);
+						else if (seconds == 0.0) printf("%-22s %9.1f %10.3f         -\n", name,
+							(double)total / BENCH_MIXFREQ, seconds);
+						else printf("%-22s %9.1f %10.3f %10.1fx\n", name,
+							(double)total / BENCH_MIXFREQ, seconds, (double)total / BENCH_MIXFREQ / seconds);
+					}
+				}
+
+				free(buffer);
+			}
+
+			DB3_Unload(m);
+		}
+		else printf("dbmbench: Loading \"%s\" failed: %s.\n", argv[1], ErrorReasons[error]);
+	}
+	else printf("dbmbench: Usage: dbmbench <module>\n");
+
+	return 0;
+}
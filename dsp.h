@@ -52,6 +52,17 @@ struct DSPTag
 };
 
 
+// dsp_pull() of source objects (wavetable, zeropadder) accepts NULL as destination. Data are not
+// fetched then, but the object state is advanced as usual.
+
+// dsp_map() is the zero-copy counterpart of dsp_pull(). It is provided by source objects and
+// objects passing data through, it is NULL for others. It checks if samples the next dsp_pull()
+// would deliver are stored contiguously in memory, followed by zeros up to the number requested.
+// If so, it stores the read-only pointer to them and returns the number dsp_pull() would return,
+// otherwise it returns -1. The object state is not changed, the source is advanced with
+// dsp_pull() to NULL destination. At least 16 samples before the pointer are readable. Use
+// dsp_pull_span() to pull a span, which is copied only if it can't be mapped.
+
 struct DSPObject
 {
 	struct DSPObject *dsp_next;
@@ -61,26 +72,166 @@ struct DSPObject
 	void(*dsp_set)(struct DSPObject*, struct DSPTag*);
 	int(*dsp_get)(struct DSPObject*, uint32_t tag, int32_t *storage);
 	void(*dsp_flush)(struct DSPObject*);
+	int32_t(*dsp_map)(struct DSPObject*, int16_t **data, int32_t requested);
 	int dsp_type;
 };
 
 
+// Pulls 'requested' samples from 'obj'. If they are in memory already, the pointer to them is
+// stored in 'data', otherwise they are pulled into 'buffer' and 'data' points to it. Returns
+// the result of dsp_pull().
+
+static inline int32_t dsp_pull_span(struct DSPObject *obj, int16_t **data, int16_t *buffer, int32_t requested)
+{
+	int32_t delivered;
+
+	if (obj->dsp_map && ((delivered = obj->dsp_map(obj, data, requested)) >= 0))
+	{
+		obj->dsp_pull(obj, NULL, requested);
+		return delivered;
+	}
+
+	*data = buffer;
+	return obj->dsp_pull(obj, buffer, requested);
+}
+
+
+/*-------------------------------------------------------------*/
+/* Objects shared with the fused voice renderer (dsp_voice.c). */
+/*-------------------------------------------------------------*/
+
+// Linear resampler. Source data are processed in 1024-sample blocks, the first 8 samples being
+// history of the previous block. A block is read straight from the sample data, when they are
+// contiguous there (the sample has guard regions for history and the end). Otherwise the block
+// is copied to the buffer, which is allocated on the first such block. Cubic and sinc resamplers
+// use the same blocks with another interpolation kernel. A block provides 8 samples before and
+// after the current position.
+
+#define RESAMPLER20_REFILL_POS       (1008 << 16)
+
+// When the source has mip levels, a level with a step below 2.0 is selected at the initial fill,
+// if possible. It is kept until the next flush.
+
+// Cubic and sinc resamplers are polyphase FIR filters. Coefficients for every phase are stored
+// contiguously as 16-bit numbers with 14 fractional bits. The phase is the upper 10 bits of the
+// position fraction.
+
+#define POLY_PHASES                  1024
+#define POLY_CUBIC_TAPS              4      // samples -1 to +2 around the position
+#define POLY_SINC_TAPS               16     // samples -7 to +8 around the position
+
+struct OneShot;
+
+struct Resampler20
+{
+	struct DSPObject object;
+	int16_t* buffer;             // vector aligned on some platforms, NULL until needed
+	int16_t *data;               // the current block, data[k] is the source sample k, k >= -8
+	uint32_t pos;                // current position on source grid * 2^16
+	uint32_t step;               // current sampling step * 2^16, on the grid of the mip level
+	uint32_t ratio;              // sampling step * 2^16 set by the player
+	int level;                   // mip level of the source, selected at the initial fill
+	int flushed;
+	int interpolation;           // DB3_RESAMPLER_xxx, may be changed while playing
+	int16_t *table;              // polyphase coefficients, NULL for linear and nearest neighbour
+	int ratio_class;             // RESAMPLER_RATIO_xxx of the current step
+	struct OneShot *oneshot;     // cached note played or recorded, NULL if none
+	uint32_t oneshot_pos;        // position in the cached note when playing
+	int recording;               // TRUE if the note is recorded into 'oneshot'
+
+	// Block kernel selected for interpolation and processor. Generates 'n' samples from the
+	// current position without buffer refills, returns the position after them.
+
+	uint32_t(*interpolate)(struct Resampler20 *obj, int16_t *dest, int32_t n);
+
+	// Kernel used for the current ratio class. It is 'interpolate', or a kernel skipping
+	// interpolation, when positions fall on source samples.
+
+	uint32_t(*run)(struct Resampler20 *obj, int16_t *dest, int32_t n);
+};
+
+// Ratio classes. With an integer step and zero position fraction every output sample is a source
+// sample. Linear and cubic interpolation return it unchanged then, so interpolation is skipped.
+
+#define RESAMPLER_RATIO_UNITY        0    // step is 1.0
+#define RESAMPLER_RATIO_INTEGER      1    // step is an integer above 1.0
+#define RESAMPLER_RATIO_DOWN         2    // step is above 1.0
+#define RESAMPLER_RATIO_UP           3    // step is below 1.0
+
+
+// Number of samples generated from the resampler buffer starting at position 'pos', before the
+// buffer is refilled. The first sample is always generated, as the resampler checks its buffer
+// once per sample.
+
+static inline uint32_t dsp_resampler20_frames_to_refill(uint32_t pos, uint32_t step)
+{
+	if (pos >= RESAMPLER20_REFILL_POS) return 1;
+	if (step == 0) return 0x7FFFFFFF;
+	return (RESAMPLER20_REFILL_POS - pos + step - 1) / step;
+}
+
+// Panoramizer. Takes mono input and produces interleaved stereo, delaying one of channels.
+
+struct Panoramizer
+{
+	struct DSPObject object;
+	int16_t DelBuf[1024 + 64];
+	int DelL;                      // Delay in frames for left
+	int DelR;                      // Delay in frames for right
+	int16_t *PhaseTable;           // pointer to the phase table in ModSynth structure
+};
+
+// Maximum number of voices rendered at once by dsp_voice_mix_lanes().
+
+#define VOICE_LANES                  8
+
+int dsp_resampler20_fill(struct Resampler20 *obj, int discard);
+void dsp_resampler20_select_level(struct Resampler20 *obj);
+void dsp_resampler20_set_step(struct Resampler20 *obj, uint32_t step);
+void dsp_resampler20_set_interpolation(struct Resampler20 *obj, int interpolation, int16_t *table);
+void dsp_resampler20_set_ratio(struct Resampler20 *obj, uint32_t ratio);
+void dsp_panoramizer_set_panning(struct DSPObject *obj, int32_t panning);
+void dsp_polyresampler_select_kernel(struct Resampler20 *obj);
+int dsp_resampler20_unmap(struct Resampler20 *obj);
+void dsp_resampler20_oneshot_leave(struct Resampler20 *obj);
+int dsp_voice_mix(struct DSPObject *panoramizer, int32_t *accu, int32_t frames, int32_t gain_l, int32_t gain_r,
+	uint32_t *cuts, int cut_count);
+int dsp_voice_skip(struct DSPObject *panoramizer, int32_t frames);
+int dsp_voice_mix_lanes(struct DSPObject **panoramizers, int32_t *gains, int *results, int count, int32_t *accu,
+	int32_t frames, uint32_t *cuts, int cut_count);
+void dsp_echo_bus_mix(struct DSPObject *obj, int32_t *bus, int32_t *accu, int32_t frames);
+
 /*-----------------------------*/
 /* Constructors of DSP objects */
 /*-----------------------------*/
 
-struct DSPObject *dsp_sampled_instr_new(int16_t *data, int32_t loop_start, int32_t loop_len, int32_t loop_count, int32_t total_frames, int loop_type);
+struct DSPObject *dsp_sampled_instr_new(int16_t *data, int16_t **mips, int16_t **reversed, int16_t *image, int32_t loop_start, int32_t loop_len, int32_t loop_count, int32_t total_frames, int loop_type);
 struct DSPObject *dsp_resampler20_new(void);
+struct DSPObject *dsp_nearestresampler_new(void);
+struct DSPObject *dsp_cubicresampler_new(int16_t *table);
+struct DSPObject *dsp_sincresampler_new(int16_t *table);
 struct DSPObject *dsp_panoramizer_new(int16_t *phase_table);
 struct DSPObject *dsp_fetchinstr_new(struct MinList *instr_chain);
 struct DSPObject *dsp_echo_new(int mixfreq, int type);
+struct DSPObject *dsp_echo_bus_new(int mixfreq);
 struct DSPObject *dsp_zeropadder_new(int padframes);
 
+/*---------------------------------------------------------------------*/
+/* Rebinding of instrument chain objects, reused for a new instrument. */
+/*---------------------------------------------------------------------*/
+
+void dsp_sampled_instr_bind(struct DSPObject *obj, int16_t *data, int16_t **mips, int16_t **reversed, int16_t *image, int32_t loop_start, int32_t loop_len, int32_t loop_count, int32_t total_frames, int loop_type);
+void dsp_zeropadder_bind(struct DSPObject *obj, int padframes);
+void dsp_resampler20_bind(struct Resampler20 *obj, int interpolation, int16_t *table);
+void dsp_panoramizer_bind(struct DSPObject *obj);
+
 /*------------------------------------*/
 /* Some functions global to ModSynth. */
 /*------------------------------------*/
 
 void generate_panoramizer_phase_table(int16_t *phase_table, int mixfreq);
+void generate_cubic_table(int16_t *table);
+void generate_sinc_table(int16_t *table);
 
 // Types of DSP objects
 
@@ -110,6 +261,8 @@ void generate_panoramizer_phase_table(int16_t *phase_table, int mixfreq);
 #define DSPA_EchoMix                13    // for echo module
 #define DSPA_EchoCross              14    // for echo module
 #define DSPA_EchoType               15    // for echo module
+#define DSPA_MipLevels              16    // for unroller, number of usable mip levels (get only)
+#define DSPA_MipLevel               17    // for unroller, selects mip level (set only)
 
 /*------------------------------------*/
 /* Special values for DSP attributes. */
@@ -28,10 +28,16 @@
 */
 
 
-/* Echo plugin. Works the same as in AHI. */
+/* Echo plugin. Works the same as in AHI. Echo of the bus shared by tracks with global echo parameters */
+/* is not a part of any chain, it processes the bus in 32-bit precision.                               */
  
 #include "libdigibooster3.h"
 #include "dsp.h"
+#include "mixer.h"
+
+#ifdef MIXER_X86
+#include <immintrin.h>
+#endif
 
 
 // Echo object structure.
@@ -40,6 +46,7 @@ struct Echo
 {
 	struct DSPObject object;
 	int16_t *DelayLine;                   // echo delay line 
+	int32_t *BusLine;                     // echo delay line of the bus echo, DelayLine is NULL then
 	int BufferSize;                       // delay line length in frames
 	int WritePos;                         // current write position in the delay line
 	int DelayTime;                        // in frames
@@ -54,6 +61,11 @@ struct Echo
 	int PCrossNBack;
 	int NCrossPBack;
 	int NCrossNBack;
+
+	// block kernels, selected for the host CPU in the constructor
+
+	void(*Run)(struct Echo *obj, int16_t *src, int16_t *dest, int32_t frames);
+	void(*BusRun)(struct Echo *obj, int32_t *bus, int32_t *accu, int32_t frames);
 }; 
 
 
@@ -105,70 +117,304 @@ void dsp_echo_set(UNUSED struct DSPObject *obj0, UNUSED struct DSPTag *tags)
 }
 
 
+//==============================================================================================
+// echo_read_pos()
+//==============================================================================================
+
+static inline int echo_read_pos(struct Echo *obj)
+{
+	int read_pos = obj->WritePos - obj->DelayTime;
+
+	if (read_pos < 0) read_pos += obj->BufferSize;
+	return read_pos;
+}
+
+
+//==============================================================================================
+// echo_run_length()
+//==============================================================================================
+
+// Returns how many of 'frames' may be processed as one run, so neither the write position, nor
+// the read position wraps inside it.
+
+static inline int32_t echo_run_length(struct Echo *obj, int32_t frames)
+{
+	int32_t to_write_end = obj->BufferSize - obj->WritePos;
+	int32_t to_read_end = obj->BufferSize - echo_read_pos(obj);
+
+	if (frames > to_write_end) frames = to_write_end;
+	if (frames > to_read_end) frames = to_read_end;
+	return frames;
+}
+
+
+//==============================================================================================
+// echo_advance()
+//==============================================================================================
+
+static inline void echo_advance(struct Echo *obj, int32_t frames)
+{
+	obj->WritePos += frames;
+	if (obj->WritePos == obj->BufferSize) obj->WritePos = 0;
+}
+
+
+//==============================================================================================
+// echo_run_scalar()
+//==============================================================================================
+
+// Processes a run of frames (see echo_run_length()). 'src' and 'dest' may be the same buffer.
+// When the delay is 0, every frame reads the delay line entry before it is overwritten.
+
+static void echo_run_scalar(struct Echo *obj, int16_t *src, int16_t *dest, int32_t frames)
+{
+	int16_t *del = &obj->DelayLine[echo_read_pos(obj) << 1];
+	int16_t *wr = &obj->DelayLine[obj->WritePos << 1];
+	int32_t n = frames;
+
+	while (n--)
+	{
+		int32_t al, ar, l, r, l_del, r_del;
+
+		// calculation of samples being stored in the delay line
+
+		l = *src++;
+		r = *src++;
+		l_del = *del++;
+		r_del = *del++;
+
+		al = l * obj->NCrossNBack;
+		al += r * obj->PCrossNBack;
+		al += l_del * obj->NCrossPBack;
+		al += r_del * obj->PCrossPBack;
+
+		ar = r * obj->NCrossNBack;
+		ar += l * obj->PCrossNBack;
+		ar += r_del * obj->NCrossPBack;
+		ar += l_del * obj->PCrossPBack;
+
+		*wr++ = al >> 16;
+		*wr++ = ar >> 16;
+
+		// output samples now
+
+		*dest++ = (l * obj->NMix + l_del * obj->PMix) >> 8;
+		*dest++ = (r * obj->NMix + r_del * obj->PMix) >> 8;
+	}
+
+	echo_advance(obj, frames);
+}
+
+
+//==============================================================================================
+// echo_bus_run_scalar()
+//==============================================================================================
+
+// The same as echo_run_scalar(), but the bus is a sum of tracks after gains, so it needs 64-bit
+// products. The result is added to 'accu'.
+
+static void echo_bus_run_scalar(struct Echo *obj, int32_t *bus, int32_t *accu, int32_t frames)
+{
+	int32_t *del = &obj->BusLine[echo_read_pos(obj) << 1];
+	int32_t *wr = &obj->BusLine[obj->WritePos << 1];
+	int32_t n = frames;
+
+	while (n--)
+	{
+		int64_t al, ar, l, r, l_del, r_del;
+
+		l = *bus++;
+		r = *bus++;
+		l_del = *del++;
+		r_del = *del++;
+
+		al = l * obj->NCrossNBack;
+		al += r * obj->PCrossNBack;
+		al += l_del * obj->NCrossPBack;
+		al += r_del * obj->PCrossPBack;
+
+		ar = r * obj->NCrossNBack;
+		ar += l * obj->PCrossNBack;
+		ar += r_del * obj->NCrossPBack;
+		ar += l_del * obj->PCrossPBack;
+
+		*wr++ = al >> 16;
+		*wr++ = ar >> 16;
+		*accu++ += (l * obj->NMix + l_del * obj->PMix) >> 8;
+		*accu++ += (r * obj->NMix + r_del * obj->PMix) >> 8;
+	}
+
+	echo_advance(obj, frames);
+}
+
+
+#ifdef MIXER_X86
+
+//==============================================================================================
+// echo_run_avx2()
+//==============================================================================================
+
+// Four frames at once. Samples are widened to 32 bits, the second operand of cross terms has
+// channels swapped in every frame. Products and sums wrap the same as 32-bit scalar ones, and
+// the results fit in 16 bits after shifts, so saturating packs do not change them. When the
+// delay is shorter than four frames, an entry may be read after it is written in the same run,
+// so such a run is processed by the scalar code.
+
+__attribute__((target("avx2")))
+static void echo_run_avx2(struct Echo *obj, int16_t *src, int16_t *dest, int32_t frames)
+{
+	int16_t *del, *wr;
+	__m256i ncnb, pcnb, ncpb, pcpb, nmix, pmix;
+	int32_t n = frames;
+
+	if ((obj->DelayTime == 0) || (obj->DelayTime >= 4))
+	{
+		del = &obj->DelayLine[echo_read_pos(obj) << 1];
+		wr = &obj->DelayLine[obj->WritePos << 1];
+		ncnb = _mm256_set1_epi32(obj->NCrossNBack);
+		pcnb = _mm256_set1_epi32(obj->PCrossNBack);
+		ncpb = _mm256_set1_epi32(obj->NCrossPBack);
+		pcpb = _mm256_set1_epi32(obj->PCrossPBack);
+		nmix = _mm256_set1_epi32(obj->NMix);
+		pmix = _mm256_set1_epi32(obj->PMix);
+
+		while (n >= 4)
+		{
+			__m256i x, d, xs, ds, a, o;
+
+			x = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i*)src));
+			d = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i*)del));
+			xs = _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+			ds = _mm256_shuffle_epi32(d, _MM_SHUFFLE(2, 3, 0, 1));
+			a = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(x, ncnb), _mm256_mullo_epi32(xs, pcnb)),
+				_mm256_add_epi32(_mm256_mullo_epi32(d, ncpb), _mm256_mullo_epi32(ds, pcpb)));
+			o = _mm256_add_epi32(_mm256_mullo_epi32(x, nmix), _mm256_mullo_epi32(d, pmix));
+			a = _mm256_srai_epi32(a, 16);
+			o = _mm256_srai_epi32(o, 8);
+			_mm_storeu_si128((__m128i*)wr, _mm_packs_epi32(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1)));
+			_mm_storeu_si128((__m128i*)dest, _mm_packs_epi32(_mm256_castsi256_si128(o), _mm256_extracti128_si256(o, 1)));
+			src += 8;
+			dest += 8;
+			del += 8;
+			wr += 8;
+			n -= 4;
+		}
+
+		echo_advance(obj, frames - n);
+	}
+
+	echo_run_scalar(obj, src, dest, n);
+}
+
+
+//==============================================================================================
+// echo_bus_run_avx2()
+//==============================================================================================
+
+// Two frames at once, a channel per 64-bit lane. Bus samples are sign extended, so 32 x 32 bit
+// multiplies give exact 64-bit products. Only low 32 bits of shifted sums are stored, and these
+// are the same for logical and arithmetic shifts.
+
+__attribute__((target("avx2")))
+static void echo_bus_run_avx2(struct Echo *obj, int32_t *bus, int32_t *accu, int32_t frames)
+{
+	int32_t *del, *wr;
+	__m256i ncnb, pcnb, ncpb, pcpb, nmix, pmix, pick;
+	int32_t n = frames;
+
+	if ((obj->DelayTime == 0) || (obj->DelayTime >= 2))
+	{
+		del = &obj->BusLine[echo_read_pos(obj) << 1];
+		wr = &obj->BusLine[obj->WritePos << 1];
+		ncnb = _mm256_set1_epi64x(obj->NCrossNBack);
+		pcnb = _mm256_set1_epi64x(obj->PCrossNBack);
+		ncpb = _mm256_set1_epi64x(obj->NCrossPBack);
+		pcpb = _mm256_set1_epi64x(obj->PCrossPBack);
+		nmix = _mm256_set1_epi64x(obj->NMix);
+		pmix = _mm256_set1_epi64x(obj->PMix);
+		pick = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+
+		while (n >= 2)
+		{
+			__m256i x, d, xs, ds, a, o;
+
+			x = _mm256_cvtepi32_epi64(_mm_loadu_si128((__m128i*)bus));
+			d = _mm256_cvtepi32_epi64(_mm_loadu_si128((__m128i*)del));
+			xs = _mm256_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2));
+			ds = _mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+			a = _mm256_add_epi64(_mm256_add_epi64(_mm256_mul_epi32(x, ncnb), _mm256_mul_epi32(xs, pcnb)),
+				_mm256_add_epi64(_mm256_mul_epi32(d, ncpb), _mm256_mul_epi32(ds, pcpb)));
+			o = _mm256_add_epi64(_mm256_mul_epi32(x, nmix), _mm256_mul_epi32(d, pmix));
+			a = _mm256_permutevar8x32_epi32(_mm256_srli_epi64(a, 16), pick);
+			o = _mm256_permutevar8x32_epi32(_mm256_srli_epi64(o, 8), pick);
+			_mm_storeu_si128((__m128i*)wr, _mm256_castsi256_si128(a));
+			_mm_storeu_si128((__m128i*)accu, _mm_add_epi32(_mm_loadu_si128((__m128i*)accu), _mm256_castsi256_si128(o)));
+			bus += 4;
+			accu += 4;
+			del += 4;
+			wr += 4;
+			n -= 2;
+		}
+
+		echo_advance(obj, frames - n);
+	}
+
+	echo_bus_run_scalar(obj, bus, accu, n);
+}
+
+#endif
+
+
 //==============================================================================================
 // dsp_echo_pull()
 //==============================================================================================
 
+// Upstream frames are pulled in one block into 'dest' (or mapped), then processed in place in
+// runs between wraps of the delay line.
+
 int dsp_echo_pull(struct DSPObject *obj0, int16_t *dest, int32_t frames)
 {
 	struct Echo *obj = (struct Echo*)obj0;
-	struct DSPObject *prev;
-	int32_t al, ar, l, r, l_del, r_del;
-	int16_t b[32], *src, *del;
-	int chunk, read_pos, leave_active = TRUE;
+	int16_t *src;
 
-	prev = obj->object.dsp_prev;
-
-	// Scalar code (one frame at a time).
+	dsp_pull_span(obj->object.dsp_prev, &src, dest, frames);
 
 	while (frames)
 	{
-		chunk = 16;
-		if (chunk > frames) chunk = frames;
-		
-		leave_active = prev->dsp_pull(prev, b, chunk);
-		src = b;
-		frames -= chunk;
+		int32_t run = echo_run_length(obj, frames);
 
-		while (chunk--)
-		{
-			read_pos = obj->WritePos - obj->DelayTime;
-			if (read_pos < 0) read_pos += obj->BufferSize;
-			del = &obj->DelayLine[read_pos << 1];
-
-			// calculation of samples being stored in the delay line
-
-			l = *src++;
-			r = *src++;
-			l_del = *del++;
-			r_del = *del++;
-			
-			al = l * obj->NCrossNBack;
-			al += r * obj->PCrossNBack;
-			al += l_del * obj->NCrossPBack;
-			al += r_del * obj->PCrossPBack;
-
-			ar = r * obj->NCrossNBack;
-			ar += l * obj->PCrossNBack;
-			ar += r_del * obj->NCrossPBack;
-			ar += l_del * obj->PCrossPBack;
-
-			obj->DelayLine[obj->WritePos << 1] = al >> 16;
-			obj->DelayLine[(obj->WritePos << 1) + 1] = ar >> 16;
-			obj->WritePos++;
-			if (obj->WritePos == obj->BufferSize) obj->WritePos = 0;
-
-			// output samples now
-
-			*dest++ = (l * obj->NMix + l_del * obj->PMix) >> 8;
-			*dest++ = (r * obj->NMix + r_del * obj->PMix) >> 8;
-		}
+		obj->Run(obj, src, dest, run);
+		src += run << 1;
+		dest += run << 1;
+		frames -= run;
 	}
 
 	return TRUE;
 }
 
 
+//==============================================================================================
+// dsp_echo_bus_mix()
+//==============================================================================================
+
+// Processes 'frames' of the bus and adds the result to 'accu'.
+
+void dsp_echo_bus_mix(struct DSPObject *obj0, int32_t *bus, int32_t *accu, int32_t frames)
+{
+	struct Echo *obj = (struct Echo*)obj0;
+
+	while (frames)
+	{
+		int32_t run = echo_run_length(obj, frames);
+
+		obj->BusRun(obj, bus, accu, run);
+		bus += run << 1;
+		accu += run << 1;
+		frames -= run;
+	}
+}
+
+
 //==============================================================================================
 // dsp_echo_dispose()
 //==============================================================================================
@@ -180,6 +426,7 @@ void dsp_echo_dispose(struct DSPObject *obj0)
 		struct Echo* obj = (struct Echo*)obj0;
 		
 		if (obj->DelayLine) db3_free(obj->DelayLine);
+		if (obj->BusLine) db3_free(obj->BusLine);
 		db3_free(obj);
 	}
 }
@@ -189,10 +436,28 @@ void dsp_echo_dispose(struct DSPObject *obj0)
 // dsp_echo_flush()
 //==============================================================================================
 
-// This module belongs to track DSP chain. This chain is never flushed.
+// This module belongs to track DSP chain. This chain is never flushed. The bus echo is flushed,
+// when it is started again, so the delay line is cleared and write position is reset.
 
-void dsp_echo_flush(UNUSED struct DSPObject *dsp)
+void dsp_echo_flush(struct DSPObject *obj0)
 {
+	struct Echo *obj = (struct Echo*)obj0;
+	int i;
+
+	if (obj->BusLine)
+	{
+		int32_t *p = obj->BusLine;
+
+		for (i = 0; i < obj->BufferSize << 1; i++) *p++ = 0;
+	}
+	else
+	{
+		int32_t *p = (int32_t*)obj->DelayLine;
+
+		for (i = 0; i < obj->BufferSize; i++) *p++ = 0;
+	}
+
+	obj->WritePos = 0;
 }
 
 
@@ -214,15 +479,20 @@ int dsp_echo_get(struct DSPObject *obj0, uint32_t attr, int32_t *storage)
 
 
 //==============================================================================================
-// dsp_echo_new()
+// dsp_echo_create()
 //==============================================================================================
 
-struct DSPObject *dsp_echo_new(int mixfreq, int type)
+// Common constructor of track and bus echo. Delay line samples are 16-bit for a track, 32-bit
+// for the bus.
+
+static struct DSPObject *dsp_echo_create(int mixfreq, int type, int bus)
 {
 	struct Echo *obj;
 
 	if (obj = db3_malloc(sizeof(struct Echo)))
 	{
+		void *line;
+
 		obj->object.dsp_type = DSPTYPE_ECHO;
 		obj->object.dsp_pull = dsp_echo_pull;
 		obj->object.dsp_dispose = dsp_echo_dispose;
@@ -237,27 +507,58 @@ struct DSPObject *dsp_echo_new(int mixfreq, int type)
 		obj->NCrossPBack = 128;
 		obj->NCrossNBack = 128;
 		obj->Type = type;
+		obj->Run = echo_run_scalar;
+		obj->BusRun = echo_bus_run_scalar;
+#ifdef MIXER_X86
+		if (__builtin_cpu_supports("avx2"))
+		{
+			obj->Run = echo_run_avx2;
+			obj->BusRun = echo_bus_run_avx2;
+		}
+#endif
 
 		// Maximum echo delay possible is 512 ms, so it needs (0.512 * mixfreq) stereo frames. I round it up to (1/2 + 1/64) *
 		// mixfreq. Buffer is rounded up (and aligned to) 16 bytes (4 stereo frames) for SIMD.
 
 		obj->BufferSize = ((mixfreq >> 1) + (mixfreq >> 6) + 3) & ~4;
 
-		if (obj->DelayLine = db3_malloc(obj->BufferSize << 2))
-		{
-			int i;
-			int32_t *p = (int32_t*)obj->DelayLine;
-
-			// let's clear the delay line
+		if (bus) line = obj->BusLine = db3_malloc(obj->BufferSize << 3);
+		else line = obj->DelayLine = db3_malloc(obj->BufferSize << 2);
 
-			for (i = 0; i < obj->BufferSize; i++) *p++ = 0;
-
-			// calculate delay time in frames, reset write position
+		if (line)
+		{
+			// let's clear the delay line, reset write position, calculate delay time in frames
 
+			dsp_echo_flush(&obj->object);
 			obj->DelayTime = (64 * mixfreq + 250) / 500;   // default echo delay = 0x40;
-			obj->WritePos = 0;
 			return &obj->object;
 		}
+
+		db3_free(obj);
 	}
+
 	return NULL;
 }
+
+
+//==============================================================================================
+// dsp_echo_new()
+//==============================================================================================
+
+struct DSPObject *dsp_echo_new(int mixfreq, int type)
+{
+	return dsp_echo_create(mixfreq, type, FALSE);
+}
+
+
+//==============================================================================================
+// dsp_echo_bus_new()
+//==============================================================================================
+
+// Creates echo of the bus shared by tracks with DSPV_EchoType_Old. It is not inserted into a
+// chain, the bus is processed with dsp_echo_bus_mix().
+
+struct DSPObject *dsp_echo_bus_new(int mixfreq)
+{
+	return dsp_echo_create(mixfreq, DSPV_EchoType_Old, TRUE);
+}
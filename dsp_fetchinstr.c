@@ -68,6 +68,23 @@ int dsp_fetchinstr_pull(struct DSPObject *obj0, int16_t *dest, int32_t frames)
 }
 
 
+//==============================================================================================
+// dsp_fetchinstr_map()
+//==============================================================================================
+
+// The request is passed to the last object of the instrument chain, so its data are not copied.
+
+int32_t dsp_fetchinstr_map(struct DSPObject *obj0, int16_t **data, int32_t frames)
+{
+	struct FetchInstr *obj = (struct FetchInstr*)obj0;
+	struct DSPObject *instr_last;
+
+	instr_last = (struct DSPObject*)obj->dsp_chain->mlh_TailPred;
+	if (!instr_last->dsp_map) return -1;
+	return instr_last->dsp_map(instr_last, data, frames);
+}
+
+
 //==============================================================================================
 // dsp_fetchinstr_dispose()
 //==============================================================================================
@@ -121,6 +138,7 @@ struct DSPObject *dsp_fetchinstr_new(struct MinList *instr_chain)
 		obj->object.dsp_set = dsp_fetchinstr_set;
 		obj->object.dsp_get = dsp_fetchinstr_get;
 		obj->object.dsp_flush = dsp_fetchinstr_flush;
+		obj->object.dsp_map = dsp_fetchinstr_map;
 		obj->dsp_chain = instr_chain;
 		return &obj->object;
 	}
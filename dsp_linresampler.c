@@ -32,24 +32,41 @@
 
 #include "libdigibooster3.h"
 #include "dsp.h"
+#include "mixer.h"
+#include "oneshot.h"
+
+#ifdef MIXER_X86
+#include <immintrin.h>
+#endif
 
 //#include "modsynth.h"
 //#include <musicmodule.h>
 
 
-// Linear resampler object structure.
+// Linear resampler object structure is defined in dsp.h, as it is shared with the fused voice
+// renderer (dsp_voice.c).
 
-struct Resampler20
-{
-	struct DSPObject object;
-	int16_t* buffer;             // vector aligned on some platforms
-	uint32_t pos;                // current position on source grid * 2^16
-	uint32_t step;               // current sampling step * 2^16
-	int flushed;
-};
+
+// Contents of the buffer before the first block is filled.
+
+static int16_t ZeroBlock[1024];
 
 
 
+//==============================================================================================
+// dsp_resampler20_set_ratio()
+//==============================================================================================
+
+// Typed setter of DSPA_ResamplerRatio, used by the player for every pitch change.
+
+void dsp_resampler20_set_ratio(struct Resampler20 *obj, uint32_t ratio)
+{
+	if (ratio != obj->ratio) dsp_resampler20_oneshot_leave(obj);
+	obj->ratio = ratio;
+	dsp_resampler20_set_step(obj, ratio >> obj->level);
+}
+
+
 //==============================================================================================
 // dsp_resampler20_set()
 //==============================================================================================
@@ -63,7 +80,17 @@ void dsp_resampler20_set(struct DSPObject *obj0, struct DSPTag *tags)
 		switch (tags->dspt_tag)
 		{
 			case DSPA_ResamplerRatio:
-				obj->step = tags->dspt_data;
+				dsp_resampler20_set_ratio(obj, tags->dspt_data);
+			break;
+
+			// Phase panning is done after the resampler, other attributes may change the
+			// source, so the cached note is not valid any more.
+
+			case DSPA_Panning:
+			break;
+
+			default:
+				dsp_resampler20_oneshot_leave(obj);
 			break;
 		}
 
@@ -73,66 +100,443 @@ void dsp_resampler20_set(struct DSPObject *obj0, struct DSPTag *tags)
 
 
 //==============================================================================================
-// dsp_resampler20_pull()
+// dsp_resampler20_select_level()
 //==============================================================================================
 
-int dsp_resampler20_pull(struct DSPObject *obj0, int16_t *dest, int32_t samples)
+// Selects the lowest mip level of the source, at which the step is below 2.0. Sources without
+// levels play the full sample. Called at the initial fill, it may be called before it to know
+// the step in advance.
+
+void dsp_resampler20_select_level(struct Resampler20 *obj)
+{
+	struct DSPObject *prev = (struct DSPObject*)obj->object.dsp_prev;
+	int32_t levels;
+	int level = 0;
+
+	if (!prev->dsp_get(prev, DSPA_MipLevels, &levels)) return;
+	while ((level < levels) && ((obj->ratio >> level) >= (2 << 16))) level++;
+
+	if (level != obj->level)
+	{
+		struct DSPTag tags[2] = {{ DSPA_MipLevel, 0 }, { TAG_END, 0 }};
+
+		tags[0].dspt_data = level;
+		prev->dsp_set(prev, tags);
+		obj->level = level;
+		dsp_resampler20_set_step(obj, obj->ratio >> level);
+	}
+}
+
+
+//==============================================================================================
+// resampler20_map()
+//==============================================================================================
+
+// Tries to make the next block of 'count' source samples the current one without copying. The
+// block starts with 1024 - 'count' samples of history, which must be equal to 'history' (zeros if
+// NULL). On success the source is advanced, the number of samples delivered is stored in 'block'
+// and TRUE is returned.
+
+static int resampler20_map(struct Resampler20 *obj, int16_t *history, int32_t count, int32_t *block)
+{
+	struct DSPObject *prev = (struct DSPObject*)obj->object.dsp_prev;
+	int16_t *data;
+	int32_t i;
+
+	if (!prev->dsp_map || ((*block = prev->dsp_map(prev, &data, count)) < 0)) return FALSE;
+	data -= 1024 - count;
+
+	if (!history)
+	{
+		for (i = 0; i < 1024 - count; i++) if (data[i]) return FALSE;
+	}
+	else if (data != history)
+	{
+		for (i = 0; i < 1024 - count; i++) if (data[i] != history[i]) return FALSE;
+	}
+
+	prev->dsp_pull(prev, NULL, count);
+	obj->data = &data[8];
+	return TRUE;
+}
+
+
+//==============================================================================================
+// resampler20_alloc_buffer()
+//==============================================================================================
+
+// The buffer is allocated for the first block, which can't be read straight from the source.
+
+static int resampler20_alloc_buffer(struct Resampler20 *obj)
+{
+	if (!obj->buffer) obj->buffer = db3_malloc(2048);
+	return (obj->buffer != NULL);
+}
+
+
+//==============================================================================================
+// dsp_resampler20_unmap()
+//==============================================================================================
+
+// Copies the current block to the buffer, if it is read straight from the source. Used when the
+// block must be at a known place in memory. Returns FALSE if the buffer can't be allocated.
+
+int dsp_resampler20_unmap(struct Resampler20 *obj)
+{
+	if (obj->buffer && (obj->data == &obj->buffer[8])) return TRUE;
+	if (!resampler20_alloc_buffer(obj)) return FALSE;
+	db3_memcpy(obj->buffer, &obj->data[-8], 2048);
+	obj->data = &obj->buffer[8];
+	return TRUE;
+}
+
+
+//==============================================================================================
+// dsp_resampler20_fill()
+//==============================================================================================
+
+// Fills the buffer after flush, or refills it when the position has reached its end. Should be
+// called once before generating every output sample. Returns FALSE if the source delivered less
+// data than requested, which means the instrument has ended. If 'discard' is TRUE, the source is
+// advanced without fetching data, buffer contents are undefined then. The new block is mapped
+// from the source if possible, and copied to the buffer otherwise. If the buffer can't be
+// allocated, the instrument ends.
+
+int dsp_resampler20_fill(struct Resampler20 *obj, int discard)
 {
 	int leave_active = TRUE;
-	struct Resampler20 *obj = (struct Resampler20*)obj0;
 	struct DSPObject *prev;
-	int32_t block;
+	int32_t block, i;
 
 	prev = (struct DSPObject*)obj->object.dsp_prev;
 
-	while (samples)
+	if (obj->flushed)  // initial buffer fill
 	{
-		int16_t s0, s1;
-		int32_t dy;
+		dsp_resampler20_select_level(obj);
 
-		if (obj->flushed)  // initial buffer fill
+		if (discard) block = prev->dsp_pull(prev, NULL, 1016);
+		else if (!resampler20_map(obj, NULL, 1016, &block))
 		{
-			int i;
-
-			for (i = 0; i < 8; i++) obj->buffer[i] = 0;
-			block = prev->dsp_pull(prev, &obj->buffer[8], 1016);
+			if (resampler20_alloc_buffer(obj))
+			{
+				for (i = 0; i < 8; i++) obj->buffer[i] = 0;
+				block = prev->dsp_pull(prev, &obj->buffer[8], 1016);
+				for (i = 8 + block; i < 1024; i++) obj->buffer[i] = 0;    // temporary zero padding
+				obj->data = &obj->buffer[8];
+			}
+			else block = 0;
+		}
 
-			// temporary zero padding
+		if (block < 1016) leave_active = FALSE;
 
-			if (block < 1016)
+		obj->pos = 0;
+		obj->flushed = FALSE;
+	}
+	else if (obj->pos >= RESAMPLER20_REFILL_POS)   // refill buffer
+	{
+		if (discard) block = prev->dsp_pull(prev, NULL, 1008);
+		else if (!resampler20_map(obj, &obj->data[1000], 1008, &block))
+		{
+			if (resampler20_alloc_buffer(obj))
 			{
-				for (dy = 8 + block; dy < 1024; dy++) obj->buffer[dy] = 0;
-				leave_active = FALSE;
+				db3_memcpy(obj->buffer, &obj->data[1000], 32);   // 16 samples from end
+				block = prev->dsp_pull(prev, &obj->buffer[16], 1008);
+				for (i = 16 + block; i < 1024; i++) obj->buffer[i] = 0;   // temporary zero padding
+				obj->data = &obj->buffer[8];
 			}
-
-			obj->pos = 0;
-			obj->flushed = FALSE;
+			else block = 0;
 		}
 
-		if (obj->pos >= 1008 << 16)   // refill buffer
-		{
-			db3_memcpy(obj->buffer, &obj->buffer[1008], 32);   // 16 samples from end
-			block = prev->dsp_pull(prev, &obj->buffer[16], 1008);
+		if (block < 1008) leave_active = FALSE;
 
-			// temporary zero padding
+		obj->pos -= RESAMPLER20_REFILL_POS;
+	}
 
-			if (block < 1008)
-			{
-				for (dy = 16 + block; dy < 1024; dy++) obj->buffer[dy] = 0;
-				leave_active = FALSE;
-			}
+	return leave_active;
+}
 
-			obj->pos -= 1008 << 16;
-		}
 
-		s0 = obj->buffer[(obj->pos >> 16) + 8];
-		s1 = obj->buffer[(obj->pos >> 16) + 9];
-		dy = (s1 - s0) * (obj->pos & 0xFFFF);
+//==============================================================================================
+// resampler20_run_scalar()
+//==============================================================================================
+
+// Linear interpolation between two neighbour samples. It is the reference for SIMD kernels.
+
+static uint32_t resampler20_run_scalar(struct Resampler20 *obj, int16_t *dest, int32_t n)
+{
+	int16_t *buffer = obj->data;
+	uint32_t pos = obj->pos;
+	uint32_t step = obj->step;
+
+	while (n--)
+	{
+		int16_t s0, s1;
+		int32_t dy;
+
+		s0 = buffer[pos >> 16];
+		s1 = buffer[(pos >> 16) + 1];
+		dy = (s1 - s0) * (pos & 0xFFFF);
 		*dest++ = s0 + (dy >> 16);
-		samples--;
-		obj->pos += obj->step;
+		pos += step;
 	}
 
+	return pos;
+}
+
+
+//==============================================================================================
+// resampler20_run_copy()
+//==============================================================================================
+
+// Kernels for integer steps. If the position fraction is zero, source samples are output without
+// interpolation. Otherwise the interpolating kernel is used.
+
+static uint32_t resampler20_run_copy(struct Resampler20 *obj, int16_t *dest, int32_t n)
+{
+	uint32_t pos = obj->pos;
+
+	if (pos & 0xFFFF) return obj->interpolate(obj, dest, n);
+	db3_memcpy(dest, &obj->data[pos >> 16], n * sizeof(int16_t));
+	return pos + (n << 16);
+}
+
+
+//==============================================================================================
+// resampler20_run_point()
+//==============================================================================================
+
+static uint32_t resampler20_run_point(struct Resampler20 *obj, int16_t *dest, int32_t n)
+{
+	int16_t *buffer = obj->data;
+	uint32_t pos = obj->pos;
+	uint32_t step = obj->step;
+
+	if (pos & 0xFFFF) return obj->interpolate(obj, dest, n);
+
+	while (n--)
+	{
+		*dest++ = buffer[pos >> 16];
+		pos += step;
+	}
+
+	return pos;
+}
+
+
+//==============================================================================================
+// resampler20_run_nearest()
+//==============================================================================================
+
+// No interpolation, the source sample at or before the position is output.
+
+static uint32_t resampler20_run_nearest(struct Resampler20 *obj, int16_t *dest, int32_t n)
+{
+	int16_t *buffer = obj->data;
+	uint32_t pos = obj->pos;
+	uint32_t step = obj->step;
+
+	while (n--)
+	{
+		*dest++ = buffer[pos >> 16];
+		pos += step;
+	}
+
+	return pos;
+}
+
+
+//==============================================================================================
+// dsp_resampler20_set_step()
+//==============================================================================================
+
+// Sets the step and selects the kernel for its ratio class. Kernels are changed only when the
+// class changes. Sinc interpolation does not return source samples, so it is always used.
+
+void dsp_resampler20_set_step(struct Resampler20 *obj, uint32_t step)
+{
+	int ratio_class;
+
+	obj->step = step;
+
+	if (step == 0x10000) ratio_class = RESAMPLER_RATIO_UNITY;
+	else if (!(step & 0xFFFF)) ratio_class = RESAMPLER_RATIO_INTEGER;
+	else if (step > 0x10000) ratio_class = RESAMPLER_RATIO_DOWN;
+	else ratio_class = RESAMPLER_RATIO_UP;
+
+	if (ratio_class == obj->ratio_class) return;
+	obj->ratio_class = ratio_class;
+	obj->run = obj->interpolate;
+
+	if (obj->interpolation != DB3_RESAMPLER_SINC)
+	{
+		if (ratio_class == RESAMPLER_RATIO_UNITY) obj->run = resampler20_run_copy;
+		else if (ratio_class == RESAMPLER_RATIO_INTEGER) obj->run = resampler20_run_point;
+	}
+}
+
+
+#ifdef MIXER_X86
+
+//==============================================================================================
+// resampler20_run_avx2()
+//==============================================================================================
+
+// Eight samples at once. Both neighbour samples are gathered as one 32-bit value. Only the lower
+// 16 bits of the result are stored, so it is calculated in 16-bit halves of lanes. The 17-bit
+// difference of samples is split into its lower 16 bits and the sign, which subtracts the
+// fraction, when negative. Results are the same as of the scalar code.
+
+__attribute__((target("avx2")))
+static uint32_t resampler20_run_avx2(struct Resampler20 *obj, int16_t *dest, int32_t n)
+{
+	int16_t *buffer = obj->data;
+	uint32_t pos = obj->pos;
+	uint32_t step = obj->step;
+	__m256i vpos, vstep;
+
+	vpos = _mm256_add_epi32(_mm256_set1_epi32(pos), _mm256_mullo_epi32(_mm256_set1_epi32(step),
+		_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+	vstep = _mm256_set1_epi32(step << 3);
+
+	while (n >= 8)
+	{
+		__m256i x, s1, dy;
+
+		x = _mm256_i32gather_epi32((const int*)buffer, _mm256_srli_epi32(vpos, 16), 2);
+		s1 = _mm256_srli_epi32(x, 16);
+		dy = _mm256_mulhi_epu16(_mm256_sub_epi16(s1, x), vpos);
+		dy = _mm256_sub_epi16(dy, _mm256_and_si256(_mm256_cmpgt_epi16(x, s1), vpos));
+		x = _mm256_srai_epi32(_mm256_slli_epi32(_mm256_add_epi16(x, dy), 16), 16);
+		_mm_storeu_si128((__m128i*)dest, _mm_packs_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1)));
+		vpos = _mm256_add_epi32(vpos, vstep);
+		dest += 8;
+		pos += step << 3;
+		n -= 8;
+	}
+
+	obj->pos = pos;
+	return resampler20_run_scalar(obj, dest, n);
+}
+
+#endif
+
+
+//==============================================================================================
+// dsp_resampler20_set_interpolation()
+//==============================================================================================
+
+// Changes the interpolation (DB3_RESAMPLER_xxx) of a working resampler. All the kernels use the
+// same blocks, so it may be done at any time. 'table' is the polyphase table for cubic and sinc
+// interpolation, NULL otherwise.
+
+void dsp_resampler20_set_interpolation(struct Resampler20 *obj, int interpolation, int16_t *table)
+{
+	dsp_resampler20_oneshot_leave(obj);
+	obj->interpolation = interpolation;
+	obj->table = table;
+
+	if (interpolation == DB3_RESAMPLER_NEAREST) obj->interpolate = resampler20_run_nearest;
+	else if (interpolation != DB3_RESAMPLER_LINEAR) dsp_polyresampler_select_kernel(obj);
+	else
+	{
+		obj->interpolate = resampler20_run_scalar;
+#ifdef MIXER_X86
+		if (__builtin_cpu_supports("avx2")) obj->interpolate = resampler20_run_avx2;
+#endif
+	}
+
+	obj->ratio_class = -1;
+	dsp_resampler20_set_step(obj, obj->step);
+}
+
+
+//==============================================================================================
+// dsp_resampler20_oneshot_leave()
+//==============================================================================================
+
+// Stops playing or recording the cached note. Blocks are filled and the position is advanced
+// as usual while the cache is used, so the note continues with the kernel seamlessly.
+
+void dsp_resampler20_oneshot_leave(struct Resampler20 *obj)
+{
+	if (obj->oneshot)
+	{
+		if (obj->recording) obj->oneshot->Recording = FALSE;
+		db3_atomic_add(&obj->oneshot->Users, -1);
+		obj->oneshot = NULL;
+		obj->recording = FALSE;
+	}
+}
+
+
+//==============================================================================================
+// resampler20_oneshot_run()
+//==============================================================================================
+
+// Counterpart of the kernel for resamplers using the cache. When recording, the kernel output
+// is stored in the cache, until it is full. When playing, samples are copied from the cache.
+// After the last cached sample the kernel takes over.
+
+static uint32_t resampler20_oneshot_run(struct Resampler20 *obj, int16_t *dest, int32_t n)
+{
+	struct OneShot *os = obj->oneshot;
+	uint32_t pos;
+	int32_t i, m;
+
+	if (obj->recording)
+	{
+		pos = obj->run(obj, dest, n);
+		m = os->Length - os->Filled;
+		if (m > n) m = n;
+		for (i = 0; i < m; i++) os->Data[os->Filled + i] = dest[i];
+		os->Filled += m;
+		if (m < n) dsp_resampler20_oneshot_leave(obj);
+		return pos;
+	}
+
+	m = os->Filled - obj->oneshot_pos;
+	if (m > n) m = n;
+	for (i = 0; i < m; i++) dest[i] = os->Data[obj->oneshot_pos + i];
+	obj->oneshot_pos += m;
+	pos = obj->pos + m * obj->step;
+
+	if (m < n)
+	{
+		dsp_resampler20_oneshot_leave(obj);
+		obj->pos = pos;
+		pos = obj->run(obj, dest + m, n - m);
+	}
+
+	return pos;
+}
+
+
+//==============================================================================================
+// dsp_resampler20_pull()
+//==============================================================================================
+
+// The buffer is checked only before samples, at which it may need a refill. Samples between are
+// generated as a block by the kernel. Recording of a cached note ends with the source.
+
+int dsp_resampler20_pull(struct DSPObject *obj0, int16_t *dest, int32_t samples)
+{
+	int leave_active = TRUE;
+	struct Resampler20 *obj = (struct Resampler20*)obj0;
+
+	while (samples)
+	{
+		uint32_t n;
+
+		if (!dsp_resampler20_fill(obj, FALSE)) leave_active = FALSE;
+		n = dsp_resampler20_frames_to_refill(obj->pos, obj->step);
+		if (n > (uint32_t)samples) n = samples;
+		if (obj->oneshot) obj->pos = resampler20_oneshot_run(obj, dest, n);
+		else obj->pos = obj->run(obj, dest, n);
+		dest += n;
+		samples -= n;
+	}
+
+	if (!leave_active && obj->recording) dsp_resampler20_oneshot_leave(obj);
 	return leave_active;
 }
 
@@ -147,6 +551,7 @@ void dsp_resampler20_dispose(struct DSPObject *obj0)
 	{
 		struct Resampler20 *obj = (struct Resampler20*)obj0;
 
+		dsp_resampler20_oneshot_leave(obj);
 		if (obj->buffer) db3_free(obj->buffer);
 		db3_free(obj0);
 	}
@@ -167,8 +572,9 @@ void dsp_resampler20_flush(struct DSPObject *dsp)
 	prev = (struct DSPObject*)dsp->dsp_prev;
 	if (prev->dsp_prev) prev->dsp_flush(prev);
 
-	// Then invalidate data in buffer.
+	// Then invalidate data in buffer, a new note starts.
 
+	dsp_resampler20_oneshot_leave(obj);
 	obj->flushed = TRUE;
 }
 
@@ -183,6 +589,24 @@ int dsp_resampler20_get(UNUSED struct DSPObject *obj, UNUSED uint32_t attr, UNUS
 }
 
 
+//==============================================================================================
+// dsp_resampler20_bind()
+//==============================================================================================
+
+// Sets the interpolation and resets the state, as if the resampler has been just created. The
+// buffer is kept. 'table' is the polyphase table for cubic and sinc interpolation.
+
+void dsp_resampler20_bind(struct Resampler20 *obj, int interpolation, int16_t *table)
+{
+	obj->data = &ZeroBlock[8];
+	obj->ratio = 65536;
+	obj->level = 0;
+	obj->flushed = TRUE;
+	obj->step = 65536;
+	dsp_resampler20_set_interpolation(obj, interpolation, table);
+}
+
+
 //==============================================================================================
 // dsp_resampler20_new()
 //==============================================================================================
@@ -193,23 +617,33 @@ struct DSPObject *dsp_resampler20_new(void)
 
 	if (obj = db3_malloc(sizeof(struct Resampler20)))
 	{
-		if (obj->buffer = db3_malloc(2048))
-		{
-			int i;
-
-			obj->object.dsp_type = DSPTYPE_RESAMPLER;
-			obj->object.dsp_pull = dsp_resampler20_pull;
-			obj->object.dsp_dispose = dsp_resampler20_dispose;
-			obj->object.dsp_set = dsp_resampler20_set;
-			obj->object.dsp_get = dsp_resampler20_get;
-			obj->object.dsp_flush = dsp_resampler20_flush;
-			obj->step = 65536;
-			obj->flushed = TRUE;
-			for (i = 0; i < 8; i++) obj->buffer[i] = 0;
-			return &obj->object;
-		}
+		obj->object.dsp_type = DSPTYPE_RESAMPLER;
+		obj->object.dsp_pull = dsp_resampler20_pull;
+		obj->object.dsp_dispose = dsp_resampler20_dispose;
+		obj->object.dsp_set = dsp_resampler20_set;
+		obj->object.dsp_get = dsp_resampler20_get;
+		obj->object.dsp_flush = dsp_resampler20_flush;
+		obj->buffer = NULL;
+		dsp_resampler20_bind(obj, DB3_RESAMPLER_LINEAR, NULL);
+		return &obj->object;
+	}
+	return NULL;
+}
+
+
+//==============================================================================================
+// dsp_nearestresampler_new()
+//==============================================================================================
 
-		db3_free(obj);
+struct DSPObject *dsp_nearestresampler_new(void)
+{
+	struct Resampler20 *obj;
+
+	if (obj = (struct Resampler20*)dsp_resampler20_new())
+	{
+		dsp_resampler20_set_interpolation(obj, DB3_RESAMPLER_NEAREST, NULL);
+		return &obj->object;
 	}
+
 	return NULL;
 }
@@ -38,16 +38,8 @@
 // output.
 
 
-// Panoramizer object structure.
-
-struct Panoramizer
-{
-	struct DSPObject object;
-	int16_t DelBuf[1024 + 64];
-	int DelL;                      // Delay in frames for left
-	int DelR;                      // Delay in frames for right
-	int16_t *PhaseTable;           // pointer to the phase table in ModSynth structure
-};
+// Panoramizer object structure is defined in dsp.h, as it is shared with the fused voice renderer
+// (dsp_voice.c).
 
 
 // A global function for calculating panorama->delay table. This trigonometric equation is approximated by quadratic equation.
@@ -68,22 +60,34 @@ void generate_panoramizer_phase_table(int16_t *phase_table, int mixfreq)
 
 
 //==============================================================================================
-// dsp_panoramizer_set()
+// dsp_panoramizer_set_panning()
 //==============================================================================================
 
-void dsp_panoramizer_set(struct DSPObject *obj0, struct DSPTag *tags)
+// Typed setter of DSPA_Panning, used by the player for every panning change.
+
+void dsp_panoramizer_set_panning(struct DSPObject *obj0, int32_t panning)
 {
 	struct Panoramizer *obj = (struct Panoramizer*)obj0;
 
+	obj->DelL = 0;
+	obj->DelR = 0;
+	if (panning < 0) obj->DelR = obj->PhaseTable[-panning - 1];
+	else if (panning > 0) obj->DelL = obj->PhaseTable[panning - 1];
+}
+
+
+//==============================================================================================
+// dsp_panoramizer_set()
+//==============================================================================================
+
+void dsp_panoramizer_set(struct DSPObject *obj, struct DSPTag *tags)
+{
 	while (tags->dspt_tag)
 	{
 		switch (tags->dspt_tag)
 		{
 			case DSPA_Panning:
-				obj->DelL = 0;
-				obj->DelR = 0;
-				if (tags->dspt_data < 0) obj->DelR = obj->PhaseTable[-tags->dspt_data - 1];
-				else if (tags->dspt_data > 0) obj->DelL = obj->PhaseTable[tags->dspt_data - 1];
+				dsp_panoramizer_set_panning(obj, tags->dspt_data);
 			break;
 		}
 
@@ -169,6 +173,23 @@ int dsp_panoramizer_get(UNUSED struct DSPObject *obj, UNUSED uint32_t attr, UNUS
 }
 
 
+//==============================================================================================
+// dsp_panoramizer_bind()
+//==============================================================================================
+
+// Resets the state, as if the object has been just created.
+
+void dsp_panoramizer_bind(struct DSPObject *dsp)
+{
+	struct Panoramizer *obj = (struct Panoramizer*)dsp;
+	int i;
+
+	obj->DelL = 0;
+	obj->DelR = 0;
+	for (i = 0; i < 64; i++) obj->DelBuf[i] = 0;
+}
+
+
 //==============================================================================================
 // dsp_panoramizer_new()
 //==============================================================================================
@@ -179,8 +200,6 @@ struct DSPObject *dsp_panoramizer_new(int16_t *phase_table)
 
 	if (obj = db3_malloc(sizeof(struct Panoramizer)))
 	{
-		int i;
-		
 		obj->object.dsp_type = DSPTYPE_PANORAMIZER;
 		obj->object.dsp_pull = dsp_panoramizer_pull;
 		obj->object.dsp_dispose = dsp_panoramizer_dispose;
@@ -188,9 +207,7 @@ struct DSPObject *dsp_panoramizer_new(int16_t *phase_table)
 		obj->object.dsp_get = dsp_panoramizer_get;
 		obj->object.dsp_flush = dsp_panoramizer_flush;
 		obj->PhaseTable = phase_table;
-		
-		for (i = 0; i < 64; i++) obj->DelBuf[i] = 0;
-		
+		dsp_panoramizer_bind(&obj->object);
 		return &obj->object;
 	}
 	return NULL;
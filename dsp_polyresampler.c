@@ -0,0 +1,357 @@
+/*-----------------*/
+/* libdigibooster3 */
+/*-----------------*/
+
+/*
+  Copyright (c) 2014, Grzegorz Kraszewski
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+     list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+
+  This software is provided by the copyright holders and contributors "as is" and
+  any express or implied warranties, including, but not limited to the implied
+  warranties of merchantability and fitness for a particular purpose are
+  disclaimed. In no event shall the copyright owner or contributors be liable for
+  any direct, indirect, incidental, special, exemplary, or consequential damages
+  (including, but not limited to, procurement of substitute goods or services;
+  loss of use, data, or profits; or business interruption) however caused and
+  on any theory of liability, whether in contract  strict liability or tort
+  (including negligence or otherwise) arising in any way out of the use of this
+  software, even if advised of the possibility of such damage.
+*/
+
+
+/* Polyphase resamplers: 4-point cubic (Catmull-Rom) and 16-tap windowed sinc. */
+
+#include "libdigibooster3.h"
+#include "dsp.h"
+#include "mixer.h"
+
+#include <math.h>
+
+#ifdef MIXER_X86
+#include <immintrin.h>
+#endif
+
+
+// Both resamplers are Resampler20 objects with another block kernel. Buffering, flushing and
+// disposing is done by the linear resampler code. Coefficient tables are shared by all the
+// resamplers of an engine and are owned by the engine.
+
+#define POLY_SINC_CUTOFF             0.9    // relative to the source Nyquist frequency
+
+
+//==============================================================================================
+// poly_normalize()
+//==============================================================================================
+
+// Converts coefficients of one phase to 14-bit fixed point. The rounding error is added to the
+// largest coefficient, so the sum is exactly 1.0 and constant signal passes unchanged.
+
+static void poly_normalize(int16_t *dest, double *coeffs, int taps)
+{
+	double sum = 0.0;
+	int32_t isum = 0;
+	int i, max = 0;
+
+	for (i = 0; i < taps; i++) sum += coeffs[i];
+
+	for (i = 0; i < taps; i++)
+	{
+		dest[i] = (int16_t)floor(coeffs[i] * 16384.0 / sum + 0.5);
+		isum += dest[i];
+		if (coeffs[i] > coeffs[max]) max = i;
+	}
+
+	dest[max] += 16384 - isum;
+}
+
+
+//==============================================================================================
+// generate_cubic_table()
+//==============================================================================================
+
+// 'table' has space for POLY_PHASES * POLY_CUBIC_TAPS coefficients.
+
+void generate_cubic_table(int16_t *table)
+{
+	int p;
+
+	for (p = 0; p < POLY_PHASES; p++)
+	{
+		double x = (double)p / POLY_PHASES;
+		double c[POLY_CUBIC_TAPS];
+
+		c[0] = (-x * x * x + 2.0 * x * x - x) * 0.5;
+		c[1] = (3.0 * x * x * x - 5.0 * x * x + 2.0) * 0.5;
+		c[2] = (-3.0 * x * x * x + 4.0 * x * x + x) * 0.5;
+		c[3] = (x * x * x - x * x) * 0.5;
+		poly_normalize(&table[p * POLY_CUBIC_TAPS], c, POLY_CUBIC_TAPS);
+	}
+}
+
+
+//==============================================================================================
+// generate_sinc_table()
+//==============================================================================================
+
+// 'table' has space for POLY_PHASES * POLY_SINC_TAPS coefficients. Blackman window spans 16
+// samples around the position.
+
+void generate_sinc_table(int16_t *table)
+{
+	int p, t;
+
+	for (p = 0; p < POLY_PHASES; p++)
+	{
+		double x = (double)p / POLY_PHASES;
+		double c[POLY_SINC_TAPS];
+
+		for (t = 0; t < POLY_SINC_TAPS; t++)
+		{
+			double d = (double)(t - 7) - x;
+			double s = POLY_SINC_CUTOFF;
+
+			if (d != 0.0) s = sin(M_PI * POLY_SINC_CUTOFF * d) / (M_PI * d);
+			c[t] = s * (0.42 + 0.5 * cos(M_PI * d / 8.0) + 0.08 * cos(M_PI * d / 4.0));
+		}
+
+		poly_normalize(&table[p * POLY_SINC_TAPS], c, POLY_SINC_TAPS);
+	}
+}
+
+
+//==============================================================================================
+// poly_output()
+//==============================================================================================
+
+// Scales the filter result back to 16 bits with rounding and saturation.
+
+static inline int16_t poly_output(int32_t acc)
+{
+	acc = (acc + 8192) >> 14;
+	if (acc > 32767) acc = 32767;
+	else if (acc < -32768) acc = -32768;
+	return acc;
+}
+
+
+//==============================================================================================
+// cubic_run_scalar()
+//==============================================================================================
+
+// Reference kernels. The current Resampler20 block keeps sample 'k' at data[k].
+
+static uint32_t cubic_run_scalar(struct Resampler20 *obj, int16_t *dest, int32_t n)
+{
+	uint32_t pos = obj->pos;
+	uint32_t step = obj->step;
+
+	while (n--)
+	{
+		int16_t *s = &obj->data[(int32_t)(pos >> 16) - 1];
+		int16_t *c = &obj->table[((pos & 0xFFFF) >> 6) * POLY_CUBIC_TAPS];
+
+		*dest++ = poly_output(s[0] * c[0] + s[1] * c[1] + s[2] * c[2] + s[3] * c[3]);
+		pos += step;
+	}
+
+	return pos;
+}
+
+
+//==============================================================================================
+// sinc_run_scalar()
+//==============================================================================================
+
+static uint32_t sinc_run_scalar(struct Resampler20 *obj, int16_t *dest, int32_t n)
+{
+	uint32_t pos = obj->pos;
+	uint32_t step = obj->step;
+
+	while (n--)
+	{
+		int16_t *s = &obj->data[(int32_t)(pos >> 16) - 7];
+		int16_t *c = &obj->table[((pos & 0xFFFF) >> 6) * POLY_SINC_TAPS];
+		int32_t acc = 0;
+		int t;
+
+		for (t = 0; t < POLY_SINC_TAPS; t++) acc += s[t] * c[t];
+		*dest++ = poly_output(acc);
+		pos += step;
+	}
+
+	return pos;
+}
+
+
+#ifdef MIXER_X86
+
+//==============================================================================================
+// poly_pack_avx2()
+//==============================================================================================
+
+// Rounds, scales and saturates eight filter results, stores them as 16-bit samples.
+
+__attribute__((target("avx2")))
+static inline void poly_pack_avx2(int16_t *dest, __m256i acc)
+{
+	acc = _mm256_srai_epi32(_mm256_add_epi32(acc, _mm256_set1_epi32(8192)), 14);
+	_mm_storeu_si128((__m128i*)dest, _mm_packs_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1)));
+}
+
+
+//==============================================================================================
+// cubic_run_avx2()
+//==============================================================================================
+
+// Eight samples at once. Four source samples and four coefficients of every output are gathered
+// as 64-bit values, multiplied and summed pairwise by madd, then pairs are added horizontally.
+// Integer sums are exact, so results are the same as of the scalar code.
+
+__attribute__((target("avx2")))
+static uint32_t cubic_run_avx2(struct Resampler20 *obj, int16_t *dest, int32_t n)
+{
+	const long long *src = (const long long*)&obj->data[-1];
+	const long long *table = (const long long*)obj->table;
+	uint32_t pos = obj->pos;
+	uint32_t step = obj->step;
+	__m256i vpos, vstep;
+
+	vpos = _mm256_add_epi32(_mm256_set1_epi32(pos), _mm256_mullo_epi32(_mm256_set1_epi32(step),
+		_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+	vstep = _mm256_set1_epi32(step << 3);
+
+	while (n >= 8)
+	{
+		__m256i index, phase, lo, hi;
+
+		index = _mm256_srli_epi32(vpos, 16);
+		phase = _mm256_srli_epi32(_mm256_slli_epi32(vpos, 16), 22);
+		lo = _mm256_madd_epi16(_mm256_i32gather_epi64(src, _mm256_castsi256_si128(index), 2),
+			_mm256_i32gather_epi64(table, _mm256_castsi256_si128(phase), 8));
+		hi = _mm256_madd_epi16(_mm256_i32gather_epi64(src, _mm256_extracti128_si256(index, 1), 2),
+			_mm256_i32gather_epi64(table, _mm256_extracti128_si256(phase, 1), 8));
+		poly_pack_avx2(dest, _mm256_permute4x64_epi64(_mm256_hadd_epi32(lo, hi), _MM_SHUFFLE(3, 1, 2, 0)));
+		vpos = _mm256_add_epi32(vpos, vstep);
+		dest += 8;
+		pos += step << 3;
+		n -= 8;
+	}
+
+	obj->pos = pos;
+	return cubic_run_scalar(obj, dest, n);
+}
+
+
+//==============================================================================================
+// sinc_run_avx2()
+//==============================================================================================
+
+// Eight samples at once. For every output 16 source samples and 16 coefficients are loaded as
+// one vector each and multiplied with madd. Eight vectors of partial sums are then reduced with
+// horizontal additions. Results are the same as of the scalar code.
+
+__attribute__((target("avx2")))
+static uint32_t sinc_run_avx2(struct Resampler20 *obj, int16_t *dest, int32_t n)
+{
+	uint32_t pos = obj->pos;
+	uint32_t step = obj->step;
+
+	while (n >= 8)
+	{
+		__m256i m[8], a, b;
+		int i;
+
+		for (i = 0; i < 8; i++)
+		{
+			m[i] = _mm256_madd_epi16(_mm256_loadu_si256((__m256i*)&obj->data[(int32_t)(pos >> 16) - 7]),
+				_mm256_loadu_si256((__m256i*)&obj->table[((pos & 0xFFFF) >> 6) * POLY_SINC_TAPS]));
+			pos += step;
+		}
+
+		a = _mm256_hadd_epi32(_mm256_hadd_epi32(m[0], m[1]), _mm256_hadd_epi32(m[2], m[3]));
+		b = _mm256_hadd_epi32(_mm256_hadd_epi32(m[4], m[5]), _mm256_hadd_epi32(m[6], m[7]));
+		poly_pack_avx2(dest, _mm256_add_epi32(_mm256_permute2x128_si256(a, b, 0x20),
+			_mm256_permute2x128_si256(a, b, 0x31)));
+		dest += 8;
+		n -= 8;
+	}
+
+	obj->pos = pos;
+	return sinc_run_scalar(obj, dest, n);
+}
+
+#endif
+
+
+//==============================================================================================
+// dsp_polyresampler_select_kernel()
+//==============================================================================================
+
+// Sets the interpolation kernel of a resampler with cubic or sinc interpolation selected.
+
+void dsp_polyresampler_select_kernel(struct Resampler20 *obj)
+{
+	if (obj->interpolation == DB3_RESAMPLER_CUBIC)
+	{
+		obj->interpolate = cubic_run_scalar;
+#ifdef MIXER_X86
+		if (__builtin_cpu_supports("avx2")) obj->interpolate = cubic_run_avx2;
+#endif
+	}
+	else
+	{
+		obj->interpolate = sinc_run_scalar;
+#ifdef MIXER_X86
+		if (__builtin_cpu_supports("avx2")) obj->interpolate = sinc_run_avx2;
+#endif
+	}
+}
+
+
+//==============================================================================================
+// dsp_cubicresampler_new()
+//==============================================================================================
+
+// 'table' is generated with generate_cubic_table().
+
+struct DSPObject *dsp_cubicresampler_new(int16_t *table)
+{
+	struct Resampler20 *obj;
+
+	if (obj = (struct Resampler20*)dsp_resampler20_new())
+	{
+		dsp_resampler20_set_interpolation(obj, DB3_RESAMPLER_CUBIC, table);
+		return &obj->object;
+	}
+
+	return NULL;
+}
+
+
+//==============================================================================================
+// dsp_sincresampler_new()
+//==============================================================================================
+
+// 'table' is generated with generate_sinc_table().
+
+struct DSPObject *dsp_sincresampler_new(int16_t *table)
+{
+	struct Resampler20 *obj;
+
+	if (obj = (struct Resampler20*)dsp_resampler20_new())
+	{
+		dsp_resampler20_set_interpolation(obj, DB3_RESAMPLER_SINC, table);
+		return &obj->object;
+	}
+
+	return NULL;
+}
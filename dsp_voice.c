@@ -0,0 +1,595 @@
+/*-----------------*/
+/* libdigibooster3 */
+/*-----------------*/
+
+/*
+  Copyright (c) 2014, Grzegorz Kraszewski
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+     list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+
+  This software is provided by the copyright holders and contributors "as is" and
+  any express or implied warranties, including, but not limited to the implied
+  warranties of merchantability and fitness for a particular purpose are
+  disclaimed. In no event shall the copyright owner or contributors be liable for
+  any direct, indirect, incidental, special, exemplary, or consequential damages
+  (including, but not limited to, procurement of substitute goods or services;
+  loss of use, data, or profits; or business interruption) however caused and
+  on any theory of liability, whether in contract  strict liability or tort
+  (including negligence or otherwise) arising in any way out of the use of this
+  software, even if advised of the possibility of such damage.
+*/
+
+
+/* Fused voice renderer. */
+
+#include "libdigibooster3.h"
+#include "dsp.h"
+#include "mixer.h"
+
+#ifdef MIXER_X86
+#include <immintrin.h>
+#endif
+
+
+// The standard instrument chain (wavetable -> zeropadder -> resampler -> panoramizer) followed by
+// mixing passes every frame through three intermediate buffers. When a track has no echo, the
+// renderer below does resampling, phase panning, gains and accumulation in a single loop. It works
+// directly on the state of resampler and panoramizer objects of the chain, so both paths may be
+// used alternately (for example when echo is switched on or off) and give identical results.
+// Source data are still fetched into the resampler buffer by pulling the wavetable. With AVX2,
+// up to VOICE_LANES such voices starting at the same frame may be rendered together, a voice per
+// SIMD lane. It pays off for many short, low pitched voices, where a single voice is too short
+// for vectorization.
+
+
+//==============================================================================================
+// voice_sample()
+//==============================================================================================
+
+// Linear interpolation of the resampler. When 'interpolate' is FALSE, the position is known to
+// fall on a source sample, which is returned unchanged, or the resampler does nearest neighbour
+// interpolation.
+
+static inline int16_t voice_sample(int16_t *buffer, uint32_t pos, int interpolate)
+{
+	int16_t s0, s1;
+	int32_t dy;
+
+	s0 = buffer[pos >> 16];
+	if (!interpolate) return s0;
+	s1 = buffer[(pos >> 16) + 1];
+	dy = (s1 - s0) * (pos & 0xFFFF);
+	return s0 + (dy >> 16);
+}
+
+
+//==============================================================================================
+// voice_run_kernel()
+//==============================================================================================
+
+// Generates 'n' frames without buffer refills. 'del' points to the current position in the
+// panoramizer delay buffer. 'mix' and 'interpolate' are constants, so every combination is
+// compiled as a separate loop.
+
+static inline uint32_t voice_run_kernel(struct Resampler20 *rs, int16_t *del, int32_t *accu, int32_t n,
+	int dl, int dr, int32_t gain_l, int32_t gain_r, int mix, int interpolate)
+{
+	int16_t *buffer = rs->data;
+	uint32_t pos = rs->pos;
+	uint32_t step = rs->step;
+	int32_t i;
+
+	if (mix)
+	{
+		for (i = 0; i < n; i++)
+		{
+			int32_t left, right;
+
+			del[i] = voice_sample(buffer, pos, interpolate);
+			left = del[i - dl] * gain_l;
+			right = del[i - dr] * gain_r;
+			*accu++ += left >> 14;
+			*accu++ += right >> 14;
+			pos += step;
+		}
+	}
+	else
+	{
+		for (i = 0; i < n; i++)
+		{
+			del[i] = voice_sample(buffer, pos, interpolate);
+			pos += step;
+		}
+	}
+
+	return pos;
+}
+
+
+//==============================================================================================
+// voice_run()
+//==============================================================================================
+
+// Interpolation is skipped for integer steps (see RESAMPLER_RATIO_xxx) starting on a source
+// sample, as all the positions are on source samples then, and for nearest neighbour resampler.
+
+static inline uint32_t voice_run(struct Resampler20 *rs, int16_t *del, int32_t *accu, int32_t n,
+	int dl, int dr, int32_t gain_l, int32_t gain_r, int mix)
+{
+	if ((rs->interpolation == DB3_RESAMPLER_NEAREST)
+	 || ((rs->ratio_class <= RESAMPLER_RATIO_INTEGER) && !(rs->pos & 0xFFFF)))
+	{
+		return voice_run_kernel(rs, del, accu, n, dl, dr, gain_l, gain_r, mix, FALSE);
+	}
+
+	return voice_run_kernel(rs, del, accu, n, dl, dr, gain_l, gain_r, mix, TRUE);
+}
+
+
+//==============================================================================================
+// voice_pulls_init()
+//==============================================================================================
+
+// Pulls of the chain, which tick by tick rendering would do in a span of 'frames' frames.
+
+struct VoicePulls
+{
+	uint32_t *Cuts;                  // offsets of pulls, except of the first one
+	int CutCount;
+	int Cut;                         // index of the cut ending the current pull
+	int32_t Start;                   // the current pull
+	int32_t End;
+	int32_t Frames;
+};
+
+
+static inline void voice_pulls_init(struct VoicePulls *vp, uint32_t *cuts, int cut_count, int32_t frames)
+{
+	vp->Cuts = cuts;
+	vp->CutCount = cut_count;
+	vp->Cut = 0;
+	vp->Start = 0;
+	vp->End = (cut_count > 0) ? (int32_t)cuts[0] : frames;
+	vp->Frames = frames;
+}
+
+
+//==============================================================================================
+// voice_end_of_source()
+//==============================================================================================
+
+// Called when the resampler has met the end of source at frame 'f' of the span. Finds the pull
+// containing the frame. If the frame is inside the last 1024 frames chunk of the pull, the pull
+// returns FALSE and rendering ends with it. Returns the frame where rendering ends, or 0 if it
+// continues.
+
+static inline int32_t voice_end_of_source(struct VoicePulls *vp, int32_t f)
+{
+	while (f >= vp->End)
+	{
+		vp->Start = vp->End;
+		vp->End = (++vp->Cut < vp->CutCount) ? (int32_t)vp->Cuts[vp->Cut] : vp->Frames;
+	}
+
+	if (f >= vp->Start + (vp->End - vp->Start - 1) / 1024 * 1024) return vp->End;
+	return 0;
+}
+
+
+//==============================================================================================
+// dsp_voice_mix()
+//==============================================================================================
+
+// Renders 'frames' frames of the instrument chain ending with 'panoramizer' and adds them to the
+// accumulator. Rendering with the chain pulled separately for every tick is emulated. 'cuts' is
+// an ascending list of 'cut_count' offsets inside the span, at which such pulls would start. The
+// return value is the one of the last pull. When the instrument ends, a pull returns FALSE if its
+// last 1024 frames chunk has met the end of source in the resampler, then following pulls are not
+// done. Rendering stops at the end of such pull and FALSE is returned. Otherwise the whole span
+// is rendered in one pass.
+
+int dsp_voice_mix(struct DSPObject *panoramizer, int32_t *accu, int32_t frames, int32_t gain_l, int32_t gain_r,
+	uint32_t *cuts, int cut_count)
+{
+	struct Panoramizer *pan = (struct Panoramizer*)panoramizer;
+	struct Resampler20 *rs = (struct Resampler20*)panoramizer->dsp_prev;
+	struct VoicePulls pulls;
+	int32_t frame = 0, stop = frames;
+	int ended = FALSE;
+
+	voice_pulls_init(&pulls, cuts, cut_count, frames);
+
+	while (frame < stop)
+	{
+		int32_t done = 0, chunk = stop - frame;
+		int i;
+
+		if (chunk > 1024) chunk = 1024;
+
+		while (done < chunk)
+		{
+			uint32_t n = chunk - done, run;
+			int32_t end;
+
+			if (!dsp_resampler20_fill(rs, FALSE) && (end = voice_end_of_source(&pulls, frame + done)))
+			{
+				stop = end;
+				ended = TRUE;
+				if (chunk > stop - frame) chunk = stop - frame;
+				n = chunk - done;
+			}
+
+			if ((run = dsp_resampler20_frames_to_refill(rs->pos, rs->step)) < n) n = run;
+			rs->pos = voice_run(rs, &pan->DelBuf[64 + done], accu, n, pan->DelL, pan->DelR, gain_l, gain_r, TRUE);
+			accu += n << 1;
+			done += n;
+		}
+
+		for (i = 0; i < 64; i++) pan->DelBuf[i] = pan->DelBuf[chunk + i];
+		frame += chunk;
+	}
+
+	return !ended;
+}
+
+
+#ifdef MIXER_X86
+
+// Voices are rendered in two passes over a tile of VOICE_TILE_FRAMES frames. The first pass
+// resamples all lanes into the tile, the second one does phase panning, gains and mixing.
+
+#define VOICE_TILE_FRAMES            256
+
+
+struct VoiceLane
+{
+	struct Panoramizer *Pan;
+	struct Resampler20 *Rs;
+	struct VoicePulls Pulls;
+	int32_t Stop;                    // frame of the span, where the voice ends
+	uint32_t Left;                   // frames before the resampler buffer is checked again
+	int Voice;                       // index of the voice in arrays passed
+};
+
+
+//==============================================================================================
+// voice_lanes_mix()
+//==============================================================================================
+
+// Second pass of dsp_voice_mix_lanes(). Resampled voices of 'frames' frames are in the tile after
+// 64 frames of history. Does phase panning and gains, then lanes are summed horizontally into
+// the accumulator. Delayed samples are gathered only if any voice is panned. Returns the
+// accumulator advanced by 'frames'. Samples and gains are 16-bit, so they are multiplied with
+// pmaddwd. Upper halves of tile entries are ignored.
+
+__attribute__((target("avx2")))
+static inline int32_t *voice_lanes_mix(int32_t *tile, int32_t *accu, int32_t frames, int32_t *gl, int32_t *gr,
+	int32_t *dl, int32_t *dr, int delays)
+{
+	__m256i vgl, vgr, vdl, vdr, left[4], right[4];
+	int32_t *row = &tile[64 * VOICE_LANES];
+	int32_t i = 0;
+
+	vgl = _mm256_and_si256(_mm256_loadu_si256((__m256i*)gl), _mm256_set1_epi32(0xFFFF));
+	vgr = _mm256_and_si256(_mm256_loadu_si256((__m256i*)gr), _mm256_set1_epi32(0xFFFF));
+	vdl = _mm256_loadu_si256((__m256i*)dl);
+	vdr = _mm256_loadu_si256((__m256i*)dr);
+
+	while (i < frames)
+	{
+		__m256i a, b;
+		int k, n = 4;
+
+		if (n > frames - i) n = frames - i;
+
+		for (k = 0; k < 4; k++)
+		{
+			if (k >= n) left[k] = right[k] = _mm256_setzero_si256();
+			else
+			{
+				if (delays)
+				{
+					left[k] = _mm256_i32gather_epi32((const int*)row, vdl, 4);
+					right[k] = _mm256_i32gather_epi32((const int*)row, vdr, 4);
+				}
+				else left[k] = right[k] = _mm256_loadu_si256((__m256i*)row);
+
+				left[k] = _mm256_srai_epi32(_mm256_madd_epi16(left[k], vgl), 14);
+				right[k] = _mm256_srai_epi32(_mm256_madd_epi16(right[k], vgr), 14);
+				row += VOICE_LANES;
+			}
+		}
+
+		// Four frames are summed at once. After two levels of horizontal additions every
+		// 128-bit half holds interleaved sums of its four lanes, then halves are added.
+
+		a = _mm256_hadd_epi32(_mm256_hadd_epi32(left[0], right[0]), _mm256_hadd_epi32(left[1], right[1]));
+		b = _mm256_hadd_epi32(_mm256_hadd_epi32(left[2], right[2]), _mm256_hadd_epi32(left[3], right[3]));
+		a = _mm256_add_epi32(_mm256_permute2x128_si256(a, b, 0x20), _mm256_permute2x128_si256(a, b, 0x31));
+
+		if (n == 4)
+		{
+			_mm256_storeu_si256((__m256i*)accu, _mm256_add_epi32(_mm256_loadu_si256((__m256i*)accu), a));
+		}
+		else
+		{
+			int32_t sums[8];
+
+			_mm256_storeu_si256((__m256i*)sums, a);
+			for (k = 0; k < n << 1; k++) accu[k] += sums[k];
+		}
+
+		accu += n << 1;
+		i += n;
+	}
+
+	return accu;
+}
+
+
+//==============================================================================================
+// dsp_voice_mix_lanes()
+//==============================================================================================
+
+// Renders up to VOICE_LANES voices at once, every voice in its own SIMD lane, and adds them to
+// the accumulator. Voices must start at the same frame and have the same span, so 'frames',
+// 'cuts' and 'cut_count' are the same as for dsp_voice_mix(). 'gains' contains left and right
+// gain of every voice, 16-bit values are expected. Return values of dsp_voice_mix() are stored in 'results'. Voices which
+// have ended drop out of the group. Results are identical to rendering voices one by one. Returns
+// FALSE, when voices can't be rendered this way and nothing has been done.
+
+__attribute__((target("avx2")))
+int dsp_voice_mix_lanes(struct DSPObject **panoramizers, int32_t *gains, int *results, int count, int32_t *accu,
+	int32_t frames, uint32_t *cuts, int cut_count)
+{
+	struct VoiceLane lanes[VOICE_LANES];
+	int32_t tile[(64 + VOICE_TILE_FRAMES) * VOICE_LANES];
+	int32_t offs[VOICE_LANES], pos[VOICE_LANES], step[VOICE_LANES], gl[VOICE_LANES], gr[VOICE_LANES];
+	int32_t dl[VOICE_LANES], dr[VOICE_LANES], fmask[VOICE_LANES];
+	int16_t *base;
+	int32_t frame = 0;
+	int active = count, delays, k;
+
+	// Lanes gather samples with 32-bit offsets relative to the buffer of the first voice. Sample
+	// data may be anywhere in memory, so blocks are always copied to resampler buffers.
+
+	for (k = 0; k < count; k++)
+	{
+		if (!dsp_resampler20_unmap((struct Resampler20*)panoramizers[k]->dsp_prev)) return FALSE;
+	}
+
+	base = ((struct Resampler20*)panoramizers[0]->dsp_prev)->data;
+
+	for (k = 0; k < count; k++)
+	{
+		int16_t *buffer = ((struct Resampler20*)panoramizers[k]->dsp_prev)->data;
+
+		if ((buffer - base > 0x3FFF0000) || (base - buffer > 0x3FFF0000)) return FALSE;
+		lanes[k].Pan = (struct Panoramizer*)panoramizers[k];
+		lanes[k].Rs = (struct Resampler20*)panoramizers[k]->dsp_prev;
+		lanes[k].Stop = frames;
+		lanes[k].Left = 0;
+		lanes[k].Voice = k;
+		voice_pulls_init(&lanes[k].Pulls, cuts, cut_count, frames);
+		results[k] = TRUE;
+	}
+
+	while (active > 0)
+	{
+		int32_t chunk = frames - frame, done = 0;
+		int i;
+
+		if (chunk > VOICE_TILE_FRAMES) chunk = VOICE_TILE_FRAMES;
+
+		for (k = 0; k < active; k++)
+		{
+			if (chunk > lanes[k].Stop - frame) chunk = lanes[k].Stop - frame;
+		}
+
+		// Lane parameters. Unused lanes read the first sample of the first voice with zero
+		// gains. The tile starts with 64 frames of panoramizer history.
+
+		delays = FALSE;
+
+		for (k = 0; k < VOICE_LANES; k++)
+		{
+			if (k < active)
+			{
+				struct VoiceLane *vl = &lanes[k];
+
+				offs[k] = vl->Rs->data - base;
+				step[k] = vl->Rs->step;
+				fmask[k] = (vl->Rs->interpolation == DB3_RESAMPLER_NEAREST) ? 0 : 0xFFFF;
+				gl[k] = gains[vl->Voice << 1];
+				gr[k] = gains[(vl->Voice << 1) + 1];
+				dl[k] = k - vl->Pan->DelL * VOICE_LANES;
+				dr[k] = k - vl->Pan->DelR * VOICE_LANES;
+				if (vl->Pan->DelL || vl->Pan->DelR) delays = TRUE;
+				for (i = 0; i < 64; i++) tile[i * VOICE_LANES + k] = vl->Pan->DelBuf[i];
+			}
+			else
+			{
+				offs[k] = step[k] = gl[k] = gr[k] = pos[k] = fmask[k] = 0;
+				dl[k] = dr[k] = k;
+				for (i = 0; i < 64; i++) tile[i * VOICE_LANES + k] = 0;
+			}
+		}
+
+		while (done < chunk)
+		{
+			int32_t n = chunk - done;
+			int32_t *row = &tile[(64 + done) * VOICE_LANES];
+			__m256i voff, vpos, vstep, vmask;
+
+			// Buffer refills. Every voice can end here, then the chunk is shortened to the
+			// end of voice. Runs end before the next refill of any voice.
+
+			for (k = 0; k < active; k++)
+			{
+				struct VoiceLane *vl = &lanes[k];
+				int32_t end;
+
+				if (vl->Left == 0)
+				{
+					if (!dsp_resampler20_fill(vl->Rs, FALSE) && (end = voice_end_of_source(&vl->Pulls, frame + done)))
+					{
+						vl->Stop = end;
+						results[vl->Voice] = FALSE;
+						if (chunk > end - frame) chunk = end - frame;
+					}
+
+					dsp_resampler20_unmap(vl->Rs);    // the buffer is already allocated
+
+					step[k] = vl->Rs->step;            // the initial fill may select a mip level
+					vl->Left = dsp_resampler20_frames_to_refill(vl->Rs->pos, vl->Rs->step);
+				}
+
+				if (vl->Left < (uint32_t)n) n = vl->Left;
+				pos[k] = vl->Rs->pos;
+			}
+
+			if (n > chunk - done) n = chunk - done;
+
+			voff = _mm256_loadu_si256((__m256i*)offs);
+			vpos = _mm256_loadu_si256((__m256i*)pos);
+			vstep = _mm256_loadu_si256((__m256i*)step);
+			vmask = _mm256_loadu_si256((__m256i*)fmask);
+
+			for (i = 0; i < n; i++)
+			{
+				__m256i x, s1, dy, frac;
+
+				// Resampling: both neighbour samples are gathered at once. Only the lower 16
+				// bits of the result are stored in the delay buffer, so it is calculated in
+				// 16-bit halves of lanes. The 17-bit difference of samples is split into its
+				// lower 16 bits and the sign, which subtracts the fraction, when negative.
+				// Lanes with nearest neighbour resampler have the fraction masked to 0.
+
+				x = _mm256_i32gather_epi32((const int*)base, _mm256_add_epi32(voff, _mm256_srli_epi32(vpos, 16)), 2);
+				s1 = _mm256_srli_epi32(x, 16);
+				frac = _mm256_and_si256(vpos, vmask);
+				dy = _mm256_mulhi_epu16(_mm256_sub_epi16(s1, x), frac);
+				dy = _mm256_sub_epi16(dy, _mm256_and_si256(_mm256_cmpgt_epi16(x, s1), frac));
+				_mm256_storeu_si256((__m256i*)row, _mm256_add_epi16(x, dy));
+				row += VOICE_LANES;
+				vpos = _mm256_add_epi32(vpos, vstep);
+			}
+
+			_mm256_storeu_si256((__m256i*)pos, vpos);
+			for (k = 0; k < active; k++)
+			{
+				lanes[k].Rs->pos = pos[k];
+				lanes[k].Left -= n;
+			}
+
+			done += n;
+		}
+
+		accu = voice_lanes_mix(tile, accu, chunk, gl, gr, dl, dr, delays);
+
+		// Panoramizer history is stored back, voices which have ended are removed.
+
+		frame += chunk;
+
+		for (k = 0; k < active; k++)
+		{
+			for (i = 0; i < 64; i++) lanes[k].Pan->DelBuf[i] = tile[(chunk + i) * VOICE_LANES + k];
+		}
+
+		for (k = active - 1; k >= 0; k--)
+		{
+			if (lanes[k].Stop == frame) lanes[k] = lanes[--active];
+		}
+	}
+
+	return TRUE;
+}
+
+#else   /* MIXER_X86 */
+
+int dsp_voice_mix_lanes(UNUSED struct DSPObject **panoramizers, UNUSED int32_t *gains, UNUSED int *results,
+	UNUSED int count, UNUSED int32_t *accu, UNUSED int32_t frames, UNUSED uint32_t *cuts, UNUSED int cut_count)
+{
+	return FALSE;
+}
+
+#endif  /* MIXER_X86 */
+
+
+//==============================================================================================
+// dsp_voice_skip()
+//==============================================================================================
+
+// Advances the instrument chain ending with 'panoramizer' by 'frames' frames without rendering
+// them (muted track). The resampler position and source state are advanced analytically. Only
+// the last 64 frames are resampled, as the panoramizer keeps them as history. The source is
+// pulled with data only for the last two buffer fills, whose data may be used later. Then the
+// state of chain is exactly the same as after dsp_voice_mix(), and so is the return value.
+
+int dsp_voice_skip(struct DSPObject *panoramizer, int32_t frames)
+{
+	struct Panoramizer *pan = (struct Panoramizer*)panoramizer;
+	struct Resampler20 *rs = (struct Resampler20*)panoramizer->dsp_prev;
+	int leave_active = TRUE;
+	int32_t frame = 0;                   // number of the current frame
+	int32_t history = frames - 64;       // number of the first frame kept in history
+
+	while (frame < frames)
+	{
+		int32_t done = 0, chunk = frames - frame;
+		int i;
+
+		if (chunk > 1024) chunk = 1024;
+		leave_active = TRUE;
+
+		while (done < chunk)
+		{
+			uint32_t n = chunk - done, run, skip;
+
+			// Buffer data are needed, if frames generated from this buffer, or from the
+			// next one (which takes 16 samples from this one), get into history.
+
+			if (rs->flushed || (rs->pos >= RESAMPLER20_REFILL_POS))
+			{
+				uint32_t pos, next, discard;
+
+				if (rs->flushed) dsp_resampler20_select_level(rs);
+				pos = rs->flushed ? 0 : rs->pos - RESAMPLER20_REFILL_POS;
+				run = dsp_resampler20_frames_to_refill(pos, rs->step);
+				next = pos + run * rs->step - RESAMPLER20_REFILL_POS;
+				run += dsp_resampler20_frames_to_refill(next, rs->step);
+				discard = (frame + done + (int64_t)run <= history);
+				if (!dsp_resampler20_fill(rs, discard)) leave_active = FALSE;
+			}
+
+			if ((run = dsp_resampler20_frames_to_refill(rs->pos, rs->step)) < n) n = run;
+
+			// Frames before history are skipped, others are resampled.
+
+			skip = n;
+
+			if (frame + done + (int32_t)n > history)
+			{
+				skip = 0;
+				if (frame + done < history) skip = history - frame - done;
+			}
+
+			rs->pos += skip * rs->step;
+			rs->pos = voice_run(rs, &pan->DelBuf[64 + done + skip], NULL, n - skip, pan->DelL, pan->DelR, 0, 0, FALSE);
+			done += n;
+		}
+
+		for (i = 0; i < 64; i++) pan->DelBuf[i] = pan->DelBuf[chunk + i];
+		frame += chunk;
+	}
+
+	return leave_active;
+}
@@ -49,6 +49,15 @@ struct TPoint
 
 // Main wavetable DSP object structure.
 
+// Positions and lengths are in frames of the current mip level. Level 0 is the sample itself.
+// An instrument played forwards at level 0 is read from the loop image if it has one. The
+// position is kept below the end of the first cycle plus 16 frames of history by wrapping it
+// by whole cycles, so a full source block can always be mapped from the image.
+
+// An instrument played backwards at level 0 is read from the reversed copy of the sample, once
+// it is made. Then the instrument is mirrored: the position, direction and loop are converted
+// to the copy, and the unroller plays it as if it was triggered without E3x.
+
 struct SampledInstrument
 {
 	struct DSPObject object;
@@ -57,6 +66,17 @@ struct SampledInstrument
 	int32_t CurPos;             // current position, the first sample to be sent in the next chunk
 	int32_t LoopFirst;          // the first sample in loop
 	int32_t LoopLast;           // the last sample in loop
+	int16_t *Levels[DB3_MIP_LEVELS + 1];
+	int32_t Frames;             // length of level 0
+	int32_t Level0LoopFirst;
+	int32_t Level0LoopLast;
+	int Level;                  // current mip level
+	int16_t *Image;             // loop image of the instrument, NULL if none
+	int32_t ImageCycle;         // length of loop cycle in the image
+	int32_t ImageEnd;           // length of the image
+	int InImage;                // CurPos is a position in the image, turnpoints are not used
+	int16_t **Reversed;         // slot of the reversed copy in the sample, filled when it is made
+	int Mirrored;               // CurPos, CurDir and loop are in the reversed copy
 	int CurDir;                 // current direction of unrolling
 	int LoopType;               // type of loop
 	int BackwardsPlay;          // true if instrument has been triggered with E3x
@@ -80,6 +100,20 @@ struct SampledInstrument
 
 void dsp_sampled_instr_regenerate(struct SampledInstrument *smi)
 {
+	int backwards = smi->BackwardsPlay;
+
+	if (smi->Mirrored)
+	{
+		smi->LoopFirst = smi->Frames - 1 - smi->Level0LoopLast;
+		smi->LoopLast = smi->Frames - 1 - smi->Level0LoopFirst;
+		backwards = FALSE;
+	}
+	else
+	{
+		smi->LoopFirst = smi->Level0LoopFirst >> smi->Level;
+		smi->LoopLast = ((smi->Level0LoopLast + 1) >> smi->Level) - 1;
+	}
+
 	if (smi->LoopType == IF_NO_LOOP)
 	{
 		smi->Tp1 = NULL;
@@ -87,7 +121,7 @@ void dsp_sampled_instr_regenerate(struct SampledInstrument *smi)
 	}
 	else if (smi->LoopType == IF_FORWARD_LOOP)
 	{
-		if (smi->BackwardsPlay)
+		if (backwards)
 		{
 			smi->TpA.Position = smi->LoopFirst;
 			smi->TpA.ActDir = TPDIR_REV;
@@ -127,6 +161,143 @@ void dsp_sampled_instr_regenerate(struct SampledInstrument *smi)
 }
 
 
+//==============================================================================================
+// dsp_sampled_instr_levels()
+//==============================================================================================
+
+// Number of mip levels above 0, which can be played. Loop points must be at exact positions of
+// a level.
+
+static int dsp_sampled_instr_levels(struct SampledInstrument *smi)
+{
+	int count = 0;
+
+	while ((count < DB3_MIP_LEVELS) && smi->Levels[count + 1])
+	{
+		if ((smi->LoopType != IF_NO_LOOP) && ((smi->Level0LoopFirst | (smi->Level0LoopLast + 1)) & ((2 << count) - 1))) break;
+		count++;
+	}
+
+	return count;
+}
+
+
+//==============================================================================================
+// dsp_sampled_instr_select_level()
+//==============================================================================================
+
+// The position is rescaled to the new level. Loop points are rescaled by the caller regenerating
+// turnpoints.
+
+static void dsp_sampled_instr_select_level(struct SampledInstrument *smi, int level)
+{
+	if ((level < 0) || (level > dsp_sampled_instr_levels(smi))) level = 0;
+	smi->CurPos = (smi->CurPos << smi->Level) >> level;
+	smi->Level = level;
+	smi->AudioData = smi->Levels[level];
+	smi->AudioLength = (smi->Frames + (1 << level) - 1) >> level;
+}
+
+
+//==============================================================================================
+// dsp_sampled_instr_image_position()
+//==============================================================================================
+
+// Converts the position in the loop image to the position and direction in the sample.
+
+static void dsp_sampled_instr_image_position(struct SampledInstrument *smi, int32_t *pos, int *dir)
+{
+	int32_t len = smi->Level0LoopLast - smi->Level0LoopFirst + 1;
+	int32_t j;
+
+	*pos = smi->CurPos;
+	*dir = TPDIR_FWD;
+	if (smi->CurPos <= smi->Level0LoopLast + 1) return;
+	j = (smi->CurPos - smi->Level0LoopFirst) % smi->ImageCycle;
+
+	if (j < len) *pos = smi->Level0LoopFirst + j;
+	else
+	{
+		*pos = smi->Level0LoopFirst + (len << 1) - j;     // the next sample is *pos - 1
+		*dir = TPDIR_REV;
+	}
+}
+
+
+//==============================================================================================
+// dsp_sampled_instr_leave_image()
+//==============================================================================================
+
+static void dsp_sampled_instr_leave_image(struct SampledInstrument *smi)
+{
+	if (smi->InImage)
+	{
+		dsp_sampled_instr_image_position(smi, &smi->CurPos, &smi->CurDir);
+		smi->AudioData = smi->Levels[smi->Level];
+		smi->InImage = FALSE;
+	}
+}
+
+
+//==============================================================================================
+// dsp_sampled_instr_enter_image()
+//==============================================================================================
+
+// The sample played forwards from any position up to the loop end is the same as the image.
+
+static void dsp_sampled_instr_enter_image(struct SampledInstrument *smi)
+{
+	if (!smi->InImage && smi->Image && (smi->Level == 0) && !smi->BackwardsPlay && (smi->CurDir == TPDIR_FWD)
+	 && (smi->CurPos <= smi->Level0LoopLast + 1))
+	{
+		smi->AudioData = smi->Image;
+		smi->InImage = TRUE;
+	}
+}
+
+
+//==============================================================================================
+// dsp_sampled_instr_mirror()
+//==============================================================================================
+
+// The reversed copy read forwards from 'Frames - pos' gives the same samples as the sample read
+// backwards from 'pos', and vice versa, so the conversion is the same both ways.
+
+static void dsp_sampled_instr_mirror(struct SampledInstrument *smi, int16_t *data)
+{
+	smi->CurPos = smi->Frames - smi->CurPos;
+	smi->CurDir = (smi->CurDir == TPDIR_FWD) ? TPDIR_REV : TPDIR_FWD;
+	smi->AudioData = data;
+	smi->Mirrored = !smi->Mirrored;
+	dsp_sampled_instr_regenerate(smi);
+}
+
+
+//==============================================================================================
+// dsp_sampled_instr_leave_mirror()
+//==============================================================================================
+
+static void dsp_sampled_instr_leave_mirror(struct SampledInstrument *smi)
+{
+	if (smi->Mirrored) dsp_sampled_instr_mirror(smi, smi->Levels[0]);
+}
+
+
+//==============================================================================================
+// dsp_sampled_instr_enter_mirror()
+//==============================================================================================
+
+static void dsp_sampled_instr_enter_mirror(struct SampledInstrument *smi)
+{
+	int16_t *reversed;
+
+	if (!smi->Mirrored && smi->BackwardsPlay && (smi->Level == 0) && smi->Reversed && (reversed = *smi->Reversed))
+	{
+		dsp_sampled_instr_mirror(smi, reversed);
+	}
+}
+
+
 //==============================================================================================
 // dsp_sampled_instr_set()
 //==============================================================================================
@@ -134,10 +305,27 @@ void dsp_sampled_instr_regenerate(struct SampledInstrument *smi)
 void dsp_sampled_instr_set(struct DSPObject *obj, struct DSPTag *tags)
 {
 	struct SampledInstrument *smi = (struct SampledInstrument*)obj;
-	int regenerate = FALSE;
+	int regenerate = FALSE, image = FALSE;
 
 	while (tags->dspt_tag)
 	{
+		// Attributes changing position or loop are applied to the sample.
+
+		switch (tags->dspt_tag)
+		{
+			case DSPA_ReversePlay:
+			case DSPA_LoopFirst:
+			case DSPA_LoopLast:
+			case DSPA_LoopType:
+			case DSPA_SampleOffset:
+			case DSPA_LimitOffsetToLoop:
+			case DSPA_MipLevel:
+				dsp_sampled_instr_leave_image(smi);
+				dsp_sampled_instr_leave_mirror(smi);
+				image = TRUE;
+			break;
+		}
+
 		switch (tags->dspt_tag)
 		{
 			case DSPA_ReversePlay:
@@ -147,23 +335,26 @@ void dsp_sampled_instr_set(struct DSPObject *obj, struct DSPTag *tags)
 			break;
 
 			case DSPA_LoopFirst:
-				smi->LoopFirst = tags->dspt_data;
+				smi->Level0LoopFirst = tags->dspt_data;
+				smi->Image = NULL;                      // the image has the original loop
 				regenerate = TRUE;
 			break;
 
 			case DSPA_LoopLast:
-				smi->LoopLast = tags->dspt_data;
+				smi->Level0LoopLast = tags->dspt_data;
+				smi->Image = NULL;
 				regenerate = TRUE;
 			break;
 
 			case DSPA_LoopType:
 				smi->LoopType = tags->dspt_data;
+				smi->Image = NULL;
 				regenerate = TRUE;
 			break;
 
 			case DSPA_SampleOffset:
-				if (smi->BackwardsPlay) smi->CurPos = smi->AudioLength - tags->dspt_data;
-				else smi->CurPos = tags->dspt_data;
+				if (smi->BackwardsPlay) smi->CurPos = (smi->Frames - tags->dspt_data) >> smi->Level;
+				else smi->CurPos = tags->dspt_data >> smi->Level;
 
 				if (smi->CurPos > smi->AudioLength) smi->CurPos = smi->AudioLength;
 				else if (smi->CurPos < 0) smi->CurPos = 0;
@@ -176,20 +367,74 @@ void dsp_sampled_instr_set(struct DSPObject *obj, struct DSPTag *tags)
 					if (smi->CurPos > smi->LoopLast) smi->CurPos = smi->LoopLast;
 				}
 			break;
+
+			case DSPA_MipLevel:
+				if (tags->dspt_data != smi->Level)
+				{
+					dsp_sampled_instr_select_level(smi, tags->dspt_data);
+					regenerate = TRUE;
+				}
+			break;
 		}
 
 		tags++;
 	}
 
 	if (regenerate) dsp_sampled_instr_regenerate(smi);
+	if (image)
+	{
+		dsp_sampled_instr_enter_image(smi);
+		dsp_sampled_instr_enter_mirror(smi);
+	}
+
 	return;
 }
 
 
+//==============================================================================================
+// dsp_sampled_instr_pull_image()
+//==============================================================================================
+
+// The image never ends, samples are copied in blocks up to its end.
+
+static int dsp_sampled_instr_pull_image(struct SampledInstrument *smi, int16_t *dest, int32_t requested)
+{
+	int32_t delivered = 0;
+
+	while (delivered < requested)
+	{
+		int32_t block = requested - delivered;
+
+		if (block > smi->ImageEnd - smi->CurPos) block = smi->ImageEnd - smi->CurPos;
+
+		if (dest)
+		{
+			db3_memcpy(dest, &smi->Image[smi->CurPos], block * sizeof(int16_t));
+			dest += block;
+		}
+
+		delivered += block;
+		smi->CurPos += block;
+
+		if (smi->CurPos >= smi->ImageEnd - 1024)
+		{
+			int32_t first = smi->Level0LoopFirst + 16;
+
+			smi->CurPos -= (smi->CurPos - first) / smi->ImageCycle * smi->ImageCycle;
+		}
+	}
+
+	return delivered;
+}
+
+
 //==============================================================================================
 // dsp_sampled_instr_pull()
 //==============================================================================================
 
+// If 'dest' is NULL, samples are skipped. Position and loop state are advanced exactly as if
+// samples were copied.
+
 int dsp_sampled_instr_pull(struct DSPObject *obj, int16_t *dest, int32_t requested)
 {
 	struct SampledInstrument *smi = (struct SampledInstrument*)obj;
@@ -197,6 +442,8 @@ int dsp_sampled_instr_pull(struct DSPObject *obj, int16_t *dest, int32_t request
 	int32_t block;
 	int end_of_instrument = FALSE;
 
+	if (smi->InImage) return dsp_sampled_instr_pull_image(smi, dest, requested);
+
 	// The main loop is driven by number of samples requested.
 
 	while (!end_of_instrument && ((block = requested - delivered) > 0))
@@ -245,8 +492,12 @@ int dsp_sampled_instr_pull(struct DSPObject *obj, int16_t *dest, int32_t request
 
 			// Trimmed request execution. Audio samples first, zero padding then if needed.
 
-			s = &smi->AudioData[smi->CurPos];
-			for (i = 0; i < block; i++) { *dest++ = *s++; }
+			if (dest)
+			{
+				s = &smi->AudioData[smi->CurPos];
+				for (i = 0; i < block; i++) { *dest++ = *s++; }
+			}
+
 			smi->CurPos += block;
 		}
 		else
@@ -285,8 +536,12 @@ int dsp_sampled_instr_pull(struct DSPObject *obj, int16_t *dest, int32_t request
 
 			// Trimmed request execution. Audio samples first, zero padding then if needed.
 
-			s = &smi->AudioData[smi->CurPos];
-			for (i = 0; i < block; i++) { *dest++ = *--s; }
+			if (dest)
+			{
+				s = &smi->AudioData[smi->CurPos];
+				for (i = 0; i < block; i++) { *dest++ = *--s; }
+			}
+
 			smi->CurPos -= block;
 		}
 
@@ -306,6 +561,42 @@ int dsp_sampled_instr_pull(struct DSPObject *obj, int16_t *dest, int32_t request
 }
 
 
+//==============================================================================================
+// dsp_sampled_instr_map()
+//==============================================================================================
+
+// Samples are contiguous when played forwards and no turnpoint is met. Zeros after the end of
+// instrument are provided by the guard region of the sample.
+
+int32_t dsp_sampled_instr_map(struct DSPObject *obj, int16_t **data, int32_t requested)
+{
+	struct SampledInstrument *smi = (struct SampledInstrument*)obj;
+
+	if (smi->InImage)
+	{
+		if (smi->CurPos + requested > smi->ImageEnd) return -1;
+		*data = &smi->Image[smi->CurPos];
+		return requested;
+	}
+
+	if (smi->CurDir != TPDIR_FWD) return -1;
+
+	if (smi->Tp1)
+	{
+		if (is_in_range_fwd(smi->Tp1->Position, smi->CurPos, requested) && (smi->Tp1->ActDir == TPDIR_FWD)) return -1;
+	}
+
+	if (smi->Tp2)
+	{
+		if (is_in_range_fwd(smi->Tp2->Position, smi->CurPos, requested) && (smi->Tp2->ActDir == TPDIR_FWD)) return -1;
+	}
+
+	*data = &smi->AudioData[smi->CurPos];
+	if (smi->CurPos + requested > smi->AudioLength) return smi->AudioLength - smi->CurPos;
+	return requested;
+}
+
+
 //==============================================================================================
 // dsp_sampled_instr_dispose()
 //==============================================================================================
@@ -335,22 +626,69 @@ void dsp_sampled_instr_flush(UNUSED struct DSPObject *obj0)
 int dsp_sampled_instr_get(struct DSPObject *obj, uint32_t attr, int32_t *storage)
 {
 	struct SampledInstrument *dsp = (struct SampledInstrument*)obj;
+	int dir;
 
 	switch (attr)
 	{
-		case DSPA_SampleOffset:    *storage = dsp->CurPos;   return 1;
+		case DSPA_SampleOffset:
+			if (dsp->InImage) dsp_sampled_instr_image_position(dsp, storage, &dir);
+			else if (dsp->Mirrored) *storage = dsp->Frames - dsp->CurPos;
+			else *storage = dsp->CurPos << dsp->Level;
+		return 1;
+
+		case DSPA_MipLevels:       *storage = dsp_sampled_instr_levels(dsp);       return 1;
 	}
 
 	return 0;
 }
 
 
+//==============================================================================================
+// dsp_sampled_instr_bind()
+//==============================================================================================
+
+// Sets the sample and loop played by the wavetable and resets its state, as if it has been just
+// created. 'mips' is a table of DB3_MIP_LEVELS pointers to mip levels 1 to 3 of the sample, NULL
+// if the sample has none. 'reversed' points to the reversed copy of the sample, which may be made
+// later, or is NULL. 'image' is the loop image of the instrument, or NULL.
+
+void dsp_sampled_instr_bind(struct DSPObject *obj, int16_t *data, int16_t **mips, int16_t **reversed, int16_t *image,
+ int32_t loop_start, int32_t loop_len, UNUSED int32_t loop_count, int32_t total_frames, int loop_type)
+{
+	struct SampledInstrument *smi = (struct SampledInstrument*)obj;
+	int level;
+
+	smi->AudioData = data;
+	smi->AudioLength = total_frames;
+	smi->Levels[0] = data;
+	for (level = 1; level <= DB3_MIP_LEVELS; level++) smi->Levels[level] = mips ? mips[level - 1] : NULL;
+	smi->Frames = total_frames;
+	smi->Level = 0;
+	smi->BackwardsPlay = FALSE;
+	smi->Level0LoopFirst = loop_start;
+	smi->Level0LoopLast = loop_start + loop_len - 1;
+	smi->Image = (loop_type != IF_NO_LOOP) ? image : NULL;
+	smi->ImageCycle = (loop_type == IF_FORWARD_LOOP) ? loop_len : loop_len << 1;
+	smi->ImageEnd = loop_start + smi->ImageCycle + DB3_LOOP_IMAGE_EXTRA;
+	smi->InImage = FALSE;
+	smi->Reversed = reversed;
+	smi->Mirrored = FALSE;
+	smi->LoopType = loop_type;
+	smi->CurPos = 0;
+	smi->CurDir = TPDIR_FWD;
+
+	dsp_sampled_instr_regenerate(smi);
+}
+
+
 //==============================================================================================
 // dsp_sampled_instr_new()
 //==============================================================================================
 
-struct DSPObject *dsp_sampled_instr_new(int16_t *data, int32_t loop_start,
- int32_t loop_len, UNUSED int32_t loop_count, int32_t total_frames, int loop_type)
+// Arguments are described at dsp_sampled_instr_bind().
+
+struct DSPObject *dsp_sampled_instr_new(int16_t *data, int16_t **mips, int16_t **reversed, int16_t *image, int32_t loop_start,
+ int32_t loop_len, int32_t loop_count, int32_t total_frames, int loop_type)
 {
 	struct SampledInstrument *smi;
 
@@ -362,17 +700,8 @@ struct DSPObject *dsp_sampled_instr_new(int16_t *data, int32_t loop_start,
 		smi->object.dsp_set = dsp_sampled_instr_set;
 		smi->object.dsp_get = dsp_sampled_instr_get;
 		smi->object.dsp_flush = dsp_sampled_instr_flush;
-
-		smi->AudioData = data;
-		smi->AudioLength = total_frames;
-		smi->BackwardsPlay = FALSE;
-		smi->LoopFirst = loop_start;
-		smi->LoopLast = loop_start + loop_len - 1;
-		smi->LoopType = loop_type;
-		smi->CurPos = 0;
-		smi->CurDir = TPDIR_FWD;
-
-		dsp_sampled_instr_regenerate(smi);
+		smi->object.dsp_map = dsp_sampled_instr_map;
+		dsp_sampled_instr_bind(&smi->object, data, mips, reversed, image, loop_start, loop_len, loop_count, total_frames, loop_type);
 		return &smi->object;
 	}
 
@@ -38,6 +38,11 @@
 
 
 
+// Padding is mapped from this block. The first 16 zeros are history before the span.
+
+static int16_t PadZeros[16 + 1024];
+
+
 struct ZeroPadder
 {
 	struct DSPObject Object;
@@ -53,8 +58,27 @@ struct ZeroPadder
 // dsp_zeropadder_set()
 //==============================================================================================
 
-void dsp_zeropadder_set(UNUSED struct DSPObject *obj, UNUSED struct DSPTag *tags)
+// Mip level selection is passed to the wavetable, padding does not depend on it.
+
+void dsp_zeropadder_set(struct DSPObject *obj, struct DSPTag *tags)
 {
+	struct DSPObject *prev = obj->dsp_prev;
+
+	while (tags->dspt_tag)
+	{
+		switch (tags->dspt_tag)
+		{
+			case DSPA_MipLevel:
+			{
+				struct DSPTag forward[] = {{ DSPA_MipLevel, tags->dspt_data }, { TAG_END, 0 }};
+
+				prev->dsp_set(prev, forward);
+			}
+			break;
+		}
+
+		tags++;
+	}
 }
 
 
@@ -63,6 +87,8 @@ void dsp_zeropadder_set(UNUSED struct DSPObject *obj, UNUSED struct DSPTag *tags
 // dsp_zeropadder_pull()
 //==============================================================================================
 
+// NULL 'dest' skips data, see dsp_sampled_instr_pull().
+
 int dsp_zeropadder_pull(struct DSPObject *obj, int16_t *dest, int32_t requested)
 {
 	struct ZeroPadder *zpd = (struct ZeroPadder*)obj;
@@ -80,7 +106,7 @@ int dsp_zeropadder_pull(struct DSPObject *obj, int16_t *dest, int32_t requested)
 	if (blocksize > 0)
 	{
 		if (blocksize > requested) blocksize = requested;
-		for (i = 0; i < blocksize; i++) *dest++ = 0;
+		if (dest) for (i = 0; i < blocksize; i++) *dest++ = 0;
 		delivered += blocksize;
 		requested -= blocksize;
 		zpd->LeadInCtr -= blocksize;
@@ -95,6 +121,7 @@ int dsp_zeropadder_pull(struct DSPObject *obj, int16_t *dest, int32_t requested)
 		prev = zpd->Object.dsp_prev;
 		blocksize = prev->dsp_pull(prev, dest, requested);
 		if (blocksize < requested) zpd->MoreData = FALSE;
+		if (dest) dest += blocksize;
 		delivered += blocksize;
 		requested -= blocksize;
 	}
@@ -108,7 +135,7 @@ int dsp_zeropadder_pull(struct DSPObject *obj, int16_t *dest, int32_t requested)
 
 	if (blocksize > 0)
 	{
-		for (i = 0; i < blocksize; i++) *dest++ = 0;
+		if (dest) for (i = 0; i < blocksize; i++) *dest++ = 0;
 		delivered += blocksize;
 		zpd->LeadOutCtr -= blocksize;
 	}
@@ -118,6 +145,41 @@ int dsp_zeropadder_pull(struct DSPObject *obj, int16_t *dest, int32_t requested)
 
 
 
+//==============================================================================================================================
+// dsp_zeropadder_map()
+//==============================================================================================================================
+
+// Lead in is mapped when it covers the whole request. Instrument data are mapped from the source,
+// lead out follows them, as the source is followed by zeros.
+
+int32_t dsp_zeropadder_map(struct DSPObject *obj, int16_t **data, int32_t requested)
+{
+	struct ZeroPadder *zpd = (struct ZeroPadder*)obj;
+	struct DSPObject *prev = zpd->Object.dsp_prev;
+	int32_t delivered = 0;
+
+	if (requested > 1024) return -1;
+
+	if (zpd->LeadInCtr > 0)
+	{
+		if (zpd->LeadInCtr < requested) return -1;
+		*data = &PadZeros[16];
+		return requested;
+	}
+
+	if (zpd->MoreData)
+	{
+		if (!prev->dsp_map || ((delivered = prev->dsp_map(prev, data, requested)) < 0)) return -1;
+		if (delivered == requested) return delivered;
+	}
+	else *data = &PadZeros[16];
+
+	if (zpd->LeadOutCtr < requested - delivered) return delivered + zpd->LeadOutCtr;
+	return requested;
+}
+
+
+
 //==============================================================================================================================
 // dsp_zeropadder_dispose()
 //==============================================================================================================================
@@ -148,13 +210,38 @@ void dsp_zeropadder_flush(struct DSPObject *obj)
 // dsp_zeropadder_get()
 //==============================================================================================================================
 
-int dsp_zeropadder_get(UNUSED struct DSPObject *obj, UNUSED uint32_t attr, UNUSED int32_t *storage)
+int dsp_zeropadder_get(struct DSPObject *obj, uint32_t attr, int32_t *storage)
 {
+	struct DSPObject *prev = obj->dsp_prev;
+
+	switch (attr)
+	{
+		case DSPA_MipLevels:   return prev->dsp_get(prev, attr, storage);
+	}
+
 	return 0;
 }
 
 
 
+//==============================================================================================================================
+// dsp_zeropadder_bind()
+//==============================================================================================================================
+
+// Sets the padding and resets the state, as if the object has been just created.
+
+void dsp_zeropadder_bind(struct DSPObject *obj, int padframes)
+{
+	struct ZeroPadder *zpd = (struct ZeroPadder*)obj;
+
+	zpd->PadSize = padframes;
+	zpd->LeadInCtr = padframes;
+	zpd->LeadOutCtr = padframes;
+	zpd->MoreData = TRUE;
+}
+
+
+
 //==============================================================================================================================
 // dsp_zeropadder_new()
 //==============================================================================================================================
@@ -171,10 +258,8 @@ struct DSPObject* dsp_zeropadder_new(int padframes)
 		zpd->Object.dsp_set = dsp_zeropadder_set;
 		zpd->Object.dsp_get = dsp_zeropadder_get;
 		zpd->Object.dsp_flush = dsp_zeropadder_flush;
-		zpd->PadSize = padframes;
-		zpd->LeadInCtr = padframes;
-		zpd->LeadOutCtr = padframes;
-		zpd->MoreData = TRUE;
+		zpd->Object.dsp_map = dsp_zeropadder_map;
+		dsp_zeropadder_bind(&zpd->Object, padframes);
 		return &zpd->Object;
 	}
 
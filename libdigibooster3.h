@@ -76,12 +76,32 @@ struct AbstractHandle
 
 struct DB3Module *DB3_Load(char *filename, int *errptr);
 void DB3_Unload(struct DB3Module* module);
+int DB3_BuildMipLevels(struct DB3Module *module);
+int DB3_UnrollLoops(struct DB3Module *module);
+void DB3_SetReverseBudget(struct DB3Module *module, int32_t bytes);
 void* DB3_NewEngine(struct DB3Module *module, uint32_t mixfreq, uint32_t bufsize);
+void* DB3_NewEngineEx(struct DB3Module *module, uint32_t mixfreq, uint32_t bufsize, uint32_t flags);
 void DB3_SetCallback(void *engine, void(*callback)(void*, struct UpdateEvent*), void *userdata);
 void DB3_SetVolume(void *engine, int16_t level);
 void DB3_SetPos(void *engine, uint32_t song, uint32_t order, uint32_t row);
 uint32_t DB3_Mix(void *engine, uint32_t frames, int16_t *out);
+uint32_t DB3_MixInt32(void *engine, uint32_t frames, int32_t *out, uint32_t layout);
+uint32_t DB3_MixFloat(void *engine, uint32_t frames, float *out, uint32_t layout);
+uint32_t DB3_MixAdd(void *engine, uint32_t frames, int32_t *bus, uint32_t gain);
+void DB3_FlushBus(int32_t *bus, uint32_t frames, int16_t *out);
+void DB3_SetTrackMute(void *engine, uint32_t track, int mute);
+void DB3_SetTrackSolo(void *engine, uint32_t track, int solo);
+uint32_t DB3_SetThreads(void *engine, uint32_t threads);
+uint32_t DB3_SetQuality(void *engine, uint32_t quality);
+uint32_t DB3_GetQuality(void *engine);
+void DB3_SetOneShotCache(void *engine, uint32_t bytes);
+void DB3_GetOneShotStats(void *engine, uint32_t *hits, uint32_t *misses);
 void DB3_DisposeEngine(void *engine);
+void* DB3_NewScheduler(uint32_t threads, uint32_t blockframes, uint32_t depth);
+void* DB3_AddStream(void *scheduler, void *engine);
+uint32_t DB3_ReadStream(void *stream, int16_t *out, int wait);
+void DB3_RemoveStream(void *stream);
+void DB3_DisposeScheduler(void *scheduler);
 
 
 
@@ -89,6 +109,30 @@ void DB3_DisposeEngine(void *engine);
 #define MAX_STEREO_PHASE_SHIFT_USEC  333
 
 
+/* output layouts for DB3_MixInt32() and DB3_MixFloat() */
+
+#define DB3_LAYOUT_INTERLEAVED                 0
+#define DB3_LAYOUT_PLANAR                      1
+
+
+/* resampler selection in flags of DB3_NewEngineEx() */
+
+#define DB3_RESAMPLER_LINEAR                   0
+#define DB3_RESAMPLER_CUBIC                    1
+#define DB3_RESAMPLER_SINC                     2
+#define DB3_RESAMPLER_NEAREST                  3
+#define DB3_RESAMPLER_MASK                     0x0000000F
+
+
+/* quality tiers for DB3_SetQuality() */
+
+#define DB3_QUALITY_PREVIEW                    0
+#define DB3_QUALITY_NORMAL                     1
+#define DB3_QUALITY_MASTER                     2
+#define DB3_QUALITY_MASK                       0x0000000F
+#define DB3_QUALITY_GOVERNOR                   0x00000010
+
+
 /* error codes */
 
 #define DB3_ERROR_NONE                         0
@@ -134,6 +178,18 @@ extern struct Library *SysBase;
 #endif
 
 
+/* Atomic operations for data shared by engines playing the same module. Without threads */
+/* (see pool.h) engines are never run in parallel.                                      */
+
+#if (defined TARGET_LINUX)
+#define db3_atomic_add(ptr, v) __sync_add_and_fetch(ptr, v)
+#define db3_atomic_cas(ptr, old, new) __sync_bool_compare_and_swap(ptr, old, new)
+#else
+#define db3_atomic_add(ptr, v) (*(ptr) += (v))
+#define db3_atomic_cas(ptr, old, new) ((*(ptr) == (old)) ? (*(ptr) = (new), 1) : 0)
+#endif
+
+
 /* File I/O */
 
 #if (defined TARGET_MORPHOS) || (defined TARGET_AMIGAOS3) || (defined TARGET_AMIGAOS4)
@@ -63,6 +63,17 @@ struct MinList
 #endif
 
 
+#define ITERATE_LIST(listptr, type, var) \
+for (var = (type)((struct MinList*)listptr)->mlh_Head; \
+ ((struct MinNode*)var)->mln_Succ; \
+ var = (type)((struct MinNode*)var)->mln_Succ)
+
+#define INIT_LIST(listptr) \
+((struct MinList*)listptr)->mlh_Head = (struct MinNode*)&((struct MinList*)listptr)->mlh_Tail; \
+((struct MinList*)listptr)->mlh_Tail = NULL; \
+((struct MinList*)listptr)->mlh_TailPred = (struct MinNode*)&((struct MinList*)listptr)->mlh_Head;
+
+
 static inline void DB3AddTail(struct MinList *list, struct MinNode *node)
 {
 	struct MinNode *tailpred;
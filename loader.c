@@ -29,6 +29,8 @@
 
 #include "libdigibooster3.h"
 
+#include <math.h>
+
 /* Pattern decoder state machine states */
 
 #define DBM0_TRACKNUM  1
@@ -825,8 +827,12 @@ static int read_sample(struct DataChunk *dc, struct DB3ModSample *ms, struct Abs
 		{
 			if (ms->Frames > 0)   // there may be samples of 0 length
 			{
-				if (ms->Data = db3_malloc(ms->Frames * sizeof(int16_t)))
+				int16_t *guarded;
+
+				if (guarded = db3_malloc((DB3_SAMPLE_GUARD_BEFORE + ms->Frames + DB3_SAMPLE_GUARD_AFTER) * sizeof(int16_t)))
 				{
+					ms->Data = guarded + DB3_SAMPLE_GUARD_BEFORE;
+
 					switch (b[3] & 0x07)  // bytes per sample
 					{
 						case 1:   error = read_sample_data_8bit(dc, ms, ah, loadbuf);    break;
@@ -866,7 +872,7 @@ static int read_chunk_smpl(struct DB3Module *m, struct DataChunk *dc, struct Abs
 				}
 				else
 				{
-					if (ms->Data) db3_free(ms->Data);
+					if (ms->Data) db3_free(ms->Data - DB3_SAMPLE_GUARD_BEFORE);
 					db3_free(ms);
 					break;
 				}
@@ -1199,6 +1205,21 @@ static int read_header(struct DB3Module *m, struct AbstractHandle *ah)
 
 
 
+static void free_mip_levels(struct DB3ModSample *ms)
+{
+	int level;
+
+	for (level = 0; level < DB3_MIP_LEVELS; level++)
+	{
+		if (ms->Mips[level])
+		{
+			db3_free(ms->Mips[level] - DB3_SAMPLE_GUARD_BEFORE);
+			ms->Mips[level] = NULL;
+		}
+	}
+}
+
+
 /****** libdigibooster3/DB3_Unload ******************************************
 *
 * NAME
@@ -1246,7 +1267,9 @@ void DB3_Unload(struct DB3Module *m)
 		{
 			if (m->Samples[i])
 			{
-				if (m->Samples[i]->Data) db3_free(m->Samples[i]->Data);
+				if (m->Samples[i]->Data) db3_free(m->Samples[i]->Data - DB3_SAMPLE_GUARD_BEFORE);
+				if (m->Samples[i]->Reversed) db3_free(m->Samples[i]->Reversed - DB3_SAMPLE_GUARD_BEFORE);
+				free_mip_levels(m->Samples[i]);
 				db3_free(m->Samples[i]);
 			}
 		}
@@ -1256,6 +1279,14 @@ void DB3_Unload(struct DB3Module *m)
 			if (m->Instruments[i])
 			{
 				if (m->Instruments[i]->Name) db3_free(m->Instruments[i]->Name);
+
+				if (m->Instruments[i]->Type == ITYPE_SAMPLE)
+				{
+					struct DB3ModInstrS *mis = (struct DB3ModInstrS*)m->Instruments[i];
+
+					if (mis->LoopImage) db3_free(mis->LoopImage - DB3_SAMPLE_GUARD_BEFORE);
+				}
+
 				db3_free(m->Instruments[i]);
 			}
 		}
@@ -1333,6 +1364,8 @@ struct DB3Module *DB3_LoadFromHandle(struct AbstractHandle *ah, int *errptr)
 
 	if (m = db3_malloc(sizeof(struct DB3Module)))
 	{
+		m->ReverseBudget = DB3_DEFAULT_REVERSE_BUDGET;
+
 		if (!(err = read_header(m, ah)))
 		{
 			if (!(err = read_contents(m, ah)))
@@ -1416,3 +1449,247 @@ struct DB3Module *DB3_Load(char *filename, int *errptr)
 
 	return m;
 }
+
+
+/* Mip levels. Every level is the previous one filtered with a halfband lowpass and decimated   */
+/* twice. The filter is a 31-tap windowed sinc. Samples outside of the data are read from       */
+/* guard regions, so they are zeros.                                                           */
+
+#define MIP_FILTER_HALF              15
+
+
+static void mip_filter(double *h)
+{
+	double sum = 0.0;
+	int n;
+
+	for (n = -MIP_FILTER_HALF; n <= MIP_FILTER_HALF; n++)
+	{
+		double x = 1.0;
+
+		if (n != 0) x = sin(M_PI * n / 2.0) / (M_PI * n / 2.0);
+		x *= 0.42 + 0.5 * cos(M_PI * n / (MIP_FILTER_HALF + 1)) + 0.08 * cos(2.0 * M_PI * n / (MIP_FILTER_HALF + 1));
+		h[n + MIP_FILTER_HALF] = x;
+		sum += x;
+	}
+
+	for (n = 0; n <= 2 * MIP_FILTER_HALF; n++) h[n] /= sum;
+}
+
+
+
+static int16_t *mip_decimate(int16_t *src, int32_t frames, double *h)
+{
+	int16_t *guarded;
+	int32_t i, half = (frames + 1) >> 1;
+
+	if (guarded = db3_malloc((DB3_SAMPLE_GUARD_BEFORE + half + DB3_SAMPLE_GUARD_AFTER) * sizeof(int16_t)))
+	{
+		int16_t *dest = guarded + DB3_SAMPLE_GUARD_BEFORE;
+
+		for (i = 0; i < half; i++)
+		{
+			int16_t *s = &src[2 * i - MIP_FILTER_HALF];
+			double acc = 0.0;
+			int n;
+
+			for (n = 0; n <= 2 * MIP_FILTER_HALF; n++) acc += s[n] * h[n];
+			acc = floor(acc + 0.5);
+			if (acc > 32767.0) acc = 32767.0;
+			else if (acc < -32768.0) acc = -32768.0;
+			dest[i] = (int16_t)acc;
+		}
+
+		return dest;
+	}
+
+	return NULL;
+}
+
+
+/****** libdigibooster3/DB3_BuildMipLevels() ********************************
+*
+* NAME
+*   DB3_BuildMipLevels() -- builds band-limited copies of module samples.
+*
+* SYNOPSIS
+*   int DB3_BuildMipLevels(struct DB3Module *module);
+*
+* FUNCTION
+*   Builds mip levels of all samples of a loaded module. These are copies
+*   of a sample lowpass filtered and decimated 2, 4 and 8 times. When an
+*   instrument is played far above its base pitch, the resampler reads a
+*   mip level instead of the full sample. Then it skips fewer source
+*   samples per output sample, which is faster and aliases less. The level
+*   is selected at note start from the playback pitch.
+*
+*   Mip levels take 7/8 of memory used by the samples. They are freed by
+*   DB3_Unload(). Calling the function again for the same module does
+*   nothing. If it is never called, the module is played as usual.
+*
+* INPUTS
+*   module - a module loaded with DB3_Load() or DB3_LoadFromHandle().
+*
+* RESULT
+*   DB3_ERROR_NONE on success, DB3_ERROR_OUT_OF_MEMORY otherwise. Levels
+*   built before the failure are kept and used.
+*
+* NOTES
+*   Call it before creating engines for the module. Levels are not used
+*   for looped instruments, if the loop start or length is not divisible
+*   by the decimation factor.
+*
+* SEE ALSO
+*   DB3_Load, DB3_LoadFromHandle, DB3_Unload
+*
+*****************************************************************************
+*
+*/
+
+int DB3_BuildMipLevels(struct DB3Module *m)
+{
+	double h[2 * MIP_FILTER_HALF + 1];
+	int i, level;
+
+	mip_filter(h);
+
+	for (i = 0; i < m->NumSamples; i++)
+	{
+		struct DB3ModSample *ms = m->Samples[i];
+		int16_t *src;
+		int32_t frames;
+
+		if (!ms || !ms->Data) continue;
+		src = ms->Data;
+		frames = ms->Frames;
+
+		for (level = 0; level < DB3_MIP_LEVELS; level++)
+		{
+			if (!ms->Mips[level])
+			{
+				if (!(ms->Mips[level] = mip_decimate(src, frames, h))) return DB3_ERROR_OUT_OF_MEMORY;
+			}
+
+			src = ms->Mips[level];
+			frames = (frames + 1) >> 1;
+		}
+	}
+
+	return DB3_ERROR_NONE;
+}
+
+
+/****** libdigibooster3/DB3_UnrollLoops() ***********************************
+*
+* NAME
+*   DB3_UnrollLoops() -- builds unrolled images of looped instruments.
+*
+* SYNOPSIS
+*   int DB3_UnrollLoops(struct DB3Module *module);
+*
+* FUNCTION
+*   Builds a loop image for every looped sample instrument of a loaded
+*   module. The image is the sample as played forwards, with the loop
+*   repeated and pingpong loops played backwards already. Instruments
+*   played forwards read the image linearly, wrapping the position back by
+*   whole loop cycles. Loop turnpoints are not processed then and the
+*   resampler reads source blocks straight from the image.
+*
+*   An image takes as much memory as the sample up to the loop end, plus
+*   the loop length for pingpong loops, plus about 1 kB. Images are freed
+*   by DB3_Unload(). Calling the function again for the same module does
+*   nothing. If it is never called, the module is played as usual.
+*
+* INPUTS
+*   module - a module loaded with DB3_Load() or DB3_LoadFromHandle().
+*
+* RESULT
+*   DB3_ERROR_NONE on success, DB3_ERROR_OUT_OF_MEMORY otherwise. Images
+*   built before the failure are kept and used.
+*
+* NOTES
+*   Call it before creating engines for the module. Images are not used
+*   for instruments played backwards (E3x command) and for mip levels of
+*   samples, see DB3_BuildMipLevels().
+*
+* SEE ALSO
+*   DB3_Load, DB3_LoadFromHandle, DB3_Unload, DB3_BuildMipLevels
+*
+*****************************************************************************
+*
+*/
+
+int DB3_UnrollLoops(struct DB3Module *m)
+{
+	int i;
+
+	for (i = 0; i < m->NumInstr; i++)
+	{
+		struct DB3ModInstrS *mis = (struct DB3ModInstrS*)m->Instruments[i];
+		struct DB3ModSample *ms;
+		int32_t cycle, frames, k;
+		int16_t *guarded;
+
+		if (!mis || (mis->Instr.Type != ITYPE_SAMPLE) || mis->LoopImage) continue;
+		if (((mis->Flags & IF_LOOP_MASK) == IF_NO_LOOP) || (mis->LoopLen <= 0)) continue;
+		if (!(ms = m->Samples[mis->SampleNum]) || !ms->Data) continue;
+
+		cycle = mis->LoopLen;
+		if ((mis->Flags & IF_LOOP_MASK) != IF_FORWARD_LOOP) cycle <<= 1;
+		frames = mis->LoopStart + cycle + DB3_LOOP_IMAGE_EXTRA;
+
+		if (!(guarded = db3_malloc((DB3_SAMPLE_GUARD_BEFORE + frames) * sizeof(int16_t)))) return DB3_ERROR_OUT_OF_MEMORY;
+		mis->LoopImage = guarded + DB3_SAMPLE_GUARD_BEFORE;
+		db3_memcpy(mis->LoopImage, ms->Data, mis->LoopStart * sizeof(int16_t));
+
+		for (k = 0; k < cycle + DB3_LOOP_IMAGE_EXTRA; k++)
+		{
+			int32_t j = k % cycle;
+
+			if (j < mis->LoopLen) mis->LoopImage[mis->LoopStart + k] = ms->Data[mis->LoopStart + j];
+			else mis->LoopImage[mis->LoopStart + k] = ms->Data[mis->LoopStart + (mis->LoopLen << 1) - 1 - j];
+		}
+	}
+
+	return DB3_ERROR_NONE;
+}
+
+
+/****** libdigibooster3/DB3_SetReverseBudget() ******************************
+*
+* NAME
+*   DB3_SetReverseBudget() -- limits memory used for reversed samples.
+*
+* SYNOPSIS
+*   void DB3_SetReverseBudget(struct DB3Module *module, int32_t bytes);
+*
+* FUNCTION
+*   When an engine plays a sample backwards (E3x command) for the first
+*   time, a reversed copy of the sample is made. Then backward playback
+*   reads it forwards, which is faster. Copies are shared by all engines
+*   playing the module and freed by DB3_Unload(). The budget limits their
+*   total size. Samples are reversed in order of their first backward
+*   play, while their copies fit in the budget. Other samples are played
+*   backwards from the original data. Output is the same in both cases.
+*
+*   The default budget is DB3_DEFAULT_REVERSE_BUDGET (8 MB).
+*
+* INPUTS
+*   module - a loaded module.
+*   bytes - the budget. 0 disables reversed copies. Copies made already
+*     are kept, when the budget is lowered.
+*
+* RESULT
+*   None.
+*
+* SEE ALSO
+*   DB3_Load, DB3_Unload
+*
+*****************************************************************************
+*
+*/
+
+void DB3_SetReverseBudget(struct DB3Module *m, int32_t bytes)
+{
+	m->ReverseBudget = bytes;
+}
@@ -0,0 +1,833 @@
+/*-----------------*/
+/* libdigibooster3 */
+/*-----------------*/
+
+/*
+  Copyright (c) 2014, Grzegorz Kraszewski
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+     list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+
+  This software is provided by the copyright holders and contributors "as is" and
+  any express or implied warranties, including, but not limited to the implied
+  warranties of merchantability and fitness for a particular purpose are
+  disclaimed. In no event shall the copyright owner or contributors be liable for
+  any direct, indirect, incidental, special, exemplary, or consequential damages
+  (including, but not limited to, procurement of substitute goods or services;
+  loss of use, data, or profits; or business interruption) however caused and
+  on any theory of liability, whether in contract  strict liability or tort
+  (including negligence or otherwise) arising in any way out of the use of this
+  software, even if advised of the possibility of such damage.
+*/
+
+/* Mixer kernels. Scalar versions are the reference, SIMD versions must give bit-identical results. */
+
+#include "libdigibooster3.h"
+#include "mixer.h"
+
+#ifdef MIXER_X86
+#include <immintrin.h>
+#endif
+
+
+//==============================================================================================
+// mixer_mix_track_scalar()
+//==============================================================================================
+
+// Volume effects, panning, envelopes are applied and result in left and right gains (signed
+// 14-bit values) for both channels. Sample is multiplied by gains, shifted 14 bits right, then
+// added to left and right channel.
+
+static void mixer_mix_track_scalar(int32_t *accu, int16_t *premix, uint32_t frames, int32_t gain_l, int32_t gain_r)
+{
+	while (frames--)
+	{
+		int32_t left, right;
+
+		left = *premix++ * gain_l;
+		right = *premix++ * gain_r;
+		*accu++ += left >> 14;
+		*accu++ += right >> 14;
+	}
+}
+
+
+//==============================================================================================
+// mixer_clear_scalar()
+//==============================================================================================
+
+static void mixer_clear_scalar(int32_t *accu, uint32_t frames)
+{
+	while (frames--)
+	{
+		*accu++ = 0;
+		*accu++ = 0;
+	}
+}
+
+
+//==============================================================================================
+// mixer_flush_scalar()
+//==============================================================================================
+
+static void mixer_flush_scalar(int32_t *accu, int16_t *out, uint32_t frames, int32_t multiplier, int32_t limit)
+{
+	uint32_t samples = frames << 1;
+
+	while (samples--)
+	{
+		int32_t s;
+
+		s = *accu++;
+		if (s > limit) *out = 0x7FFF;
+		else if (s < -limit) *out = 0x8001;
+		else *out = s * multiplier >> 16;
+		out++;
+	}
+}
+
+
+//==============================================================================================
+// mixer_flush_int32_scalar()
+//==============================================================================================
+
+// Values are scaled to 32-bit full range. Saturation thresholds are the same as for 16-bit
+// output, for values below the limit the product always fits in 32 bits.
+
+static inline int32_t mixer_scale32(int32_t s, int32_t multiplier, int32_t limit)
+{
+	if (s > limit) return 0x7FFFFFFF;
+	else if (s < -limit) return -0x7FFFFFFF;
+	else return s * multiplier;
+}
+
+
+static void mixer_flush_int32_scalar(int32_t *accu, int32_t *out, uint32_t frames, int32_t multiplier, int32_t limit)
+{
+	uint32_t samples = frames << 1;
+
+	while (samples--) *out++ = mixer_scale32(*accu++, multiplier, limit);
+}
+
+
+//==============================================================================================
+// mixer_flush_int32_planar_scalar()
+//==============================================================================================
+
+static void mixer_flush_int32_planar_scalar(int32_t *accu, int32_t *left, int32_t *right, uint32_t frames, int32_t multiplier, int32_t limit)
+{
+	while (frames--)
+	{
+		*left++ = mixer_scale32(*accu++, multiplier, limit);
+		*right++ = mixer_scale32(*accu++, multiplier, limit);
+	}
+}
+
+
+//==============================================================================================
+// mixer_flush_float_scalar()
+//==============================================================================================
+
+// No saturation, the full accumulator range is preserved.
+
+static void mixer_flush_float_scalar(int32_t *accu, float *out, uint32_t frames, float scale)
+{
+	uint32_t samples = frames << 1;
+
+	while (samples--) *out++ = (float)*accu++ * scale;
+}
+
+
+//==============================================================================================
+// mixer_flush_float_planar_scalar()
+//==============================================================================================
+
+static void mixer_flush_float_planar_scalar(int32_t *accu, float *left, float *right, uint32_t frames, float scale)
+{
+	while (frames--)
+	{
+		*left++ = (float)*accu++ * scale;
+		*right++ = (float)*accu++ * scale;
+	}
+}
+
+
+//==============================================================================================
+// mixer_add_scalar()
+//==============================================================================================
+
+// Adds a partial accumulator to the main one.
+
+static void mixer_add_scalar(int32_t *accu, int32_t *partial, uint32_t frames)
+{
+	while (frames--)
+	{
+		*accu++ += *partial++;
+		*accu++ += *partial++;
+	}
+}
+
+
+//==============================================================================================
+// mixer_mix_add_scalar()
+//==============================================================================================
+
+// Adds the accumulator scaled by 'multiplier' to a 32-bit bus. Full 64-bit products are shifted
+// right, so there is no saturation and no intermediate overflow. 'multiplier' is non-negative.
+
+static void mixer_mix_add_scalar(int32_t *accu, int32_t *bus, uint32_t frames, int32_t multiplier)
+{
+	uint32_t samples = frames << 1;
+
+	while (samples--) *bus++ += (int32_t)((int64_t)*accu++ * multiplier >> 16);
+}
+
+
+//==============================================================================================
+// mixer_flush_bus()
+//==============================================================================================
+
+// Saturates a 32-bit bus to 16-bit output and clears it. The bus is not bound to any engine, so
+// there are no processor specific versions. The loop is simple enough for the compiler.
+
+void mixer_flush_bus(int32_t *bus, int16_t *out, uint32_t frames)
+{
+	uint32_t samples = frames << 1;
+
+	while (samples--)
+	{
+		int32_t s = *bus;
+
+		if (s > 0x7FFF) s = 0x7FFF;
+		else if (s < -0x7FFF) s = -0x7FFF;
+		*out++ = s;
+		*bus++ = 0;
+	}
+}
+
+
+#ifdef MIXER_X86
+
+//==============================================================================================
+// mixer_mix_track_sse2()
+//==============================================================================================
+
+// Samples are multiplied as 16-bit numbers, full 32-bit products are rebuilt from low and high
+// halves. Gains are non-negative and below 2^15, so products are exact.
+
+__attribute__((target("sse2")))
+static void mixer_mix_track_sse2(int32_t *accu, int16_t *premix, uint32_t frames, int32_t gain_l, int32_t gain_r)
+{
+	__m128i gains = _mm_set_epi16(gain_r, gain_l, gain_r, gain_l, gain_r, gain_l, gain_r, gain_l);
+	uint32_t blocks = frames >> 2;
+
+	while (blocks--)
+	{
+		__m128i x, lo, hi, a0, a1;
+
+		x = _mm_loadu_si128((__m128i*)premix);
+		lo = _mm_mullo_epi16(x, gains);
+		hi = _mm_mulhi_epi16(x, gains);
+		a0 = _mm_loadu_si128((__m128i*)accu);
+		a1 = _mm_loadu_si128((__m128i*)(accu + 4));
+		a0 = _mm_add_epi32(a0, _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 14));
+		a1 = _mm_add_epi32(a1, _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 14));
+		_mm_storeu_si128((__m128i*)accu, a0);
+		_mm_storeu_si128((__m128i*)(accu + 4), a1);
+		premix += 8;
+		accu += 8;
+	}
+
+	mixer_mix_track_scalar(accu, premix, frames & 3, gain_l, gain_r);
+}
+
+
+//==============================================================================================
+// mixer_clear_sse2()
+//==============================================================================================
+
+__attribute__((target("sse2")))
+static void mixer_clear_sse2(int32_t *accu, uint32_t frames)
+{
+	__m128i zero = _mm_setzero_si128();
+	uint32_t blocks = frames >> 2;
+
+	while (blocks--)
+	{
+		_mm_storeu_si128((__m128i*)accu, zero);
+		_mm_storeu_si128((__m128i*)(accu + 4), zero);
+		accu += 8;
+	}
+
+	mixer_clear_scalar(accu, frames & 3);
+}
+
+
+//==============================================================================================
+// mixer_add_sse2()
+//==============================================================================================
+
+__attribute__((target("sse2")))
+static void mixer_add_sse2(int32_t *accu, int32_t *partial, uint32_t frames)
+{
+	uint32_t blocks = frames >> 1;
+
+	while (blocks--)
+	{
+		__m128i a = _mm_loadu_si128((__m128i*)accu);
+
+		_mm_storeu_si128((__m128i*)accu, _mm_add_epi32(a, _mm_loadu_si128((__m128i*)partial)));
+		accu += 4;
+		partial += 4;
+	}
+
+	mixer_add_scalar(accu, partial, frames & 1);
+}
+
+
+//==============================================================================================
+// mixer_mullo32_sse2()
+//==============================================================================================
+
+// SSE2 has no 32 x 32 -> 32 bit multiplication. Low halves of 64-bit unsigned products are the
+// same as for signed ones.
+
+__attribute__((target("sse2")))
+static inline __m128i mixer_mullo32_sse2(__m128i a, __m128i b)
+{
+	__m128i even, odd;
+
+	even = _mm_mul_epu32(a, b);
+	odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	even = _mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0));
+	odd = _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0));
+	return _mm_unpacklo_epi32(even, odd);
+}
+
+
+//==============================================================================================
+// mixer_mix_add_sse2()
+//==============================================================================================
+
+// Bits 16 to 47 of 64-bit products are needed. Products are unsigned, for negative samples the
+// multiplier shifted 16 bits left is subtracted, which turns them into signed ones.
+
+__attribute__((target("sse2")))
+static void mixer_mix_add_sse2(int32_t *accu, int32_t *bus, uint32_t frames, int32_t multiplier)
+{
+	__m128i mul = _mm_set1_epi32(multiplier);
+	__m128i corr = _mm_set1_epi32((uint32_t)multiplier << 16);
+	__m128i even = _mm_set_epi32(0, -1, 0, -1);
+	uint32_t blocks = frames >> 1;
+
+	while (blocks--)
+	{
+		__m128i s, lo, hi, r;
+
+		s = _mm_loadu_si128((__m128i*)accu);
+		lo = _mm_srli_epi64(_mm_mul_epu32(s, mul), 16);
+		hi = _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(s, 32), mul), 16);
+		r = _mm_or_si128(_mm_and_si128(even, lo), _mm_andnot_si128(even, hi));
+		r = _mm_sub_epi32(r, _mm_and_si128(_mm_srai_epi32(s, 31), corr));
+		_mm_storeu_si128((__m128i*)bus, _mm_add_epi32(_mm_loadu_si128((__m128i*)bus), r));
+		accu += 4;
+		bus += 4;
+	}
+
+	mixer_mix_add_scalar(accu, bus, frames & 1, multiplier);
+}
+
+
+//==============================================================================================
+// mixer_flush_sse2()
+//==============================================================================================
+
+// Saturation is done by comparison with the limit, exactly as in the scalar code. Scaled values
+// which passed the comparison always fit in 16 bits, so signed packing never saturates them.
+
+__attribute__((target("sse2")))
+static inline __m128i mixer_saturate_sse2(__m128i s, __m128i in, __m128i lim, __m128i nlim, __m128i pmax, __m128i nmax)
+{
+	__m128i over, under;
+
+	over = _mm_cmpgt_epi32(s, lim);
+	under = _mm_cmplt_epi32(s, nlim);
+	in = _mm_andnot_si128(_mm_or_si128(over, under), in);
+	in = _mm_or_si128(in, _mm_and_si128(over, pmax));
+	return _mm_or_si128(in, _mm_and_si128(under, nmax));
+}
+
+
+__attribute__((target("sse2")))
+static inline __m128i mixer_scale_sse2(__m128i s, __m128i mul, __m128i lim, __m128i nlim, __m128i pmax, __m128i nmax)
+{
+	return mixer_saturate_sse2(s, _mm_srai_epi32(mixer_mullo32_sse2(s, mul), 16), lim, nlim, pmax, nmax);
+}
+
+
+__attribute__((target("sse2")))
+static void mixer_flush_sse2(int32_t *accu, int16_t *out, uint32_t frames, int32_t multiplier, int32_t limit)
+{
+	__m128i mul = _mm_set1_epi32(multiplier);
+	__m128i lim = _mm_set1_epi32(limit);
+	__m128i nlim = _mm_set1_epi32(-limit);
+	__m128i pmax = _mm_set1_epi32(0x7FFF);
+	__m128i nmax = _mm_set1_epi32(-0x7FFF);
+	uint32_t blocks = frames >> 2;
+
+	while (blocks--)
+	{
+		__m128i s0, s1;
+
+		s0 = mixer_scale_sse2(_mm_loadu_si128((__m128i*)accu), mul, lim, nlim, pmax, nmax);
+		s1 = mixer_scale_sse2(_mm_loadu_si128((__m128i*)(accu + 4)), mul, lim, nlim, pmax, nmax);
+		_mm_storeu_si128((__m128i*)out, _mm_packs_epi32(s0, s1));
+		accu += 8;
+		out += 8;
+	}
+
+	mixer_flush_scalar(accu, out, frames & 3, multiplier, limit);
+}
+
+
+//==============================================================================================
+// mixer_flush_int32_sse2()
+//==============================================================================================
+
+__attribute__((target("sse2")))
+static inline __m128i mixer_scale32_sse2(__m128i s, __m128i mul, __m128i lim, __m128i nlim, __m128i pmax, __m128i nmax)
+{
+	return mixer_saturate_sse2(s, mixer_mullo32_sse2(s, mul), lim, nlim, pmax, nmax);
+}
+
+
+__attribute__((target("sse2")))
+static void mixer_flush_int32_sse2(int32_t *accu, int32_t *out, uint32_t frames, int32_t multiplier, int32_t limit)
+{
+	__m128i mul = _mm_set1_epi32(multiplier);
+	__m128i lim = _mm_set1_epi32(limit);
+	__m128i nlim = _mm_set1_epi32(-limit);
+	__m128i pmax = _mm_set1_epi32(0x7FFFFFFF);
+	__m128i nmax = _mm_set1_epi32(-0x7FFFFFFF);
+	uint32_t blocks = frames >> 1;
+
+	while (blocks--)
+	{
+		_mm_storeu_si128((__m128i*)out, mixer_scale32_sse2(_mm_loadu_si128((__m128i*)accu), mul, lim, nlim, pmax, nmax));
+		accu += 4;
+		out += 4;
+	}
+
+	mixer_flush_int32_scalar(accu, out, frames & 1, multiplier, limit);
+}
+
+
+//==============================================================================================
+// mixer_flush_int32_planar_sse2()
+//==============================================================================================
+
+// Frames are deinterleaved with floating point shuffles, these just move bits.
+
+__attribute__((target("sse2")))
+static void mixer_flush_int32_planar_sse2(int32_t *accu, int32_t *left, int32_t *right, uint32_t frames, int32_t multiplier, int32_t limit)
+{
+	__m128i mul = _mm_set1_epi32(multiplier);
+	__m128i lim = _mm_set1_epi32(limit);
+	__m128i nlim = _mm_set1_epi32(-limit);
+	__m128i pmax = _mm_set1_epi32(0x7FFFFFFF);
+	__m128i nmax = _mm_set1_epi32(-0x7FFFFFFF);
+	uint32_t blocks = frames >> 2;
+
+	while (blocks--)
+	{
+		__m128 s0, s1;
+
+		s0 = _mm_castsi128_ps(mixer_scale32_sse2(_mm_loadu_si128((__m128i*)accu), mul, lim, nlim, pmax, nmax));
+		s1 = _mm_castsi128_ps(mixer_scale32_sse2(_mm_loadu_si128((__m128i*)(accu + 4)), mul, lim, nlim, pmax, nmax));
+		_mm_storeu_ps((float*)left, _mm_shuffle_ps(s0, s1, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps((float*)right, _mm_shuffle_ps(s0, s1, _MM_SHUFFLE(3, 1, 3, 1)));
+		accu += 8;
+		left += 4;
+		right += 4;
+	}
+
+	mixer_flush_int32_planar_scalar(accu, left, right, frames & 3, multiplier, limit);
+}
+
+
+//==============================================================================================
+// mixer_flush_float_sse2()
+//==============================================================================================
+
+__attribute__((target("sse2")))
+static void mixer_flush_float_sse2(int32_t *accu, float *out, uint32_t frames, float scale)
+{
+	__m128 mul = _mm_set1_ps(scale);
+	uint32_t blocks = frames >> 1;
+
+	while (blocks--)
+	{
+		_mm_storeu_ps(out, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((__m128i*)accu)), mul));
+		accu += 4;
+		out += 4;
+	}
+
+	mixer_flush_float_scalar(accu, out, frames & 1, scale);
+}
+
+
+//==============================================================================================
+// mixer_flush_float_planar_sse2()
+//==============================================================================================
+
+__attribute__((target("sse2")))
+static void mixer_flush_float_planar_sse2(int32_t *accu, float *left, float *right, uint32_t frames, float scale)
+{
+	__m128 mul = _mm_set1_ps(scale);
+	uint32_t blocks = frames >> 2;
+
+	while (blocks--)
+	{
+		__m128 s0, s1;
+
+		s0 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((__m128i*)accu)), mul);
+		s1 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((__m128i*)(accu + 4))), mul);
+		_mm_storeu_ps(left, _mm_shuffle_ps(s0, s1, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps(right, _mm_shuffle_ps(s0, s1, _MM_SHUFFLE(3, 1, 3, 1)));
+		accu += 8;
+		left += 4;
+		right += 4;
+	}
+
+	mixer_flush_float_planar_scalar(accu, left, right, frames & 3, scale);
+}
+
+
+//==============================================================================================
+// mixer_mix_track_avx2()
+//==============================================================================================
+
+__attribute__((target("avx2")))
+static void mixer_mix_track_avx2(int32_t *accu, int16_t *premix, uint32_t frames, int32_t gain_l, int32_t gain_r)
+{
+	__m256i gains = _mm256_set_epi32(gain_r, gain_l, gain_r, gain_l, gain_r, gain_l, gain_r, gain_l);
+	uint32_t blocks = frames >> 3;
+
+	while (blocks--)
+	{
+		__m256i x0, x1, a0, a1;
+
+		x0 = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i*)premix));
+		x1 = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i*)(premix + 8)));
+		a0 = _mm256_loadu_si256((__m256i*)accu);
+		a1 = _mm256_loadu_si256((__m256i*)(accu + 8));
+		a0 = _mm256_add_epi32(a0, _mm256_srai_epi32(_mm256_mullo_epi32(x0, gains), 14));
+		a1 = _mm256_add_epi32(a1, _mm256_srai_epi32(_mm256_mullo_epi32(x1, gains), 14));
+		_mm256_storeu_si256((__m256i*)accu, a0);
+		_mm256_storeu_si256((__m256i*)(accu + 8), a1);
+		premix += 16;
+		accu += 16;
+	}
+
+	mixer_mix_track_scalar(accu, premix, frames & 7, gain_l, gain_r);
+}
+
+
+//==============================================================================================
+// mixer_clear_avx2()
+//==============================================================================================
+
+__attribute__((target("avx2")))
+static void mixer_clear_avx2(int32_t *accu, uint32_t frames)
+{
+	__m256i zero = _mm256_setzero_si256();
+	uint32_t blocks = frames >> 3;
+
+	while (blocks--)
+	{
+		_mm256_storeu_si256((__m256i*)accu, zero);
+		_mm256_storeu_si256((__m256i*)(accu + 8), zero);
+		accu += 16;
+	}
+
+	mixer_clear_scalar(accu, frames & 7);
+}
+
+
+//==============================================================================================
+// mixer_add_avx2()
+//==============================================================================================
+
+__attribute__((target("avx2")))
+static void mixer_add_avx2(int32_t *accu, int32_t *partial, uint32_t frames)
+{
+	uint32_t blocks = frames >> 2;
+
+	while (blocks--)
+	{
+		__m256i a = _mm256_loadu_si256((__m256i*)accu);
+
+		_mm256_storeu_si256((__m256i*)accu, _mm256_add_epi32(a, _mm256_loadu_si256((__m256i*)partial)));
+		accu += 8;
+		partial += 8;
+	}
+
+	mixer_add_scalar(accu, partial, frames & 3);
+}
+
+
+//==============================================================================================
+// mixer_mix_add_avx2()
+//==============================================================================================
+
+// Signed 64-bit products of even and odd lanes, bits 16 to 47 are blended together.
+
+__attribute__((target("avx2")))
+static void mixer_mix_add_avx2(int32_t *accu, int32_t *bus, uint32_t frames, int32_t multiplier)
+{
+	__m256i mul = _mm256_set1_epi32(multiplier);
+	uint32_t blocks = frames >> 2;
+
+	while (blocks--)
+	{
+		__m256i s, lo, hi;
+
+		s = _mm256_loadu_si256((__m256i*)accu);
+		lo = _mm256_srli_epi64(_mm256_mul_epi32(s, mul), 16);
+		hi = _mm256_slli_epi64(_mm256_mul_epi32(_mm256_srli_epi64(s, 32), mul), 16);
+		s = _mm256_blend_epi32(lo, hi, 0xAA);
+		_mm256_storeu_si256((__m256i*)bus, _mm256_add_epi32(_mm256_loadu_si256((__m256i*)bus), s));
+		accu += 8;
+		bus += 8;
+	}
+
+	mixer_mix_add_scalar(accu, bus, frames & 3, multiplier);
+}
+
+
+//==============================================================================================
+// mixer_flush_avx2()
+//==============================================================================================
+
+__attribute__((target("avx2")))
+static inline __m256i mixer_saturate_avx2(__m256i s, __m256i in, __m256i lim, __m256i nlim, __m256i pmax, __m256i nmax)
+{
+	__m256i over, under;
+
+	over = _mm256_cmpgt_epi32(s, lim);
+	under = _mm256_cmpgt_epi32(nlim, s);
+	in = _mm256_blendv_epi8(in, pmax, over);
+	return _mm256_blendv_epi8(in, nmax, under);
+}
+
+
+__attribute__((target("avx2")))
+static inline __m256i mixer_scale_avx2(__m256i s, __m256i mul, __m256i lim, __m256i nlim, __m256i pmax, __m256i nmax)
+{
+	return mixer_saturate_avx2(s, _mm256_srai_epi32(_mm256_mullo_epi32(s, mul), 16), lim, nlim, pmax, nmax);
+}
+
+
+__attribute__((target("avx2")))
+static void mixer_flush_avx2(int32_t *accu, int16_t *out, uint32_t frames, int32_t multiplier, int32_t limit)
+{
+	__m256i mul = _mm256_set1_epi32(multiplier);
+	__m256i lim = _mm256_set1_epi32(limit);
+	__m256i nlim = _mm256_set1_epi32(-limit);
+	__m256i pmax = _mm256_set1_epi32(0x7FFF);
+	__m256i nmax = _mm256_set1_epi32(-0x7FFF);
+	uint32_t blocks = frames >> 3;
+
+	while (blocks--)
+	{
+		__m256i s0, s1, p;
+
+		s0 = mixer_scale_avx2(_mm256_loadu_si256((__m256i*)accu), mul, lim, nlim, pmax, nmax);
+		s1 = mixer_scale_avx2(_mm256_loadu_si256((__m256i*)(accu + 8)), mul, lim, nlim, pmax, nmax);
+		p = _mm256_permute4x64_epi64(_mm256_packs_epi32(s0, s1), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i*)out, p);
+		accu += 16;
+		out += 16;
+	}
+
+	mixer_flush_scalar(accu, out, frames & 7, multiplier, limit);
+}
+
+
+//==============================================================================================
+// mixer_flush_int32_avx2()
+//==============================================================================================
+
+__attribute__((target("avx2")))
+static inline __m256i mixer_scale32_avx2(__m256i s, __m256i mul, __m256i lim, __m256i nlim, __m256i pmax, __m256i nmax)
+{
+	return mixer_saturate_avx2(s, _mm256_mullo_epi32(s, mul), lim, nlim, pmax, nmax);
+}
+
+
+__attribute__((target("avx2")))
+static void mixer_flush_int32_avx2(int32_t *accu, int32_t *out, uint32_t frames, int32_t multiplier, int32_t limit)
+{
+	__m256i mul = _mm256_set1_epi32(multiplier);
+	__m256i lim = _mm256_set1_epi32(limit);
+	__m256i nlim = _mm256_set1_epi32(-limit);
+	__m256i pmax = _mm256_set1_epi32(0x7FFFFFFF);
+	__m256i nmax = _mm256_set1_epi32(-0x7FFFFFFF);
+	uint32_t blocks = frames >> 2;
+
+	while (blocks--)
+	{
+		_mm256_storeu_si256((__m256i*)out, mixer_scale32_avx2(_mm256_loadu_si256((__m256i*)accu), mul, lim, nlim, pmax, nmax));
+		accu += 8;
+		out += 8;
+	}
+
+	mixer_flush_int32_scalar(accu, out, frames & 3, multiplier, limit);
+}
+
+
+//==============================================================================================
+// mixer_flush_int32_planar_avx2()
+//==============================================================================================
+
+// Lanes are permuted to (L0 L1 L2 L3 R0 R1 R2 R3), then stored as two halves.
+
+__attribute__((target("avx2")))
+static void mixer_flush_int32_planar_avx2(int32_t *accu, int32_t *left, int32_t *right, uint32_t frames, int32_t multiplier, int32_t limit)
+{
+	__m256i mul = _mm256_set1_epi32(multiplier);
+	__m256i lim = _mm256_set1_epi32(limit);
+	__m256i nlim = _mm256_set1_epi32(-limit);
+	__m256i pmax = _mm256_set1_epi32(0x7FFFFFFF);
+	__m256i nmax = _mm256_set1_epi32(-0x7FFFFFFF);
+	__m256i perm = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	uint32_t blocks = frames >> 2;
+
+	while (blocks--)
+	{
+		__m256i s;
+
+		s = mixer_scale32_avx2(_mm256_loadu_si256((__m256i*)accu), mul, lim, nlim, pmax, nmax);
+		s = _mm256_permutevar8x32_epi32(s, perm);
+		_mm_storeu_si128((__m128i*)left, _mm256_castsi256_si128(s));
+		_mm_storeu_si128((__m128i*)right, _mm256_extracti128_si256(s, 1));
+		accu += 8;
+		left += 4;
+		right += 4;
+	}
+
+	mixer_flush_int32_planar_scalar(accu, left, right, frames & 3, multiplier, limit);
+}
+
+
+//==============================================================================================
+// mixer_flush_float_avx2()
+//==============================================================================================
+
+__attribute__((target("avx2")))
+static void mixer_flush_float_avx2(int32_t *accu, float *out, uint32_t frames, float scale)
+{
+	__m256 mul = _mm256_set1_ps(scale);
+	uint32_t blocks = frames >> 2;
+
+	while (blocks--)
+	{
+		_mm256_storeu_ps(out, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((__m256i*)accu)), mul));
+		accu += 8;
+		out += 8;
+	}
+
+	mixer_flush_float_scalar(accu, out, frames & 3, scale);
+}
+
+
+//==============================================================================================
+// mixer_flush_float_planar_avx2()
+//==============================================================================================
+
+__attribute__((target("avx2")))
+static void mixer_flush_float_planar_avx2(int32_t *accu, float *left, float *right, uint32_t frames, float scale)
+{
+	__m256 mul = _mm256_set1_ps(scale);
+	__m256i perm = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	uint32_t blocks = frames >> 2;
+
+	while (blocks--)
+	{
+		__m256 s;
+
+		s = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((__m256i*)accu)), mul);
+		s = _mm256_permutevar8x32_ps(s, perm);
+		_mm_storeu_ps(left, _mm256_castps256_ps128(s));
+		_mm_storeu_ps(right, _mm256_extractf128_ps(s, 1));
+		accu += 8;
+		left += 4;
+		right += 4;
+	}
+
+	mixer_flush_float_planar_scalar(accu, left, right, frames & 3, scale);
+}
+
+#endif  /* MIXER_X86 */
+
+
+//==============================================================================================
+// mixer_init()
+//==============================================================================================
+
+// Selects the best set of kernels for the processor the code runs on. Called once for every
+// engine in DB3_NewEngine().
+
+void mixer_init(struct MixKernels *mk)
+{
+	mk->Level = MIXER_SCALAR;
+	mk->MixTrack = mixer_mix_track_scalar;
+	mk->Clear = mixer_clear_scalar;
+	mk->Add = mixer_add_scalar;
+	mk->MixAdd = mixer_mix_add_scalar;
+	mk->Flush = mixer_flush_scalar;
+	mk->FlushInt32 = mixer_flush_int32_scalar;
+	mk->FlushInt32Planar = mixer_flush_int32_planar_scalar;
+	mk->FlushFloat = mixer_flush_float_scalar;
+	mk->FlushFloatPlanar = mixer_flush_float_planar_scalar;
+
+#ifdef MIXER_X86
+
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+	{
+		mk->Level = MIXER_AVX2;
+		mk->MixTrack = mixer_mix_track_avx2;
+		mk->Clear = mixer_clear_avx2;
+		mk->Add = mixer_add_avx2;
+		mk->MixAdd = mixer_mix_add_avx2;
+		mk->Flush = mixer_flush_avx2;
+		mk->FlushInt32 = mixer_flush_int32_avx2;
+		mk->FlushInt32Planar = mixer_flush_int32_planar_avx2;
+		mk->FlushFloat = mixer_flush_float_avx2;
+		mk->FlushFloatPlanar = mixer_flush_float_planar_avx2;
+	}
+	else if (__builtin_cpu_supports("sse2"))
+	{
+		mk->Level = MIXER_SSE2;
+		mk->MixTrack = mixer_mix_track_sse2;
+		mk->Clear = mixer_clear_sse2;
+		mk->Add = mixer_add_sse2;
+		mk->MixAdd = mixer_mix_add_sse2;
+		mk->Flush = mixer_flush_sse2;
+		mk->FlushInt32 = mixer_flush_int32_sse2;
+		mk->FlushInt32Planar = mixer_flush_int32_planar_sse2;
+		mk->FlushFloat = mixer_flush_float_sse2;
+		mk->FlushFloatPlanar = mixer_flush_float_planar_sse2;
+	}
+
+#endif
+}
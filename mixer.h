@@ -0,0 +1,95 @@
+/*-----------------*/
+/* libdigibooster3 */
+/*-----------------*/
+
+/*
+  Copyright (c) 2014, Grzegorz Kraszewski
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+     list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+
+  This software is provided by the copyright holders and contributors "as is" and
+  any express or implied warranties, including, but not limited to the implied
+  warranties of merchantability and fitness for a particular purpose are
+  disclaimed. In no event shall the copyright owner or contributors be liable for
+  any direct, indirect, incidental, special, exemplary, or consequential damages
+  (including, but not limited to, procurement of substitute goods or services;
+  loss of use, data, or profits; or business interruption) however caused and
+  on any theory of liability, whether in contract  strict liability or tort
+  (including negligence or otherwise) arising in any way out of the use of this
+  software, even if advised of the possibility of such damage.
+*/
+
+#ifndef LIBDIGIBOOSTER3_MIXER_H
+#define LIBDIGIBOOSTER3_MIXER_H
+
+/* Mixer kernels: track accumulation, accumulator clearing and output flush. */
+
+#ifndef TARGET_WIN32
+#include <stdint.h>
+#else
+#include "../stdint.h"
+#endif
+
+// SIMD kernels are compiled only with GCC compatible compilers on x86. They are selected at
+// runtime, so the library still runs on processors without SSE2/AVX2.
+
+#if (defined __GNUC__) && ((defined __x86_64__) || (defined __i386__))
+#define MIXER_X86
+#endif
+
+
+// Kernel levels.
+
+#define MIXER_SCALAR                 0
+#define MIXER_SSE2                   1
+#define MIXER_AVX2                   2
+
+
+struct MixKernels
+{
+	int Level;                      // one of MIXER_xxx
+
+	// Adds stereo 'premix' multiplied by 14-bit gains to the accumulator.
+
+	void(*MixTrack)(int32_t *accu, int16_t *premix, uint32_t frames, int32_t gain_l, int32_t gain_r);
+
+	// Clears 'frames' stereo frames of the accumulator.
+
+	void(*Clear)(int32_t *accu, uint32_t frames);
+
+	// Adds 'frames' stereo frames of a partial accumulator to the accumulator.
+
+	void(*Add)(int32_t *accu, int32_t *partial, uint32_t frames);
+
+	// Adds the accumulator scaled by 'multiplier' (>> 16) to a 32-bit bus, without saturation.
+
+	void(*MixAdd)(int32_t *accu, int32_t *bus, uint32_t frames, int32_t multiplier);
+
+	// Scales the accumulator with master volume and saturates it to 16 bits.
+
+	void(*Flush)(int32_t *accu, int16_t *out, uint32_t frames, int32_t multiplier, int32_t limit);
+
+	// The same, but the result is scaled to full 32-bit range, interleaved or planar.
+
+	void(*FlushInt32)(int32_t *accu, int32_t *out, uint32_t frames, int32_t multiplier, int32_t limit);
+	void(*FlushInt32Planar)(int32_t *accu, int32_t *left, int32_t *right, uint32_t frames, int32_t multiplier, int32_t limit);
+
+	// Converts the accumulator to floats multiplied by 'scale', without saturation.
+
+	void(*FlushFloat)(int32_t *accu, float *out, uint32_t frames, float scale);
+	void(*FlushFloatPlanar)(int32_t *accu, float *left, float *right, uint32_t frames, float scale);
+};
+
+
+void mixer_init(struct MixKernels *mk);
+void mixer_flush_bus(int32_t *bus, int16_t *out, uint32_t frames);
+
+#endif      /* LIBDIGIBOOSTER3_MIXER_H */
@@ -73,10 +73,31 @@
 /* A sample. */
 /*-----------*/
 
+/* Audio data are surrounded by guard regions of zeros. Resamplers read data */
+/* straight from the sample, including history before the first frame and    */
+/* zeros after the last one, which make a source block complete.             */
+
+#define DB3_SAMPLE_GUARD_BEFORE              16      /* in frames */
+#define DB3_SAMPLE_GUARD_AFTER               1024    /* in frames */
+
+/* Mip levels are optional band-limited copies of the sample decimated 2, 4 */
+/* and 8 times, built with DB3_BuildMipLevels(). They have guard regions as */
+/* the sample itself. Level 'n' has (Frames + 2^n - 1) >> n frames.         */
+
+#define DB3_MIP_LEVELS                       3
+
+/* The reversed copy of a sample is built when an engine plays it backwards */
+/* for the first time, if the module reverse budget allows. It has guard    */
+/* regions and is shared by all engines playing the module.                 */
+
+#define DB3_DEFAULT_REVERSE_BUDGET           (8 << 20)   /* in bytes */
+
 struct DB3ModSample
 {
 	int32_t Frames;
-	int16_t *Data;
+	int16_t *Data;           /* points after the leading guard region */
+	int16_t *Mips[DB3_MIP_LEVELS];   /* levels 1 to 3, NULL if not built */
+	int16_t *Reversed;       /* points after the leading guard region, NULL if not built */
 };
 
 /*-----------------------*/
@@ -119,7 +140,12 @@ struct DB3ModInstr
 	uint16_t PanEnv;       // index of panning envelope, 0xFFFF if none
 };
 
-// Sample based instrument.
+// Sample based instrument. The optional loop image, built with DB3_UnrollLoops(), is the sample
+// as played forwards from its start: frames before the loop, then loop cycles. A cycle of a
+// pingpong loop is the loop played forwards, then backwards. The image has a leading guard region
+// and DB3_LOOP_IMAGE_EXTRA frames after the first cycle.
+
+#define DB3_LOOP_IMAGE_EXTRA                 (16 + 1024)
 
 struct DB3ModInstrS
 {
@@ -129,6 +155,7 @@ struct DB3ModInstrS
 	int32_t LoopStart;
 	int32_t LoopLen;
 	uint16_t Flags;
+	int16_t *LoopImage;    // points after the leading guard region, NULL if not built
 };
 
 /*----------------*/
@@ -202,6 +229,8 @@ struct DB3Module
 	struct DB3ModEnvelope *VolEnvs;     // table of volume envelopes
 	struct DB3ModEnvelope *PanEnvs;     // table of panning envelopes
 	struct DB3GlobalDSP DspDefaults;    // global DSP effects defaults
+	int32_t ReverseBudget;              // memory for reversed samples, in bytes
+	int32_t ReverseUsed;                // memory taken by reversed samples, updated atomically
 };
 
 #endif  /* LIBDIGIBOOSTER3_MUSICMODULE_H */
@@ -0,0 +1,189 @@
+/*-----------------*/
+/* libdigibooster3 */
+/*-----------------*/
+
+/*
+  Copyright (c) 2014, Grzegorz Kraszewski
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+     list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+
+  This software is provided by the copyright holders and contributors "as is" and
+  any express or implied warranties, including, but not limited to the implied
+  warranties of merchantability and fitness for a particular purpose are
+  disclaimed. In no event shall the copyright owner or contributors be liable for
+  any direct, indirect, incidental, special, exemplary, or consequential damages
+  (including, but not limited to, procurement of substitute goods or services;
+  loss of use, data, or profits; or business interruption) however caused and
+  on any theory of liability, whether in contract  strict liability or tort
+  (including negligence or otherwise) arising in any way out of the use of this
+  software, even if advised of the possibility of such damage.
+*/
+
+/* Cache of resampled one-shot notes. */
+
+#include "libdigibooster3.h"
+#include "dsp.h"
+#include "oneshot.h"
+
+
+//==============================================================================================
+// oneshot_init()
+//==============================================================================================
+
+void oneshot_init(struct OneShotCache *cache)
+{
+	INIT_LIST(&cache->Entries);
+	cache->Budget = 0;
+	cache->Used = 0;
+	cache->Hits = 0;
+	cache->Misses = 0;
+}
+
+
+//==============================================================================================
+// oneshot_free()
+//==============================================================================================
+
+static void oneshot_free(struct OneShotCache *cache, struct OneShot *os)
+{
+	DB3Remove(&os->Node);
+	cache->Used -= os->Bytes;
+	db3_free(os);
+}
+
+
+//==============================================================================================
+// oneshot_evict()
+//==============================================================================================
+
+// Frees least recently used entries, until the cache takes at most 'limit' bytes. Entries in use
+// are kept, so the limit may be not reached.
+
+static void oneshot_evict(struct OneShotCache *cache, uint32_t limit)
+{
+	struct OneShot *os, *next;
+
+	for (os = (struct OneShot*)cache->Entries.mlh_Head; (cache->Used > limit) && (next = (struct OneShot*)os->Node.mln_Succ); os = next)
+	{
+		if (os->Users == 0) oneshot_free(cache, os);
+	}
+}
+
+
+//==============================================================================================
+// oneshot_find()
+//==============================================================================================
+
+static struct OneShot *oneshot_find(struct OneShotCache *cache, struct OneShotKey *key)
+{
+	struct OneShot *os;
+
+	ITERATE_LIST(&cache->Entries, struct OneShot*, os)
+	{
+		if ((os->Key.Instr == key->Instr) && (os->Key.Ratio == key->Ratio) && (os->Key.Offset == key->Offset)
+		 && (os->Key.Backwards == key->Backwards) && (os->Key.Interpolation == key->Interpolation)) return os;
+	}
+
+	return NULL;
+}
+
+
+//==============================================================================================
+// oneshot_attach()
+//==============================================================================================
+
+// Connects the resampler of a note just triggered to the cache. A cached note is played from the
+// cache. Otherwise the resampler records the note, if 'length' samples fit in the budget. A note
+// being recorded is not played, as its recorded part may be still too short.
+
+void oneshot_attach(struct OneShotCache *cache, struct Resampler20 *rs, struct OneShotKey *key, uint32_t length)
+{
+	struct OneShot *os;
+	uint32_t bytes;
+
+	if (os = oneshot_find(cache, key))
+	{
+		DB3Remove(&os->Node);
+		DB3AddTail(&cache->Entries, &os->Node);
+
+		if (os->Recording)
+		{
+			cache->Misses++;
+			return;
+		}
+
+		if (os->Filled > 0)
+		{
+			os->Users++;
+			rs->oneshot = os;
+			rs->oneshot_pos = 0;
+			rs->recording = FALSE;
+			cache->Hits++;
+			return;
+		}
+
+		// Recording has been stopped before the first sample, the note is recorded again.
+
+		oneshot_free(cache, os);
+	}
+
+	cache->Misses++;
+	if (cache->Budget < sizeof(struct OneShot)) return;
+	if (length > (cache->Budget - sizeof(struct OneShot)) / sizeof(int16_t)) return;
+	bytes = sizeof(struct OneShot) + length * sizeof(int16_t);
+	oneshot_evict(cache, cache->Budget - bytes);
+	if (cache->Used + bytes > cache->Budget) return;
+
+	if (os = db3_malloc(bytes))
+	{
+		os->Key = *key;
+		os->Data = (int16_t*)(os + 1);
+		os->Length = length;
+		os->Bytes = bytes;
+		os->Filled = 0;
+		os->Users = 1;
+		os->Recording = TRUE;
+		DB3AddTail(&cache->Entries, &os->Node);
+		cache->Used += bytes;
+		rs->oneshot = os;
+		rs->oneshot_pos = 0;
+		rs->recording = TRUE;
+	}
+}
+
+
+//==============================================================================================
+// oneshot_trim()
+//==============================================================================================
+
+// Sets a new budget and frees entries not fitting in it. Entries in use are kept until the cache
+// needs room again, or the engine is disposed.
+
+void oneshot_trim(struct OneShotCache *cache, uint32_t budget)
+{
+	cache->Budget = budget;
+	oneshot_evict(cache, budget);
+}
+
+
+//==============================================================================================
+// oneshot_dispose()
+//==============================================================================================
+
+// Frees all the entries. Resamplers using them must be disposed before.
+
+void oneshot_dispose(struct OneShotCache *cache)
+{
+	struct OneShot *os;
+
+	while (os = (struct OneShot*)DB3RemHead(&cache->Entries)) db3_free(os);
+	cache->Used = 0;
+}
@@ -0,0 +1,89 @@
+/*-----------------*/
+/* libdigibooster3 */
+/*-----------------*/
+
+/*
+  Copyright (c) 2014, Grzegorz Kraszewski
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+     list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+
+  This software is provided by the copyright holders and contributors "as is" and
+  any express or implied warranties, including, but not limited to the implied
+  warranties of merchantability and fitness for a particular purpose are
+  disclaimed. In no event shall the copyright owner or contributors be liable for
+  any direct, indirect, incidental, special, exemplary, or consequential damages
+  (including, but not limited to, procurement of substitute goods or services;
+  loss of use, data, or profits; or business interruption) however caused and
+  on any theory of liability, whether in contract  strict liability or tort
+  (including negligence or otherwise) arising in any way out of the use of this
+  software, even if advised of the possibility of such damage.
+*/
+
+#ifndef LIBDIGIBOOSTER3_ONESHOT_H
+#define LIBDIGIBOOSTER3_ONESHOT_H
+
+/* Cache of resampled one-shot notes. */
+
+// Notes of instruments without loop, triggered again with the same pitch, produce the same
+// resampler output. The first note records it, next ones copy it instead of interpolating. The
+// cache belongs to an engine, it is used only by the sequencer thread, except of entry fields
+// updated by resamplers, as noted below.
+
+#ifndef TARGET_WIN32
+#include <stdint.h>
+#else
+#include "../stdint.h"
+#endif
+
+#include "lists.h"
+
+struct Resampler20;
+
+
+struct OneShotKey
+{
+	int Instr;                       // instrument number (from 1)
+	uint32_t Ratio;                  // resampler ratio * 2^16
+	int32_t Offset;                  // sample offset at trigger
+	int Backwards;                   // TRUE for notes played backwards (E3x)
+	int Interpolation;               // DB3_RESAMPLER_xxx
+};
+
+
+struct OneShot
+{
+	struct MinNode Node;             // in the cache list, least recently used first
+	struct OneShotKey Key;
+	int16_t *Data;                   // resampler output, stored after the structure
+	uint32_t Length;                 // capacity of Data in samples
+	uint32_t Bytes;                  // size of the entry, accounted in the budget
+	uint32_t Filled;                 // samples recorded, updated by the recording resampler
+	int32_t Users;                   // resamplers playing or recording, decremented atomically by them
+	int Recording;                   // TRUE until the recording resampler leaves the entry
+};
+
+
+struct OneShotCache
+{
+	struct MinList Entries;
+	uint32_t Budget;                 // in bytes, 0 disables the cache
+	uint32_t Used;                   // bytes of entries
+	uint32_t Hits;                   // notes played from the cache
+	uint32_t Misses;                 // notes resampled, including ones being recorded
+};
+
+
+void oneshot_init(struct OneShotCache *cache);
+void oneshot_attach(struct OneShotCache *cache, struct Resampler20 *rs, struct OneShotKey *key, uint32_t length);
+void oneshot_trim(struct OneShotCache *cache, uint32_t budget);
+void oneshot_dispose(struct OneShotCache *cache);
+
+#endif      /* LIBDIGIBOOSTER3_ONESHOT_H */
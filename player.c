@@ -33,6 +33,10 @@
 #include "dsp.h"
 #include "player.h"
 
+#ifdef MSYNTH_GOVERNOR
+#include <time.h>
+#endif
+
 #define porta_to_note(me) ((me->Cmd1 == 3) || (me->Cmd1 == 5) || (me->Cmd2 == 3) || (me->Cmd2 == 5))
 
 
@@ -142,17 +146,6 @@ uint32_t DbVals[6] = { 65536, 73562, 82570, 92682, 104032, 116772 };
 #define LOOPDIR_BACKWARD        1
 
 
-#define ITERATE_LIST(listptr, type, var) \
-for (var = (type)((struct MinList*)listptr)->mlh_Head; \
- ((struct MinNode*)var)->mln_Succ; \
- var = (type)((struct MinNode*)var)->mln_Succ)
-
-#define INIT_LIST(listptr) \
-((struct MinList*)listptr)->mlh_Head = (struct MinNode*)&((struct MinList*)listptr)->mlh_Tail; \
-((struct MinList*)listptr)->mlh_Tail = NULL; \
-((struct MinList*)listptr)->mlh_TailPred = (struct MinNode*)&((struct MinList*)listptr)->mlh_Head;
-
-
 
 //==============================================================================================
 // bcd2bin()
@@ -172,6 +165,330 @@ uint8_t bcd2bin(uint8_t x)
 }
 
 
+//==============================================================================================
+// msynth_fusable_instr()
+//==============================================================================================
+
+// Checks if the instrument chain ending with 'last' can be rendered by the fused voice renderer.
+// It interpolates linearly, so the chain must end with a linear or nearest neighbour resampler
+// and a panoramizer.
+
+int msynth_fusable_instr(struct DSPObject *last)
+{
+	if (last->dsp_next && (last->dsp_type == DSPTYPE_PANORAMIZER))
+	{
+		struct Resampler20 *rs = (struct Resampler20*)last->dsp_prev;
+
+		if ((rs->interpolation == DB3_RESAMPLER_LINEAR) || (rs->interpolation == DB3_RESAMPLER_NEAREST)) return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+//==============================================================================================
+// msynth_track_output()
+//==============================================================================================
+
+// Returns the object of the track chain, from which the track is mixed. It is the last one,
+// except of echo bypassed in the preview tier, then it is the instrument fetcher.
+
+static inline struct DSPObject *msynth_track_output(struct ModSynth *msyn, struct ModTrack *mt)
+{
+	if (msyn->EchoBypass) return (struct DSPObject*)mt->DSPTrackChain.mlh_Head;
+	return (struct DSPObject*)mt->DSPTrackChain.mlh_TailPred;
+}
+
+
+//==============================================================================================
+// msynth_plan_track()
+//==============================================================================================
+
+// Compiles the render plan of the track from its DSP chains. Must be called after every change
+// of chain topology, of the echo bus membership or of the quality tier.
+
+void msynth_plan_track(struct ModSynth *msyn, struct ModTrack *mt)
+{
+	struct DSPObject *dspo, *output, *last;
+
+	mt->Plan.Echo = NULL;
+
+	ITERATE_LIST(&mt->DSPTrackChain, struct DSPObject*, dspo)
+	{
+		if (dspo->dsp_type == DSPTYPE_ECHO)
+		{
+			mt->Plan.Echo = dspo;
+			break;
+		}
+	}
+
+	output = msynth_track_output(msyn, mt);
+	last = (struct DSPObject*)mt->DSPInstrChain.mlh_TailPred;
+	mt->Plan.Bus = mt->EchoBus && !msyn->EchoBypass;
+
+	// If there is nothing on the track chain except of the instrument fetcher (no echo), it is
+	// skipped, as it only forwards pulls to the instrument chain. Then the instrument chain is
+	// rendered straight into Accumulator by the fused voice renderer if possible.
+
+	if (mt->DSPInstrChain.mlh_TailPred == (struct MinNode*)&mt->DSPInstrChain) mt->Plan.Kind = PLAN_IDLE;
+	else if (output->dsp_type == DSPTYPE_FETCHINSTR)
+	{
+		mt->Plan.Kind = msynth_fusable_instr(last) ? PLAN_VOICE : PLAN_PULL;
+		mt->Plan.Output = last;
+	}
+	else
+	{
+		mt->Plan.Kind = PLAN_PULL;
+		mt->Plan.Output = output;
+	}
+}
+
+
+//==============================================================================================
+// msynth_echo_type()
+//==============================================================================================
+
+// Returns DSPV_EchoType_xxx of the echo on the track, 0 if there is none. Standard echo is the
+// echo bus.
+
+int32_t msynth_echo_type(struct ModTrack *mt)
+{
+	int32_t type = 0;
+
+	if (mt->EchoBus) type = DSPV_EchoType_Old;
+	else if (mt->Plan.Echo) mt->Plan.Echo->dsp_get(mt->Plan.Echo, DSPA_EchoType, &type);
+	return type;
+}
+
+
+//==============================================================================================
+// msynth_mix_track_in()
+//==============================================================================================
+
+// Renders the track and adds it to 'accu'. 'premix' is a buffer for tracks with echo. Returns
+// FALSE if the instrument has finished playing, so the track should be turned off. The function
+// changes nothing outside of the track, so different tracks may be rendered in parallel.
+
+int msynth_mix_track_in(struct ModSynth *msyn, struct ModTrack *mt, int32_t *accu, int16_t *premix, uint32_t frames)
+{
+	int16_t *src;
+	int active;
+
+	switch (mt->Plan.Kind)
+	{
+		// Muted track is not rendered, its instrument is just advanced, so it continues
+		// properly when unmuted.
+
+		case PLAN_VOICE:
+			if (mt->Muted) return dsp_voice_skip(mt->Plan.Output, frames);
+			return dsp_voice_mix(mt->Plan.Output, accu, frames, mt->GainL, mt->GainR, NULL, 0);
+
+		// Just pull needed frames from the output object to PreMixBuf (or map them, if they
+		// are in memory already). Then they get mixed into Accumulator. If Pull() returns 0,
+		// it means instrument has finished playing, so the track is turned off. Tracks with
+		// echo are always rendered, even if muted, as the echo state depends on the signal.
+
+		case PLAN_PULL:
+			active = dsp_pull_span(mt->Plan.Output, &src, premix, frames);
+
+			// Mixing. Volume effects, panning, envelopes are applied and result in
+			// left and right gains (signed 14-bit values) for both channels. The
+			// kernel is selected for the host CPU in DB3_NewEngine().
+
+			if (!mt->Muted) msyn->Mixer.MixTrack(accu, src, frames, mt->GainL, mt->GainR);
+			return active;
+	}
+
+	return FALSE;
+}
+
+
+//==============================================================================================
+// msynth_span_cuts()
+//==============================================================================================
+
+// Stores offsets of ticks started strictly inside the span from block position 'from' to 'to'
+// into 'cuts', relative to 'from'. Returns their number.
+
+int msynth_span_cuts(struct ModSynth *msyn, uint32_t *cuts, uint32_t from, uint32_t to)
+{
+	int cut_count = 0, i;
+
+	for (i = 0; i < msyn->TickCount; i++)
+	{
+		uint32_t tick_start = msyn->TickStarts[i];
+
+		if ((tick_start > from) && (tick_start < to)) cuts[cut_count++] = tick_start - from;
+	}
+
+	return cut_count;
+}
+
+
+//==============================================================================================
+// msynth_fused_voice()
+//==============================================================================================
+
+// Returns the panoramizer of the track, if the track can be rendered by the fused voice renderer
+// (it is unmuted, has no echo and uses linear or nearest neighbour resampler), NULL otherwise.
+
+static inline struct DSPObject *msynth_fused_voice(struct ModTrack *mt)
+{
+	if ((mt->Plan.Kind == PLAN_VOICE) && !mt->Muted) return mt->Plan.Output;
+	return NULL;
+}
+
+
+//==============================================================================================
+// msynth_mix_track_span()
+//==============================================================================================
+
+// Renders the track from block position 'from' to 'to' with its current parameters. 'accu'
+// points to the start of block. Ticks started inside the span matter only when the instrument
+// ends, as the track is turned off at the end of tick. Unmuted tracks without echo are rendered
+// in one pass by the fused voice renderer, others are pulled tick by tick. Returns FALSE when
+// the track should be turned off.
+
+int msynth_mix_track_span(struct ModSynth *msyn, struct ModTrack *mt, int32_t *accu, int16_t *premix, uint32_t from, uint32_t to)
+{
+	uint32_t cuts[MSYNTH_MAX_TICK_STARTS + 1];
+	struct DSPObject *voice;
+	uint32_t start = 0;
+	int cut_count, i;
+
+	cut_count = msynth_span_cuts(msyn, cuts, from, to);
+	accu += from << 1;
+
+	if (voice = msynth_fused_voice(mt))
+	{
+		return dsp_voice_mix(voice, accu, to - from, mt->GainL, mt->GainR, cuts, cut_count);
+	}
+
+	cuts[cut_count++] = to - from;
+
+	for (i = 0; i < cut_count; i++)
+	{
+		if (!msynth_mix_track_in(msyn, mt, accu + (start << 1), premix, cuts[i] - start)) return FALSE;
+		start = cuts[i];
+	}
+
+	return TRUE;
+}
+
+
+//==============================================================================================
+// msynth_render_track()
+//==============================================================================================
+
+// Renders the track from where it has been rendered so far, up to block position 'end', into
+// 'accu', or into 'bus', if the track is mixed into the echo bus. A track which has ended is only
+// marked as being off. It is removed from Active set at the end of mixing block, so the set may
+// be iterated, while tracks are rendered.
+
+void msynth_render_track(struct ModSynth *msyn, struct ModTrack *mt, int32_t *accu, int32_t *bus, int16_t *premix, uint32_t end)
+{
+	if (mt->Plan.Bus) accu = bus;
+
+	if (mt->IsOn && (mt->RenderPos < end))
+	{
+		if (!msynth_mix_track_span(msyn, mt, accu, premix, mt->RenderPos, end)) mt->IsOn = FALSE;
+	}
+
+	mt->RenderPos = end;
+}
+
+
+//==============================================================================================
+// msynth_catch_up()
+//==============================================================================================
+
+// Must be called before the sequencer changes anything affecting rendering of the track: gains,
+// DSP attributes, DSP chains. Then the track is rendered with old parameters up to the current
+// sequencer position.
+
+void msynth_catch_up(struct ModSynth *msyn, struct ModTrack *mt)
+{
+	msynth_render_track(msyn, mt, msyn->Accumulator, msyn->EchoBusBuf, msyn->PreMixBuf, msyn->BlockPos);
+}
+
+
+//==============================================================================================
+// msynth_render_tracks()
+//==============================================================================================
+
+// Renders every 'stride'-th member of Active set starting from 'first' up to block position
+// 'end'. With AVX2, fused voices starting at the same block position and mixed into the same
+// destination are rendered in groups, a voice per SIMD lane. Other tracks are rendered one by
+// one. Results are the same in both cases.
+
+void msynth_render_tracks(struct ModSynth *msyn, int first, int stride, int32_t *accu, int32_t *bus, int16_t *premix, uint32_t end)
+{
+	struct ModTrack *voices[256];
+	int count = 0, i;
+
+	for (i = first; i < msyn->Active.Count; i += stride)
+	{
+		struct ModTrack *mt = &msyn->Tracks[msyn->Active.Members[i]];
+
+		if ((msyn->Mixer.Level >= MIXER_AVX2) && mt->IsOn && (mt->RenderPos < end) && msynth_fused_voice(mt))
+		{
+			int j = count++;
+
+			// Insertion sort by destination, then by render position.
+
+			while ((j > 0) && ((voices[j - 1]->Plan.Bus > mt->Plan.Bus) || ((voices[j - 1]->Plan.Bus == mt->Plan.Bus)
+			 && (voices[j - 1]->RenderPos > mt->RenderPos))))
+			{
+				voices[j] = voices[j - 1];
+				j--;
+			}
+
+			voices[j] = mt;
+		}
+		else msynth_render_track(msyn, mt, accu, bus, premix, end);
+	}
+
+	i = 0;
+
+	while (i < count)
+	{
+		struct DSPObject *pans[VOICE_LANES];
+		int32_t gains[VOICE_LANES * 2];
+		int results[VOICE_LANES];
+		uint32_t cuts[MSYNTH_MAX_TICK_STARTS + 1];
+		uint32_t from = voices[i]->RenderPos;
+		int32_t *dest = voices[i]->Plan.Bus ? bus : accu;
+		int group = 0, k;
+
+		while ((i + group < count) && (group < VOICE_LANES) && (voices[i + group]->RenderPos == from)
+		 && (voices[i + group]->Plan.Bus == voices[i]->Plan.Bus)) group++;
+
+		for (k = 0; k < group; k++)
+		{
+			pans[k] = msynth_fused_voice(voices[i + k]);
+			gains[k << 1] = voices[i + k]->GainL;
+			gains[(k << 1) + 1] = voices[i + k]->GainR;
+		}
+
+		if ((group > 1) && dsp_voice_mix_lanes(pans, gains, results, group, dest + (from << 1), end - from, cuts,
+		 msynth_span_cuts(msyn, cuts, from, end)))
+		{
+			for (k = 0; k < group; k++)
+			{
+				if (!results[k]) voices[i + k]->IsOn = FALSE;
+				voices[i + k]->RenderPos = end;
+			}
+		}
+		else
+		{
+			for (k = 0; k < group; k++) msynth_render_track(msyn, voices[i + k], accu, bus, premix, end);
+		}
+
+		i += group;
+	}
+}
+
+
 //==============================================================================================
 // msynth_dsp_dispose_chain()
 //==============================================================================================
@@ -191,10 +508,12 @@ void msynth_dsp_dispose_chain(struct MinList *chain)
 // msynth_dsp_set_instr_attrs()
 //==============================================================================================
 
-void msynth_dsp_set_instr_attrs(struct ModTrack *mt, struct DSPTag *tags)
+void msynth_dsp_set_instr_attrs(struct ModSynth *msyn, struct ModTrack *mt, struct DSPTag *tags)
 {
 	struct DSPObject *dspo;
 
+	msynth_catch_up(msyn, mt);
+
 	ITERATE_LIST(&mt->DSPInstrChain, struct DSPObject*, dspo)
 	{
 		dspo->dsp_set(dspo, tags);
@@ -206,10 +525,12 @@ void msynth_dsp_set_instr_attrs(struct ModTrack *mt, struct DSPTag *tags)
 // msynth_dsp_set_track_attrs()
 //==============================================================================================
 
-void msynth_dsp_set_track_attrs(struct ModTrack *mt, struct DSPTag *tags)
+void msynth_dsp_set_track_attrs(struct ModSynth *msyn, struct ModTrack *mt, struct DSPTag *tags)
 {
 	struct DSPObject *dspo;
 
+	msynth_catch_up(msyn, mt);
+
 	ITERATE_LIST(&mt->DSPTrackChain, struct DSPObject*, dspo)
 	{
 		dspo->dsp_set(dspo, tags);
@@ -236,20 +557,136 @@ int32_t msynth_dsp_get_instr_attr(struct ModTrack *mt, uint32_t tag)
 
 
 //==============================================================================================
-// msynth_dsp_get_track_attr()
+// msynth_set_add()
 //==============================================================================================
 
-int32_t msynth_dsp_get_track_attr(struct ModTrack *mt, uint32_t tag)
+void msynth_set_add(struct TrackSet *ts, int track)
 {
-	struct DSPObject *dspo;
-	int32_t value = 0;
+	if (ts->Slots[track] == TRACKSET_NONE)
+	{
+		ts->Slots[track] = ts->Count;
+		ts->Members[ts->Count++] = track;
+	}
+}
 
-	ITERATE_LIST(&mt->DSPTrackChain, struct DSPObject*, dspo)
+
+//==============================================================================================
+// msynth_set_remove()
+//==============================================================================================
+
+// The last member is moved into the slot of removed one. Then loops removing members while
+// iterating a set should go from the last member to the first one.
+
+void msynth_set_remove(struct TrackSet *ts, int track)
+{
+	uint16_t slot = ts->Slots[track];
+
+	if (slot != TRACKSET_NONE)
 	{
-		if (dspo->dsp_get(dspo, tag, &value)) return value;
+		uint16_t last = ts->Members[--ts->Count];
+
+		ts->Members[slot] = last;
+		ts->Slots[last] = slot;
+		ts->Slots[track] = TRACKSET_NONE;
 	}
+}
 
-	return 0;
+
+//==============================================================================================
+// msynth_set_clear()
+//==============================================================================================
+
+void msynth_set_clear(struct TrackSet *ts, int tracks)
+{
+	int track;
+
+	for (track = 0; track < tracks; track++) ts->Slots[track] = TRACKSET_NONE;
+	ts->Count = 0;
+}
+
+
+//==============================================================================================
+// msynth_track_on()
+//==============================================================================================
+
+void msynth_track_on(struct ModSynth *msyn, struct ModTrack *mt)
+{
+	mt->IsOn = 1;
+	msynth_set_add(&msyn->Active, mt - msyn->Tracks);
+}
+
+
+//==============================================================================================
+// msynth_track_off()
+//==============================================================================================
+
+void msynth_track_off(struct ModSynth *msyn, struct ModTrack *mt)
+{
+	msynth_catch_up(msyn, mt);
+	mt->IsOn = 0;
+	msynth_set_remove(&msyn->Active, mt - msyn->Tracks);
+}
+
+
+//==============================================================================================
+// msynth_track_settled()
+//==============================================================================================
+
+// Returns TRUE if msynth_post_tick(), msynth_clear_slides() and msynth_setup_slides() have
+// nothing to do for the track: no slides, no appregio or vibrato, volume, panning and pitch
+// within limits and being multiples of the current speed. Such a track need not to be member
+// of the Sliding set.
+
+int msynth_track_settled(struct ModSynth *msyn, struct ModTrack *mt)
+{
+	if (mt->VolumeDelta || mt->PanningDelta || mt->PitchDelta || mt->Porta3Delta) return FALSE;
+	if (mt->ApprTable[1] || mt->ApprTable[2] || mt->VibratoSpeed || mt->VibratoDepth) return FALSE;
+	if ((mt->Volume < msyn->MinVolume) || (mt->Volume > msyn->MaxVolume)) return FALSE;
+	if ((mt->Panning < msyn->MinPanning) || (mt->Panning > msyn->MaxPanning)) return FALSE;
+	if ((mt->Pitch < msyn->MinPitch) || (mt->Pitch > msyn->MaxPitch)) return FALSE;
+	if ((mt->Volume % msyn->Speed) || (mt->Panning % msyn->Speed) || (mt->Pitch % msyn->Speed)) return FALSE;
+	return TRUE;
+}
+
+
+//==============================================================================================
+// msynth_reverse_sample()
+//==============================================================================================
+
+// Makes the reversed copy of the sample played on the track, if it has none and it fits in the
+// module budget. Engines playing the same module may do it at the same time. Memory is reserved
+// in the budget first, then the copy is published, the engine losing the race frees its copy.
+
+static void msynth_reverse_sample(struct DB3Module *m, struct ModTrack *mt)
+{
+	struct DB3ModInstr *mi;
+	struct DB3ModSample *ms;
+	int16_t *guarded, *reversed;
+	int32_t bytes, i;
+
+	if ((mt->Instr == 0) || (mt->Instr > m->NumInstr)) return;
+	mi = m->Instruments[mt->Instr - 1];
+	if (mi->Type != ITYPE_SAMPLE) return;
+	ms = m->Samples[((struct DB3ModInstrS*)mi)->SampleNum];
+	if (!ms || !ms->Data || ms->Reversed) return;
+
+	bytes = (DB3_SAMPLE_GUARD_BEFORE + ms->Frames + DB3_SAMPLE_GUARD_AFTER) * sizeof(int16_t);
+
+	if (db3_atomic_add(&m->ReverseUsed, bytes) > m->ReverseBudget)
+	{
+		db3_atomic_add(&m->ReverseUsed, -bytes);
+		return;
+	}
+
+	if (guarded = db3_malloc(bytes))
+	{
+		reversed = guarded + DB3_SAMPLE_GUARD_BEFORE;
+		for (i = 0; i < ms->Frames; i++) reversed[i] = ms->Data[ms->Frames - 1 - i];
+		if (db3_atomic_cas(&ms->Reversed, NULL, reversed)) return;
+		db3_free(guarded);
+	}
+
+	db3_atomic_add(&m->ReverseUsed, -bytes);
 }
 
 
@@ -257,8 +694,9 @@ int32_t msynth_dsp_get_track_attr(struct ModTrack *mt, uint32_t tag)
 // msynth_trigger()
 //==============================================================================================
 
-void msynth_trigger(struct DB3Module *m, struct ModTrack *mt)
+void msynth_trigger(struct ModSynth *msyn, struct ModTrack *mt)
 {
+	struct DB3Module *m = msyn->Mod;
 	struct DSPObject *last;
 
 	mt->VolEnvCurrent = 16384;
@@ -290,6 +728,7 @@ void msynth_trigger(struct DB3Module *m, struct ModTrack *mt)
 
 	if (last = (struct DSPObject*)mt->DSPInstrChain.mlh_TailPred)
 	{
+		msynth_catch_up(msyn, mt);
 		last->dsp_flush(last);
 
 		if (mt->PlayBackwards)
@@ -300,7 +739,8 @@ void msynth_trigger(struct DB3Module *m, struct ModTrack *mt)
 				{ 0, 0 }
 			};
 
-			msynth_dsp_set_instr_attrs(mt, tags);
+			msynth_reverse_sample(m, mt);
+			msynth_dsp_set_instr_attrs(msyn, mt, tags);
 		}
 		else
 		{
@@ -310,26 +750,76 @@ void msynth_trigger(struct DB3Module *m, struct ModTrack *mt)
 				{ 0, 0 }
 			};
 
-			msynth_dsp_set_instr_attrs(mt, tags);
+			msynth_dsp_set_instr_attrs(msyn, mt, tags);
 		}
 
 		mt->VibratoCounter = 0;
-		mt->IsOn = 1;
+		mt->OneShotPending = (msyn->OneShots.Budget != 0);
+		msynth_track_on(msyn, mt);
 	}
 }
 
 
+//==============================================================================================
+// msynth_oneshot_attach()
+//==============================================================================================
+
+// Connects the note just triggered on the track to the one-shot cache, when its pitch is set.
+// Only notes of instruments without loop, resampled with cubic or sinc interpolation are cached.
+// Linear and nearest neighbour voices are rendered by the fused voice renderer, which is not
+// slower than copying.
+
+static void msynth_oneshot_attach(struct ModSynth *msyn, struct ModTrack *mt)
+{
+	struct DB3ModInstrS *mis;
+	struct DB3ModSample *ms;
+	struct Resampler20 *rs;
+	struct OneShotKey key;
+	uint64_t length;
+
+	mt->OneShotPending = FALSE;
+	if (!mt->Instr || !(mis = (struct DB3ModInstrS*)msyn->Mod->Instruments[mt->Instr - 1])) return;
+	if ((mis->Instr.Type != ITYPE_SAMPLE) || ((mis->Flags & IF_LOOP_MASK) != IF_NO_LOOP)) return;
+	rs = (struct Resampler20*)((struct DSPObject*)mt->DSPInstrChain.mlh_TailPred)->dsp_prev;
+	if ((rs->interpolation != DB3_RESAMPLER_CUBIC) && (rs->interpolation != DB3_RESAMPLER_SINC)) return;
+	if (!rs->flushed || rs->oneshot || !rs->ratio) return;
+
+	// The note is not longer than the source at the mip level used, followed by up to three
+	// blocks filled after its end.
+
+	dsp_resampler20_select_level(rs);
+	ms = msyn->Mod->Samples[mis->SampleNum];
+	length = ((((uint64_t)ms->Frames >> rs->level) + 1 + 3 * 1024) << 16) / rs->step + 2;
+	if (length > 0x7FFFFFFF) length = 0x7FFFFFFF;
+	key.Instr = mt->Instr;
+	key.Ratio = rs->ratio;
+	key.Offset = mt->TrigOffset;
+	key.Backwards = mt->PlayBackwards;
+	key.Interpolation = rs->interpolation;
+	oneshot_attach(&msyn->OneShots, rs, &key, length);
+}
+
+
 //==============================================================================================
 // msynth_instrument()
 //==============================================================================================
 
 int msynth_instrument(struct ModSynth *msyn, struct ModTrack *mt, int instr)
 {
+	struct VoiceObjects *vo = &msyn->Voices[mt - msyn->Tracks];
 	struct DB3ModInstr *mi;
 
-	msynth_dsp_dispose_chain(&mt->DSPInstrChain);
+	// The chain is emptied, its objects are kept for the next instrument. A cached note is
+	// released at once.
+
+	msynth_catch_up(msyn, mt);
+	dsp_resampler20_oneshot_leave((struct Resampler20*)vo->Resampler);
+	INIT_LIST(&mt->DSPInstrChain);
+	msynth_plan_track(msyn, mt);
 	mt->Instr = 0;
-	mt->IsOn = 0;
+	mt->OneShotPending = FALSE;
+	msynth_track_off(msyn, mt);
+	msynth_set_remove(&msyn->Armed, mt - msyn->Tracks);
 
 	/*-----------------------------------------------------------------*/
 	/* Added 20.11.2009: Some modules contain triggers of non-existing */
@@ -352,7 +842,6 @@ int msynth_instrument(struct ModSynth *msyn, struct ModTrack *mt, int instr)
 		{
 			struct DB3ModInstrS *mis = (struct DB3ModInstrS*)mi;
 			struct DB3ModSample *ms = msyn->Mod->Samples[mis->SampleNum];
-			struct DSPObject *wavetable, *zeropadder, *resampler, *panoramizer;
 
 			// There may be instruments with proper, but empty samples. If such an
 			// instrument is triggered, just turn the channel off to the next trigger.
@@ -361,31 +850,26 @@ int msynth_instrument(struct ModSynth *msyn, struct ModTrack *mt, int instr)
 
 			if ((mis->Flags & IF_LOOP_MASK) == IF_NO_LOOP)
 			{
-				wavetable = dsp_sampled_instr_new(ms->Data, 0, 0, 0, ms->Frames, IF_NO_LOOP);
+				dsp_sampled_instr_bind(vo->Wavetable, ms->Data, ms->Mips, &ms->Reversed, NULL, 0, 0, 0, ms->Frames, IF_NO_LOOP);
 			}
 			else   // Forward or pingpong loop. I assume mis->LoopLen > 0.
 			{
-				wavetable = dsp_sampled_instr_new(ms->Data, mis->LoopStart, mis->LoopLen, 0x7FFFFFFF, ms->Frames, mis->Flags & IF_LOOP_MASK);
-			}
-
-			zeropadder = dsp_zeropadder_new(0);
-			resampler = dsp_resampler20_new();
-			panoramizer = dsp_panoramizer_new(msyn->PanPhaseTable);
-
-			if (wavetable && zeropadder && resampler && panoramizer)
-			{
-				DB3AddTail(&mt->DSPInstrChain, (struct MinNode*)wavetable);
-				DB3AddTail(&mt->DSPInstrChain, (struct MinNode*)zeropadder);
-				DB3AddTail(&mt->DSPInstrChain, (struct MinNode*)resampler);
-				DB3AddTail(&mt->DSPInstrChain, (struct MinNode*)panoramizer);
-				mt->Instr = instr;
-				return TRUE;
+				dsp_sampled_instr_bind(vo->Wavetable, ms->Data, ms->Mips, &ms->Reversed, mis->LoopImage, mis->LoopStart, mis->LoopLen, 0x7FFFFFFF, ms->Frames, mis->Flags & IF_LOOP_MASK);
 			}
 
-			if (wavetable) wavetable->dsp_dispose(wavetable);
-			if (zeropadder) zeropadder->dsp_dispose(zeropadder);
-			if (resampler) resampler->dsp_dispose(resampler);
-			if (panoramizer) panoramizer->dsp_dispose(panoramizer);
+			dsp_zeropadder_bind(vo->ZeroPadder, 0);
+			dsp_resampler20_bind((struct Resampler20*)vo->Resampler, msyn->Interpolation, msyn->ResamplerTables[msyn->Interpolation]);
+			dsp_panoramizer_bind(vo->Panoramizer);
+			DB3AddTail(&mt->DSPInstrChain, (struct MinNode*)vo->Wavetable);
+			DB3AddTail(&mt->DSPInstrChain, (struct MinNode*)vo->ZeroPadder);
+			DB3AddTail(&mt->DSPInstrChain, (struct MinNode*)vo->Resampler);
+			DB3AddTail(&mt->DSPInstrChain, (struct MinNode*)vo->Panoramizer);
+			msynth_plan_track(msyn, mt);
+			mt->Step = MSYNTH_STEP_UNSET;
+			mt->PanPhase = MSYNTH_PAN_UNSET;
+			mt->Instr = instr;
+			msynth_set_add(&msyn->Armed, mt - msyn->Tracks);
+			return TRUE;
 		}
 		break;
 	}
@@ -400,7 +884,8 @@ int msynth_instrument(struct ModSynth *msyn, struct ModTrack *mt, int instr)
 
 // Sets the pitch for the current instrument on the track. Does neither set nor
 // retrigger the instrument. 'pitch' parameter is in finetune unit prescaled by
-// current module speed. 0 of pitch is C-0 note.
+// current module speed. 0 of pitch is C-0 note. A changed ratio is marked dirty,
+// it is passed to the resampler with msynth_apply_voice().
 
 void msynth_pitch(struct ModSynth *msyn, struct ModTrack *mt, uint16_t pitch)
 {
@@ -418,7 +903,6 @@ void msynth_pitch(struct ModSynth *msyn, struct ModTrack *mt, uint16_t pitch)
 					uint32_t samplestep, alpha, beta;
 					uint64_t samplestep64 = 0;
 					uint16_t f_tune, s_porta, octave = 0;
-					struct DSPTag tags[2] = {{ DSPA_ResamplerRatio, 0 }, { 0, 0 }};
 
 					s_porta	= pitch % msyn->Speed;
 					f_tune = pitch / msyn->Speed;
@@ -435,8 +919,15 @@ void msynth_pitch(struct ModSynth *msyn, struct ModTrack *mt, uint16_t pitch)
 					samplestep64 = (uint64_t)mis->C3Freq * beta * alpha;
 					samplestep64 >>= 19 - octave;
 					samplestep = (uint32_t)(samplestep64 / msyn->MixFreq);
-					tags[0].dspt_data = samplestep;
-					msynth_dsp_set_instr_attrs(mt, tags);
+
+					// Unchanged ratio is not marked, so the track need not to be
+					// rendered up to this point.
+
+					if (samplestep != mt->Step)
+					{
+						mt->Step = samplestep;
+						mt->Dirty |= VOICE_DIRTY_RATIO;
+					}
 				}
 			}
 		}
@@ -552,13 +1043,96 @@ void msynth_apply_delayed(struct ModSynth *msyn)
 
 
 //==============================================================================================
-// msynth_echo_on_for_track()
+// msynth_echo_bus_catch_up()
+//==============================================================================================
+
+// Must be called before echo bus parameters or its members change. Tracks mixed into the bus are
+// rendered up to the current sequencer position, then the bus echo processes the bus up to the
+// same position and adds it to Accumulator.
+
+void msynth_echo_bus_catch_up(struct ModSynth *msyn)
+{
+	uint32_t pos = msyn->EchoBusPos;
+	int i;
+
+	if (!msyn->EchoBusTracks || msyn->EchoBypass || (pos >= msyn->BlockPos)) return;
+
+	for (i = 0; i < msyn->Active.Count; i++)
+	{
+		struct ModTrack *mt = &msyn->Tracks[msyn->Active.Members[i]];
+
+		if (mt->Plan.Bus) msynth_catch_up(msyn, mt);
+	}
+
+	dsp_echo_bus_mix(msyn->EchoBus, msyn->EchoBusBuf + (pos << 1), msyn->Accumulator + (pos << 1), msyn->BlockPos - pos);
+	msyn->EchoBusPos = msyn->BlockPos;
+}
+
+
+//==============================================================================================
+// msynth_echo_bus_join()
+//==============================================================================================
+
+// Standard echo has the same parameters for all tracks, so tracks with it are summed into the
+// echo bus, processed by a single echo. The bus and its echo are made when a track joins it for
+// the first time. When the first track joins, the echo is started with empty delay line, as
+// there was no echo before.
+
+void msynth_echo_bus_join(struct ModSynth *msyn, struct ModTrack *mt)
+{
+	if (!msyn->EchoBus)
+	{
+		if (msyn->EchoBusBuf = db3_malloc(msyn->BufSize << 3))
+		{
+			if (!(msyn->EchoBus = dsp_echo_bus_new(msyn->MixFreq)))
+			{
+				db3_free(msyn->EchoBusBuf);
+				msyn->EchoBusBuf = NULL;
+			}
+		}
+
+		if (!msyn->EchoBus) return;
+	}
+
+	msynth_catch_up(msyn, mt);
+
+	if (msyn->EchoBusTracks++ == 0)
+	{
+		msyn->EchoBus->dsp_flush(msyn->EchoBus);
+		msyn->EchoBusPos = msyn->BlockPos;
+	}
+
+	mt->EchoBus = TRUE;
+	mt->EchoType = DSPV_EchoType_Old;
+	msynth_plan_track(msyn, mt);
+}
+
+
+//==============================================================================================
+// msynth_echo_bus_leave()
+//==============================================================================================
+
+// The track is mixed into Accumulator from now on. The echo bus is stopped, when the last track
+// leaves it. Its echo tail is dropped then, the same as the tail of echo removed from a track.
+
+void msynth_echo_bus_leave(struct ModSynth *msyn, struct ModTrack *mt)
+{
+	msynth_echo_bus_catch_up(msyn);
+	msynth_catch_up(msyn, mt);
+	mt->EchoBus = FALSE;
+	msyn->EchoBusTracks--;
+	msynth_plan_track(msyn, mt);
+}
+
+
+//==============================================================================================
+// msynth_echo_on_for_track()
 //==============================================================================================
 
 // Used for both standard, global echo and new per-track echo. The only difference is echo type,
-// as per-track echo parameters default to standard ones. Echo is inserted as the last object in
-// the track DSP chain. Echo should not be added more than one time, so if DSPTYPE_ECHO object
-// already exists in the track DSP chain, this function does nothing.
+// as per-track echo parameters default to standard ones. Standard echo joins the track to the
+// echo bus. New echo is inserted as the last object in the track DSP chain. Echo should not be
+// added more than one time, so if the track has echo already, this function does nothing.
 
 void msynth_echo_on_for_track(struct ModSynth *msyn, struct ModTrack *mt, int type)
 {
@@ -566,7 +1140,13 @@ void msynth_echo_on_for_track(struct ModSynth *msyn, struct ModTrack *mt, int ty
 
 	// checking echo module existence
 
-	if (msynth_dsp_get_track_attr(mt, DSPA_EchoType) > 0) return;
+	if (msynth_echo_type(mt) > 0) return;
+
+	if (type == DSPV_EchoType_Old)
+	{
+		msynth_echo_bus_join(msyn, mt);
+		return;
+	}
 
 	// adding echo
 
@@ -574,8 +1154,10 @@ void msynth_echo_on_for_track(struct ModSynth *msyn, struct ModTrack *mt, int ty
 
 	if (echo)
 	{
+		msynth_catch_up(msyn, mt);
 		DB3AddTail(&mt->DSPTrackChain, (struct MinNode*)echo);
 		mt->EchoType = type;
+		msynth_plan_track(msyn, mt);
 	}
 }
 
@@ -584,11 +1166,11 @@ void msynth_echo_on_for_track(struct ModSynth *msyn, struct ModTrack *mt, int ty
 // msynth_echo_off_for_track
 //==============================================================================================
 
-// Searches the track DSP chain for [the first] DSPTYPE_ECHO object and removes it. If there is
-// no DSPTYPE_ECHO object in the track DSP chain, the function does nothing. The function
+// Searches the track DSP chain for [the first] DSPTYPE_ECHO object and removes it, or removes
+// the track from the echo bus. If the track has no echo, the function does nothing. The function
 // removes echo only if it matches passed 'type'.
 
-inline void msynth_echo_off_for_track(struct ModTrack *mt, int type)
+inline void msynth_echo_off_for_track(struct ModSynth *msyn, struct ModTrack *mt, int type)
 {
 	struct DSPObject *obj;
 	int echo_type;
@@ -596,20 +1178,22 @@ inline void msynth_echo_off_for_track(struct ModTrack *mt, int type)
 	// the check below exits the function either if there is no echo in the chain, or echo type
 	// does not match
 
-	echo_type = msynth_dsp_get_track_attr(mt, DSPA_EchoType);
+	echo_type = msynth_echo_type(mt);
 	if (echo_type != type) return;
 
-	// locate echo object and remove it
-
-	ITERATE_LIST(&mt->DSPTrackChain, struct DSPObject*, obj)
+	if (mt->EchoBus)
 	{
-		if (obj->dsp_type == DSPTYPE_ECHO)
-		{
-			DB3Remove((struct MinNode*)obj);
-			obj->dsp_dispose(obj);
-			break;
-		}
+		msynth_echo_bus_leave(msyn, mt);
+		return;
 	}
+
+	// the echo object is known from the render plan
+
+	obj = mt->Plan.Echo;
+	msynth_catch_up(msyn, mt);
+	DB3Remove((struct MinNode*)obj);
+	obj->dsp_dispose(obj);
+	msynth_plan_track(msyn, mt);
 }
 
 
@@ -643,7 +1227,7 @@ void msynth_echo_off_for_all_tracks(struct ModSynth *msyn)
 
 	for (track_number = 0; track_number < msyn->Mod->NumTracks; track_number++)
 	{
-		msynth_echo_off_for_track(&msyn->Tracks[track_number], DSPV_EchoType_Old);
+		msynth_echo_off_for_track(msyn, &msyn->Tracks[track_number], DSPV_EchoType_Old);
 	}
 }
 
@@ -653,8 +1237,8 @@ void msynth_echo_off_for_all_tracks(struct ModSynth *msyn)
 //==============================================================================================
 
 // This function checks the echo type in the track. If there is no echo, or echo is
-// DSPV_EchoType_Old, echo parameters are set for all tracks with old echo. If echo is
-// DSPV_EchoType_New, parameters are changed for this track only.
+// DSPV_EchoType_Old, echo parameters are set for the echo bus and stored in all tracks with old
+// echo. If echo is DSPV_EchoType_New, parameters are changed for this track only.
 
 void msynth_change_echo_params(struct ModSynth *msyn, struct ModTrack *mt)
 {
@@ -666,7 +1250,7 @@ void msynth_change_echo_params(struct ModSynth *msyn, struct ModTrack *mt)
 	tags[3].dspt_tag = DSPA_EchoDelay;      tags[3].dspt_data = mt->EchoDelay;
 	tags[4].dspt_tag = TAG_END;
 
-	if (msynth_dsp_get_track_attr(mt, DSPA_EchoType) == DSPV_EchoType_New) msynth_dsp_set_track_attrs(mt, tags);
+	if (msynth_echo_type(mt) == DSPV_EchoType_New) msynth_dsp_set_track_attrs(msyn, mt, tags);
 	else
 	{
 		int track_num;
@@ -676,15 +1260,20 @@ void msynth_change_echo_params(struct ModSynth *msyn, struct ModTrack *mt)
 		{
 			mt2 = &msyn->Tracks[track_num];
 
-			if (msynth_dsp_get_track_attr(mt2, DSPA_EchoType) == DSPV_EchoType_Old)
+			if (msynth_echo_type(mt2) == DSPV_EchoType_Old)
 			{
 				mt2->EchoFeedback = mt->EchoFeedback;
 				mt2->EchoMix = mt->EchoMix;
 				mt2->EchoCross = mt->EchoCross;
 				mt2->EchoDelay = mt->EchoDelay;
-				msynth_dsp_set_track_attrs(mt2, tags);
 			}
 		}
+
+		if (msyn->EchoBus)
+		{
+			msynth_echo_bus_catch_up(msyn);
+			msyn->EchoBus->dsp_set(msyn->EchoBus, tags);
+		}
 	}
 }
 
@@ -722,7 +1311,7 @@ void msynth_effect_exx(struct ModSynth *msyn, struct ModTrack *mt, uint8_t param
 		case 0x4:
 			if (param == 0x40)          /* E40 - track mute */
 			{
-				mt->IsOn = FALSE;
+				msynth_track_off(msyn, mt);
 			}
 		break;
 
@@ -1071,9 +1660,9 @@ void msynth_effect(struct ModSynth *msyn, struct ModTrack *mt, uint8_t cmd, uint
 			{
 				switch (p0)
 				{
-					case 0:  msynth_echo_off_for_track(mt, DSPV_EchoType_Old);        break;
+					case 0:  msynth_echo_off_for_track(msyn, mt, DSPV_EchoType_Old);       break;
 					case 1:  msynth_echo_off_for_all_tracks(msyn);                    break;
-					case 2:  msynth_echo_off_for_track(mt, DSPV_EchoType_New);        break;
+					case 2:  msynth_echo_off_for_track(msyn, mt, DSPV_EchoType_New);       break;
 				}
 			}
 		}
@@ -1294,7 +1883,7 @@ void msynth_next_row(struct ModSynth *msyn)
 				// sustain A, sustain B" order. If an instruments has neither volume
 				// nor panning envelope, cut the channel off.
 
-				if ((mt->VolEnv.Index == 0xFFFF) && (mt->PanEnv.Index = 0xFFFF)) mt->IsOn = FALSE;
+				if ((mt->VolEnv.Index == 0xFFFF) && (mt->PanEnv.Index = 0xFFFF)) msynth_track_off(msyn, mt);
 
 				if (mt->VolEnv.Index != 0xFFFF)
 				{
@@ -1334,6 +1923,10 @@ void msynth_next_row(struct ModSynth *msyn)
 
 		if (me->Cmd1 || me->Param1) msynth_effect(msyn, mt, me->Cmd1, me->Param1);
 		if (me->Cmd2 || me->Param2) msynth_effect(msyn, mt, me->Cmd2, me->Param2);
+
+		// Slides or new values may need processing in msynth_post_tick().
+
+		if (!msynth_track_settled(msyn, mt)) msynth_set_add(&msyn->Sliding, track);
 		me++;
 	}
 
@@ -1376,11 +1969,13 @@ void msynth_next_row(struct ModSynth *msyn)
 
 void msynth_post_tick(struct ModSynth *msyn)
 {
-	int track;
+	int i;
 
-	for (track = 0; track < msyn->Mod->NumTracks; track++)
+	// Only tracks of Sliding set are processed, for other ones this loop changes nothing.
+
+	for (i = msyn->Sliding.Count - 1; i >= 0; i--)
 	{
-		struct ModTrack *mt = &msyn->Tracks[track];
+		struct ModTrack *mt = &msyn->Tracks[msyn->Sliding.Members[i]];
 		int32_t porta_target;
 
 		// Volume slides (accumulated).
@@ -1420,6 +2015,8 @@ void msynth_post_tick(struct ModSynth *msyn)
 
 		if (mt->Pitch > msyn->MaxPitch) mt->Pitch = msyn->MaxPitch;
 		if (mt->Pitch < msyn->MinPitch) mt->Pitch = msyn->MinPitch;
+
+		if (msynth_track_settled(msyn, mt)) msynth_set_remove(&msyn->Sliding, mt - msyn->Tracks);
 	}
 
 	// Hxx, global volume slide
@@ -1436,26 +2033,25 @@ void msynth_post_tick(struct ModSynth *msyn)
 
 void msynth_do_triggers(struct ModSynth *msyn)
 {
-	int track;
+	int i;
 
-	for (track = 0; track < msyn->Mod->NumTracks; track++)
+	// Armed set contains all tracks with an instrument set.
+
+	for (i = 0; i < msyn->Armed.Count; i++)
 	{
-		struct ModTrack *mt = &msyn->Tracks[track];
+		struct ModTrack *mt = &msyn->Tracks[msyn->Armed.Members[i]];
 
-		if (mt->Instr)
+		if (mt->TrigCounter == 0)
 		{
-			if (mt->TrigCounter == 0)
-			{
-				msynth_trigger(msyn->Mod, mt);
-				mt->TrigCounter = mt->Retrigger;
-			}
-			mt->TrigCounter--;
+			msynth_trigger(msyn, mt);
+			mt->TrigCounter = mt->Retrigger;
+		}
+		mt->TrigCounter--;
 
-			// Note that note cut does not switch the channel off, the note is being
-			// continued with 0 volume.
+		// Note that note cut does not switch the channel off, the note is being
+		// continued with 0 volume.
 
-			if (mt->CutCounter-- <= 0) mt->Volume = 0;
-		}
+		if (mt->CutCounter-- <= 0) mt->Volume = 0;
 	}
 }
 
@@ -1466,17 +2062,23 @@ void msynth_do_triggers(struct ModSynth *msyn)
 
 void msynth_clear_slides(struct ModSynth *msyn)
 {
-	int track;
+	int i;
 
 	// Scale back current volume/pan to PT units and pitch to finetunes.
 	// Clear deltas.
 	// Clear appregio table entries 1 and 2 (entry 0 is always cleared).
 	// Clear appregio (global) counter
 	// Clear vibrato
+	//
+	// Tracks outside of Sliding set have nothing to clear and their values are
+	// multiples of speed. They are rescaled in msynth_setup_slides(), only if
+	// speed is changed.
 
-	for (track = 0; track < msyn->Mod->NumTracks; track++)
+	msyn->ClearSpeed = msyn->Speed;
+
+	for (i = 0; i < msyn->Sliding.Count; i++)
 	{
-		struct ModTrack *mt = &msyn->Tracks[track];
+		struct ModTrack *mt = &msyn->Tracks[msyn->Sliding.Members[i]];
 
 		mt->VolumeDelta = 0;
 		mt->PanningDelta = 0;
@@ -1513,19 +2115,37 @@ void msynth_clear_slides(struct ModSynth *msyn)
 
 void msynth_setup_slides(struct ModSynth *msyn)
 {
-	int track;
+	int i, track;
 
 	// Scale current volume, panning, pitch with current speed.
 
-	for (track = 0; track < msyn->Mod->NumTracks; track++)
+	for (i = 0; i < msyn->Sliding.Count; i++)
 	{
-		struct ModTrack *mt = &msyn->Tracks[track];
+		struct ModTrack *mt = &msyn->Tracks[msyn->Sliding.Members[i]];
 
 		mt->Volume *= msyn->Speed;
 		mt->Panning *= msyn->Speed;
 		mt->Pitch *= msyn->Speed;
 	}
 
+	// Other tracks were not scaled back in msynth_clear_slides(), it is needed
+	// only when speed has been changed.
+
+	if (msyn->Speed != msyn->ClearSpeed)
+	{
+		for (track = 0; track < msyn->Mod->NumTracks; track++)
+		{
+			struct ModTrack *mt = &msyn->Tracks[track];
+
+			if (msyn->Sliding.Slots[track] == TRACKSET_NONE)
+			{
+				mt->Volume = mt->Volume / msyn->ClearSpeed * msyn->Speed;
+				mt->Panning = mt->Panning / msyn->ClearSpeed * msyn->Speed;
+				mt->Pitch = mt->Pitch / msyn->ClearSpeed * msyn->Speed;
+			}
+		}
+	}
+
 	// Calculate limits.
 
 	msyn->MinVolume = 0;
@@ -1538,23 +2158,46 @@ void msynth_setup_slides(struct ModSynth *msyn)
 }
 
 
+//==============================================================================================
+// msynth_apply_voice()
+//==============================================================================================
+
+// Passes voice parameters marked dirty in the current tick to the DSP stages using them. The
+// track is rendered up to this point with old values once. Gains are used by the mixer only,
+// gains of muted track are not used, so the track need not to be rendered for them.
+
+static void msynth_apply_voice(struct ModSynth *msyn, struct ModTrack *mt)
+{
+	struct VoiceObjects *vo = &msyn->Voices[mt - msyn->Tracks];
+
+	if ((mt->Dirty != VOICE_DIRTY_GAINS) || !mt->Muted) msynth_catch_up(msyn, mt);
+	if (mt->Dirty & VOICE_DIRTY_RATIO) dsp_resampler20_set_ratio((struct Resampler20*)vo->Resampler, mt->Step);
+	if (mt->Dirty & VOICE_DIRTY_PANNING) dsp_panoramizer_set_panning(vo->Panoramizer, mt->PanPhase);
+	mt->Dirty = 0;
+}
+
+
 //==============================================================================================
 // msynth_tick_gains_and_pitch()
 //==============================================================================================
 
 void msynth_tick_gains_and_pitch(struct ModSynth *msyn)
 {
-	int track;
+	int i;
 
-	for (track = 0; track < msyn->Mod->NumTracks; track++)
+	// Gains and pitch of tracks being off are not needed. When such a track is
+	// triggered, this function is called before the track is mixed. Vibrato
+	// counter is reset at trigger as well.
+
+	for (i = 0; i < msyn->Active.Count; i++)
 	{
-		struct ModTrack *mt = &msyn->Tracks[track];
-		int32_t vol, volc, pan, pitch, p2;
+		struct ModTrack *mt = &msyn->Tracks[msyn->Active.Members[i]];
+		int32_t vol, volc, pan, pitch, p2, gain_l;
 		int16_t p1;
-		struct DSPTag tags[2] = { 
-			{ DSPA_Panning, 0 },
-			{ TAG_END, 0},
-		};
+
+		// Track may have ended in this mixing block already.
+
+		if (!mt->IsOn) continue;
 
 		pitch = mt->Pitch;
 		pitch += mt->ApprTable[msyn->ApprCounter];
@@ -1563,7 +2206,6 @@ void msynth_tick_gains_and_pitch(struct ModSynth *msyn)
 		mt->VibratoCounter &= 0x3F;
 		msynth_pitch(msyn, mt, pitch);
 
-
 		// Convert [PT * speed] units of accumulated volume slide to 14-bit gain.
 		// Apply panning then.
 		// mt->Volume               <0, +64 * speed>    |  volc      <0, +16384>
@@ -1613,7 +2255,7 @@ void msynth_tick_gains_and_pitch(struct ModSynth *msyn)
 			vol >>= 14;
 		}
 
-		mt->GainL = vol;
+		gain_l = vol;
 
 		vol = volc;
 
@@ -1623,12 +2265,26 @@ void msynth_tick_gains_and_pitch(struct ModSynth *msyn)
 			vol >>= 14;
 		}
 
-		mt->GainR = vol;
+		if ((gain_l != mt->GainL) || (vol != mt->GainR)) mt->Dirty |= VOICE_DIRTY_GAINS;
 
-		// Send panning to the panoramizer for phase augmented panning.
+		// Panning for phase augmented panning in the panoramizer.
 
-		tags[0].dspt_data = mt->Panning / msyn->Speed;
-		msynth_dsp_set_instr_attrs(mt, tags);
+		if (mt->Panning / msyn->Speed != mt->PanPhase)
+		{
+			mt->PanPhase = mt->Panning / msyn->Speed;
+			mt->Dirty |= VOICE_DIRTY_PANNING;
+		}
+
+		if (mt->Dirty)
+		{
+			msynth_apply_voice(msyn, mt);
+			mt->GainL = gain_l;
+			mt->GainR = vol;
+		}
+
+		// A cached note is matched against the ratio just set.
+
+		if (mt->OneShotPending) msynth_oneshot_attach(msyn, mt);
 	}
 }
 
@@ -1696,11 +2352,11 @@ int16_t msynth_panenv_interpolator(struct EnvInterp *evi, struct DB3ModEnvelope
 
 void msynth_do_envelopes(struct ModSynth *msyn)
 {
-	int16_t track;
+	int i;
 
-	for (track = 0; track < msyn->Mod->NumTracks; track++)
+	for (i = 0; i < msyn->Active.Count; i++)
 	{
-		struct ModTrack *mt = &msyn->Tracks[track];
+		struct ModTrack *mt = &msyn->Tracks[msyn->Active.Members[i]];
 
 		if (mt->IsOn && (mt->VolEnv.Index != 0xFFFF))
 		{
@@ -1819,6 +2475,15 @@ void msynth_init_tracks(struct ModSynth *msyn, int unmute)
 {
 	int16_t track;
 
+	// All tracks are off and have no instruments. Pitch 0 is below limits, so every track
+	// is clipped in the first msynth_post_tick().
+
+	msynth_set_clear(&msyn->Active, msyn->Mod->NumTracks);
+	msynth_set_clear(&msyn->Armed, msyn->Mod->NumTracks);
+	msynth_set_clear(&msyn->Sliding, msyn->Mod->NumTracks);
+	msyn->SoloTracks = 0;
+	msyn->EchoBusTracks = 0;
+
 	for (track = 0; track < msyn->Mod->NumTracks; track++)
 	{
 		struct ModTrack *mt = &msyn->Tracks[track];
@@ -1828,12 +2493,16 @@ void msynth_init_tracks(struct ModSynth *msyn, int unmute)
 		mt->IsOn = 0;
 		mt->Muted = 1;
 		if (unmute) mt->Muted = 0;
+		mt->UserMute = mt->Muted;
+		mt->Solo = FALSE;
 		mt->Pitch = 0;
 		mt->ApprTable[0] = 0;     // entries 1 and 2 are cleared before every position
 		mt->Porta3Target = 576;   // C-4
 		mt->Old.VolSlide = 0;
 		mt->Old.PanSlide = 0;
 		mt->PlayBackwards = FALSE;
+		mt->OneShotPending = FALSE;
+		mt->EchoBus = FALSE;
 		mt->VibratoCounter = 0;
 		mt->TrigCounter = 0x7FFFFFFF;
 		mt->CutCounter = 0x7FFFFFFF;
@@ -1848,6 +2517,11 @@ void msynth_init_tracks(struct ModSynth *msyn, int unmute)
 		mt->VibratoDepth = 0;
 		mt->Volume = 0;
 		mt->Panning = 0;
+		mt->Step = MSYNTH_STEP_UNSET;
+		mt->PanPhase = MSYNTH_PAN_UNSET;
+		mt->Dirty = 0;
+		mt->RenderPos = 0;
+		msynth_set_add(&msyn->Sliding, track);
 
 		INIT_LIST(&mt->DSPInstrChain);
 		INIT_LIST(&mt->DSPTrackChain);
@@ -1868,6 +2542,8 @@ void msynth_init_tracks(struct ModSynth *msyn, int unmute)
 
 		if (msyn->Mod->DspDefaults.EffectMask[track] & DSP_MASK_ECHO) msynth_echo_on_for_track(msyn, mt, DSPV_EchoType_Old);
 		else mt->EchoType = 0;
+
+		msynth_plan_track(msyn, mt);
 	}
 }
 
@@ -1909,50 +2585,47 @@ void msynth_reset(struct ModSynth* msyn, int unmute)
 
 
 //==============================================================================================
-// msynth_mix_track_in()
+// msynth_render_job()
 //==============================================================================================
 
-void msynth_mix_track_in(struct ModSynth *msyn, unsigned int track, int32_t *accu, unsigned long frames)
-{
-	struct ModTrack *mt = &msyn->Tracks[track];
-	struct DSPObject *dspo;
-
-	// Skip inactive track immediately.
+// Renders a part of active tracks to the end of mixing block in a worker pool thread. Tracks are
+// distributed between threads in turn. Thread 0 mixes into Accumulator and EchoBusBuf, other
+// threads into partial accumulators and echo buses.
 
-	if (!mt->IsOn) return;
+void msynth_render_job(void *context, int thread)
+{
+	struct RenderJob *job = (struct RenderJob*)context;
+	struct ModSynth *msyn = job->Synth;
+	int32_t *accu = msyn->Accumulator;
+	int32_t *bus = msyn->EchoBusBuf;
+	int16_t *premix = msyn->PreMixBuf;
 
-	// Just pull needed frames from the last DSP object on the track to PreMixBuf.
-	// Then PreMixBuf gets mixed into Accumulator. If Pull() returns 0, it means
-	// instrument has finished playing, so the track is turned off.
+	if (thread > 0)
+	{
+		accu = msyn->PartialAccus + (thread - 1) * msyn->BufSize * 2;
+		bus = msyn->PartialEchoBusBufs + (thread - 1) * msyn->BufSize * 2;
+		premix = msyn->PartialPreMixBufs + (thread - 1) * msyn->BufSize * 2;
+	}
 
-	dspo = (struct DSPObject*)mt->DSPTrackChain.mlh_TailPred;
+	msynth_render_tracks(msyn, thread, msyn->Threads, accu, bus, premix, job->End);
+}
 
-	if (dspo->dsp_next)    // The chain is not empty?
-	{
-		uint32_t i;
-		int16_t *premix = msyn->PreMixBuf;
 
-		mt->IsOn = dspo->dsp_pull(dspo, premix, frames);
+//==============================================================================================
+// msynth_update_mutes()
+//==============================================================================================
 
-		// Mixing. Volume effects, panning, envelopes are applied and result in
-		// left and right gains (signed 14-bit values) for both channels. Sample
-		// is multiplied by gains, shifted 6 bits right (as I can have up to 256
-		// channels), then added to left and right channel.
+// Calculates effective mute state of all tracks from user mutes and solos.
 
-		if (!mt->Muted)
-		{
-			for (i = 0; i < frames; i++)
-			{
-				int32_t left, right;
+void msynth_update_mutes(struct ModSynth *msyn)
+{
+	int track;
 
-				// PreMix buffer contains stereo samples, because panoramizer splits channels.
+	for (track = 0; track < msyn->Mod->NumTracks; track++)
+	{
+		struct ModTrack *mt = &msyn->Tracks[track];
 
-				left = *premix++ * mt->GainL;
-				right = *premix++ * mt->GainR;
-				*accu++ += left >> 14;
-				*accu++ += right >> 14;
-			}
-		}
+		mt->Muted = mt->UserMute || (msyn->SoloTracks && !mt->Solo);
 	}
 }
 
@@ -1963,13 +2636,7 @@ void msynth_mix_track_in(struct ModSynth *msyn, unsigned int track, int32_t *acc
 
 void msynth_accumulator_clear(struct ModSynth *msyn, uint32_t frames)
 {
-	int32_t *p = msyn->Accumulator;
-
-	while (frames--)
-	{
-		*p++ = 0;
-		*p++ = 0;
-	}
+	msyn->Mixer.Clear(msyn->Accumulator, frames);
 }
 
 
@@ -1979,368 +2646,1288 @@ void msynth_accumulator_clear(struct ModSynth *msyn, uint32_t frames)
 
 void msynth_accumulator_flush(struct ModSynth *msyn, uint32_t frames, int16_t *out)
 {
-	int32_t *p = msyn->Accumulator;
-	uint32_t ctr = frames;
+	msyn->Mixer.Flush(msyn->Accumulator, out, frames, msyn->BoostMultiplier, msyn->BoostLimit);
+}
 
-	while (ctr--)
-	{
-		int32_t s;
 
-		s = *p++;                          // left
-		if (s > msyn->BoostLimit) *out = 0x7FFF;
-		else if (s < -msyn->BoostLimit) *out = 0x8001;
-		else *out = s * msyn->BoostMultiplier >> 16;
-		out++;
 
-		s = *p++;                          // right
-		if (s > msyn->BoostLimit) *out = 0x7FFF;
-		else if (s < -msyn->BoostLimit) *out = 0x8001;
-		else *out = s * msyn->BoostMultiplier >> 16;
-		out++;
-	}
-}
+//==============================================================================================
+// msynth_free_threads()
+//==============================================================================================
 
+void msynth_free_threads(struct ModSynth *msyn)
+{
+	pool_dispose(msyn->Pool);
+	if (msyn->PartialAccus) db3_free(msyn->PartialAccus);
+	if (msyn->PartialPreMixBufs) db3_free(msyn->PartialPreMixBufs);
+	if (msyn->PartialEchoBusBufs) db3_free(msyn->PartialEchoBusBufs);
+	msyn->Pool = NULL;
+	msyn->PartialAccus = NULL;
+	msyn->PartialPreMixBufs = NULL;
+	msyn->PartialEchoBusBufs = NULL;
+	msyn->Threads = 1;
+}
 
 
 //==============================================================================================
-// msynth_boost_multiplier()
+// msynth_free_voices()
 //==============================================================================================
 
-int32_t msynth_boost_multiplier(int16_t db_boost, int16_t chans)
+void msynth_free_voices(struct ModSynth *msyn)
 {
-	int64_t b = 0x00010000;
+	int track;
 
-	while (db_boost >= 6) { db_boost -= 6; b <<= 1; }
-	while (db_boost < 0) { db_boost += 6; b >>= 1; }
-	b	*= DbVals[db_boost];
-	b	/= chans;
-	b	>>= 16;
-	return (int32_t)b;
+	if (msyn->Voices)
+	{
+		for (track = 0; track < msyn->Mod->NumTracks; track++)
+		{
+			struct VoiceObjects *vo = &msyn->Voices[track];
+
+			if (vo->Wavetable) vo->Wavetable->dsp_dispose(vo->Wavetable);
+			if (vo->ZeroPadder) vo->ZeroPadder->dsp_dispose(vo->ZeroPadder);
+			if (vo->Resampler) vo->Resampler->dsp_dispose(vo->Resampler);
+			if (vo->Panoramizer) vo->Panoramizer->dsp_dispose(vo->Panoramizer);
+		}
+
+		db3_free(msyn->Voices);
+		msyn->Voices = NULL;
+	}
 }
 
 
-/* === API === */
+//==============================================================================================
+// msynth_alloc_voices()
+//==============================================================================================
 
-/****** libdigibooster3/DB3_NewEngine ***************************************
-*
-* NAME
-*   DB3_NewEngine() -- creates and setups a new module synthesizer.
-*
-* SYNOPSIS
-*   void* DB3_NewEngine(struct DB3Module *mod, uint32_t mixfreq, uint32_t
-*   maxbuf);
-*
-* FUNCTION
-*   Creates and setups a new module synthesizer for passed module, mixing
-*   frequency and declared maximum mising buffer size. Allocates all buffers
-*   needed.
-*
-* INPUTS
-*   mod - complete music module as defined in "musicmodule.h". NULL is safe,
-*     function just returns NULL.
-*   mixfreq - downmix sampling frequency in Hz. Allowed frequencies are 8 kHz
-*     to 192 kHz (including).
-*   maxbuf - maximum number of frames that will be requested in DB3_Mix()
-*     calls. Note that some internal buffers are allocated based on this
-*     value, so setting it high may result in unexpected memory consumption.
-*     Values up to mixing frequency (which yields one second buffer) are
-*     reasonable. Very short buffers are allowed (yes, even one single
-*     frame), but highly ineffective. Zero passed here causes the function to
-*     quit immediately with NULL result.
-*
-* RESULT
-*   An opaque pointer to the new module synthesizer, or NULL in case of wrong
-*   arguments or memory shortage.
-*
-* SEE ALSO
-*   DB3_Mix()
-*
-*****************************************************************************
-*
-*/
+// Creates instrument chain objects of every track. They are bound to instruments later, in
+// msynth_instrument(). Returns FALSE in case of memory shortage.
 
-void* DB3_NewEngine(struct DB3Module *m, uint32_t mixfreq, uint32_t bufsize)
+int msynth_alloc_voices(struct ModSynth *msyn)
 {
-	struct ModSynth *msyn = NULL;
+	int track;
 
-	if (m && bufsize && (mixfreq >= 8000) && (mixfreq <= 192000))
+	if (msyn->Voices = db3_malloc(msyn->Mod->NumTracks * sizeof(struct VoiceObjects)))
 	{
-		if (msyn = db3_malloc(sizeof(struct ModSynth)))
+		for (track = 0; track < msyn->Mod->NumTracks; track++)
 		{
-			if (msyn->Accumulator = db3_malloc(bufsize << 3))
-			{
-				if (msyn->PreMixBuf = db3_malloc(bufsize << 2))     
-				{
-					if (msyn->Tracks = db3_malloc(m->NumTracks * sizeof(struct ModTrack)))
-					{
-						msyn->Mod = m;
-						msyn->MixFreq = mixfreq;
-						msyn->UpdateCallback = NULL;
-						msynth_reset(msyn, TRUE);
-						generate_panoramizer_phase_table(msyn->PanPhaseTable, mixfreq);
-						DB3_SetVolume(msyn, 0);
-						DB3_SetPos(msyn, 0, 0, 0);
-						return (void*)msyn;
-					}
+			struct VoiceObjects *vo = &msyn->Voices[track];
 
-					db3_free(msyn->PreMixBuf);
-				}
+			vo->Wavetable = dsp_sampled_instr_new(NULL, NULL, NULL, NULL, 0, 0, 0, 0, IF_NO_LOOP);
+			vo->ZeroPadder = dsp_zeropadder_new(0);
+			vo->Resampler = dsp_resampler20_new();
+			vo->Panoramizer = dsp_panoramizer_new(msyn->PanPhaseTable);
 
-				db3_free(msyn->Accumulator);
+			if (!vo->Wavetable || !vo->ZeroPadder || !vo->Resampler || !vo->Panoramizer)
+			{
+				msynth_free_voices(msyn);
+				return FALSE;
 			}
-
-			db3_free(msyn);
 		}
+
+		return TRUE;
 	}
 
-	return NULL;
+	return FALSE;
 }
 
 
-/****** libdigibooster3/DB3_SetCallback() ***********************************
-*
-* NAME
-*   DB3_SetCallback() -- Sets a position update callback function for a
-*   synthesizer.
-*
-* SYNOPSIS
-*   void DB3_SetCallback(void *engine, void(*callback)(void*, struct
-*   UpdateEvent*), void *userdata);
-*
-* FUNCTION
-*   This function is provided for players that want to know exact time of
-*   position changes in a module. Useful for example for displaying current
-*   pattern/row number, scrolling pattern display or synchronizing something
-*   to the music. Using this callback it is possible to get position change
-*   timing with single downmix frame accuracy. The callback gets number of
-*   row, pattern, song order and delay, measured in downmix frames relative
-*   to the start of last module fragment rendered with ModSynth_Mix(). To get
-*   realtime trigger, audio interrupts or timers may be used, depending on
-*   features available on host. To convert the delay to seconds one just
-*   divides delay in frames by mixing frequency.
-*
-* INPUTS
-*   engine - an opaque pointer to the module synthesizer created with
-*     DB3_NewEngine(). NULL is safe, the function does nothing in the case.
-*
-*   callback - a callback function defined as:
-*
-*     void callback(void *udata, struct UpdateEvent *uevent);
+//==============================================================================================
+// msynth_resampler_table()
+//==============================================================================================
+
+// Generates polyphase coefficients needed for the interpolation, if not generated yet. Returns
+// FALSE in case of memory shortage.
+
+static int msynth_resampler_table(struct ModSynth *msyn, int interpolation)
+{
+	int16_t **table = &msyn->ResamplerTables[interpolation];
+
+	if (*table) return TRUE;
+
+	if (interpolation == DB3_RESAMPLER_CUBIC)
+	{
+		if (*table = db3_malloc(POLY_PHASES * POLY_CUBIC_TAPS * sizeof(int16_t))) generate_cubic_table(*table);
+	}
+	else if (interpolation == DB3_RESAMPLER_SINC)
+	{
+		if (*table = db3_malloc(POLY_PHASES * POLY_SINC_TAPS * sizeof(int16_t))) generate_sinc_table(*table);
+	}
+	else return TRUE;
+
+	return (*table != NULL);
+}
+
+
+//==============================================================================================
+// msynth_set_tier()
+//==============================================================================================
+
+// Switches the engine to a quality tier. Resamplers of playing instruments are switched at once.
+// Panoramizers get the new phase table at the next tick, when the panning is sent again.
+// Polyphase tables of the tier must be generated already.
+
+static void msynth_set_tier(struct ModSynth *msyn, int quality)
+{
+	int track, i;
+
+	switch (quality)
+	{
+		case DB3_QUALITY_PREVIEW: msyn->Interpolation = DB3_RESAMPLER_NEAREST; break;
+		case DB3_QUALITY_MASTER: msyn->Interpolation = DB3_RESAMPLER_SINC; break;
+		default: msyn->Interpolation = msyn->Resampler; break;
+	}
+
+	msyn->Quality = quality;
+	msyn->EchoBypass = (quality == DB3_QUALITY_PREVIEW);
+	msyn->GovernorHold = 0;
+
+	if (quality == DB3_QUALITY_PREVIEW) for (i = 0; i < 128; i++) msyn->PanPhaseTable[i] = 0;
+	else generate_panoramizer_phase_table(msyn->PanPhaseTable, msyn->MixFreq);
+
+	for (track = 0; track < msyn->Mod->NumTracks; track++)
+	{
+		struct ModTrack *mt = &msyn->Tracks[track];
+		struct DSPObject *dspo;
+
+		ITERATE_LIST(&mt->DSPInstrChain, struct DSPObject*, dspo)
+		{
+			if (dspo->dsp_type == DSPTYPE_RESAMPLER)
+			{
+				dsp_resampler20_set_interpolation((struct Resampler20*)dspo, msyn->Interpolation,
+				 msyn->ResamplerTables[msyn->Interpolation]);
+			}
+		}
+
+		mt->PanPhase = MSYNTH_PAN_UNSET;
+		msynth_plan_track(msyn, mt);
+	}
+}
+
+
+#ifdef MSYNTH_GOVERNOR
+
+//==============================================================================================
+// msynth_clock()
+//==============================================================================================
+
+// Monotonic time in microseconds.
+
+static uint64_t msynth_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+//==============================================================================================
+// msynth_governor()
+//==============================================================================================
+
+// Updates the average load with render time of 'frames' frames taking 'usec' microseconds, then
+// steps the tier down or up, if the load has been out of the middle band for the hold time. The
+// average is taken over about 8 mixing calls.
+
+static void msynth_governor(struct ModSynth *msyn, uint32_t frames, uint64_t usec)
+{
+	uint64_t load;
+
+	if (!frames) return;
+	load = (usec * msyn->MixFreq << 8) / ((uint64_t)frames * 1000000);
+	if (load > 0xFFFF) load = 0xFFFF;
+	msyn->GovernorLoad = (msyn->GovernorLoad * 7 + (uint32_t)load) >> 3;
+	msyn->GovernorHold += frames;
+
+	if (msyn->GovernorLoad > MSYNTH_GOVERNOR_HIGH)
+	{
+		if ((msyn->Quality > DB3_QUALITY_PREVIEW) && (msyn->GovernorHold >= msyn->MixFreq / MSYNTH_GOVERNOR_DOWN_HOLD))
+		{
+			msynth_set_tier(msyn, msyn->Quality - 1);
+		}
+	}
+	else if ((msyn->GovernorLoad < MSYNTH_GOVERNOR_LOW) && (msyn->Quality < msyn->MaxQuality))
+	{
+		if (msyn->GovernorHold >= msyn->MixFreq * MSYNTH_GOVERNOR_UP_HOLD) msynth_set_tier(msyn, msyn->Quality + 1);
+	}
+	else msyn->GovernorHold = 0;
+}
+
+#endif  /* MSYNTH_GOVERNOR */
+
+
+//==============================================================================================
+// msynth_render()
+//==============================================================================================
+
+// Runs the sequencer and mixes 'frames' frames into Accumulator. Returns number of rendered
+// frames, which is less than requested, when the sequencer has been stopped.
+
+uint32_t msynth_render(struct ModSynth *msyn, uint32_t frames)
+{
+	uint32_t frame_counter = 0;
+	unsigned long frames_left = frames;
+	int stop = 0, i;
+#ifdef MSYNTH_GOVERNOR
+	uint64_t start = 0;
+
+	if (msyn->Governor) start = msynth_clock();
+#endif
+
+	msynth_accumulator_clear(msyn, frames);
+	if (msyn->EchoBus) msyn->Mixer.Clear(msyn->EchoBusBuf, frames);
+
+	if (msyn->Pool)
+	{
+		for (i = 1; i < msyn->Threads; i++)
+		{
+			msyn->Mixer.Clear(msyn->PartialAccus + (i - 1) * msyn->BufSize * 2, frames);
+			if (msyn->EchoBus) msyn->Mixer.Clear(msyn->PartialEchoBusBufs + (i - 1) * msyn->BufSize * 2, frames);
+		}
+	}
+
+	// Tracks and the echo bus are rendered from the start of block.
+
+	msyn->BlockPos = 0;
+	msyn->TickCount = 0;
+	msyn->EchoBusPos = 0;
+
+	for (i = 0; i < msyn->Active.Count; i++) msyn->Tracks[msyn->Active.Members[i]].RenderPos = 0;
+
+	// Only the sequencer runs tick by tick. Tracks are rendered, when the sequencer changes
+	// their parameters, then at the end of block.
+
+	while (!stop && frames_left)
+	{
+		uint32_t frame_chunk;
+
+		if (msyn->TickSamplesHi == 0)
+		{
+			msyn->BlockPos = frame_counter;
+
+			if (msyn->TickCount == MSYNTH_MAX_TICK_STARTS)
+			{
+				for (i = 0; i < msyn->Active.Count; i++) msynth_catch_up(msyn, &msyn->Tracks[msyn->Active.Members[i]]);
+				msyn->TickCount = 0;
+			}
+
+			msyn->TickStarts[msyn->TickCount++] = frame_counter;
+			stop = msynth_next_tick(msyn, frame_counter);
+		}
+
+		frame_chunk = msyn->TickSamplesHi;
+		if (frame_chunk > frames_left) frame_chunk = frames_left;
+		frames_left -= frame_chunk;
+		msyn->TickSamplesHi -= frame_chunk;
+		frame_counter += frame_chunk;
+	}
+
+	// Resampling and mixing up to the end of block. Only tracks being on are mixed. Tracks
+	// may be rendered by the worker pool. Tracks which have ended are removed from the set.
+
+	msyn->BlockPos = frame_counter;
+
+	if (msyn->Pool && (msyn->Active.Count > 1))
+	{
+		struct RenderJob job;
+
+		job.Synth = msyn;
+		job.End = frame_counter;
+		pool_run(msyn->Pool, msynth_render_job, &job);
+	}
+	else msynth_render_tracks(msyn, 0, 1, msyn->Accumulator, msyn->EchoBusBuf, msyn->PreMixBuf, frame_counter);
+
+	for (i = msyn->Active.Count - 1; i >= 0; i--)
+	{
+		struct ModTrack *mt = &msyn->Tracks[msyn->Active.Members[i]];
+
+		if (!mt->IsOn) msynth_track_off(msyn, mt);
+	}
+
+	// Partial accumulators and echo buses of threads are added to the main ones. Integer addition
+	// gives results independent of the number of threads. Then the echo bus is processed to the
+	// end of block.
+
+	if (msyn->Pool)
+	{
+		for (i = 1; i < msyn->Threads; i++)
+		{
+			msyn->Mixer.Add(msyn->Accumulator, msyn->PartialAccus + (i - 1) * msyn->BufSize * 2, frames);
+			if (msyn->EchoBus) msyn->Mixer.Add(msyn->EchoBusBuf, msyn->PartialEchoBusBufs + (i - 1) * msyn->BufSize * 2, frames);
+		}
+	}
+
+	msynth_echo_bus_catch_up(msyn);
+
+#ifdef MSYNTH_GOVERNOR
+	if (msyn->Governor) msynth_governor(msyn, frames, msynth_clock() - start);
+#endif
+
+	return frame_counter;
+}
+
+
+//==============================================================================================
+// msynth_boost_multiplier()
+//==============================================================================================
+
+int32_t msynth_boost_multiplier(int16_t db_boost, int16_t chans)
+{
+	int64_t b = 0x00010000;
+
+	while (db_boost >= 6) { db_boost -= 6; b <<= 1; }
+	while (db_boost < 0) { db_boost += 6; b >>= 1; }
+	b	*= DbVals[db_boost];
+	b	/= chans;
+	b	>>= 16;
+	return (int32_t)b;
+}
+
+
+/* === API === */
+
+/****** libdigibooster3/DB3_NewEngine ***************************************
+*
+* NAME
+*   DB3_NewEngine() -- creates and setups a new module synthesizer.
+*
+* SYNOPSIS
+*   void* DB3_NewEngine(struct DB3Module *mod, uint32_t mixfreq, uint32_t
+*   maxbuf);
+*
+* FUNCTION
+*   Creates and setups a new module synthesizer for passed module, mixing
+*   frequency and declared maximum mising buffer size. Allocates all buffers
+*   needed.
+*
+* INPUTS
+*   mod - complete music module as defined in "musicmodule.h". NULL is safe,
+*     function just returns NULL.
+*   mixfreq - downmix sampling frequency in Hz. Allowed frequencies are 8 kHz
+*     to 192 kHz (including).
+*   maxbuf - maximum number of frames that will be requested in DB3_Mix()
+*     calls. Note that some internal buffers are allocated based on this
+*     value, so setting it high may result in unexpected memory consumption.
+*     Values up to mixing frequency (which yields one second buffer) are
+*     reasonable. Very short buffers are allowed (yes, even one single
+*     frame), but highly ineffective. Zero passed here causes the function to
+*     quit immediately with NULL result.
+*
+* RESULT
+*   An opaque pointer to the new module synthesizer, or NULL in case of wrong
+*   arguments or memory shortage.
+*
+* NOTES
+*   The engine uses linear interpolation. Use DB3_NewEngineEx() to select
+*   another resampler.
+*
+* SEE ALSO
+*   DB3_Mix(), DB3_NewEngineEx()
+*
+*****************************************************************************
+*
+*/
+
+void* DB3_NewEngine(struct DB3Module *m, uint32_t mixfreq, uint32_t bufsize)
+{
+	return DB3_NewEngineEx(m, mixfreq, bufsize, DB3_RESAMPLER_LINEAR);
+}
+
+
+/****** libdigibooster3/DB3_NewEngineEx() ***********************************
+*
+* NAME
+*   DB3_NewEngineEx() -- creates a module synthesizer with options.
+*
+* SYNOPSIS
+*   void* DB3_NewEngineEx(struct DB3Module *mod, uint32_t mixfreq, uint32_t
+*   maxbuf, uint32_t flags);
+*
+* FUNCTION
+*   Works like DB3_NewEngine(), additionally selects synthesizer options.
+*   The option is the resampler used for all instruments, which trades
+*   quality for speed:
+*     DB3_RESAMPLER_LINEAR - linear interpolation, fast, the same as
+*       in DB3_NewEngine(). Suitable for previews.
+*     DB3_RESAMPLER_CUBIC - 4-point cubic (Catmull-Rom) interpolation.
+*       Noticeably reduces high frequency noise of upsampled instruments.
+*     DB3_RESAMPLER_SINC - 16-tap Blackman windowed sinc interpolation. The
+*       best quality, the slowest. Suitable for offline rendering.
+*     DB3_RESAMPLER_NEAREST - no interpolation, the nearest preceding sample
+*       is used. Even faster than linear, with audible aliasing.
+*
+* INPUTS
+*   mod - complete music module as defined in "musicmodule.h". NULL is safe,
+*     function just returns NULL.
+*   mixfreq - downmix sampling frequency in Hz, see DB3_NewEngine().
+*   maxbuf - maximum number of frames that will be requested in DB3_Mix()
+*     calls, see DB3_NewEngine().
+*   flags - one of DB3_RESAMPLER_xxx values. Other bits should be 0.
+*
+* RESULT
+*   An opaque pointer to the new module synthesizer, or NULL in case of wrong
+*   arguments or memory shortage.
+*
+* NOTES
+*   Cubic and sinc resamplers bypass the fused voice renderer used for
+*   tracks without their own echo, so they are slower than the linear one
+*   not only because of longer filters. Use "dbmbench" tool to measure the
+*   speed of every resampler on a given module. The resampler is the one of
+*   the normal quality tier, see DB3_SetQuality().
+*
+* SEE ALSO
+*   DB3_NewEngine(), DB3_Mix(), DB3_SetQuality()
+*
+*****************************************************************************
+*
+*/
+
+void* DB3_NewEngineEx(struct DB3Module *m, uint32_t mixfreq, uint32_t bufsize, uint32_t flags)
+{
+	struct ModSynth *msyn = NULL;
+	uint32_t resampler = flags & DB3_RESAMPLER_MASK;
+
+	if (m && bufsize && (mixfreq >= 8000) && (mixfreq <= 192000) && (resampler <= DB3_RESAMPLER_NEAREST))
+	{
+		if (msyn = db3_malloc(sizeof(struct ModSynth)))
+		{
+			if (msyn->Accumulator = db3_malloc(bufsize << 3))
+			{
+				if (msyn->PreMixBuf = db3_malloc(bufsize << 2))     
+				{
+					if (msyn->Tracks = db3_malloc(m->NumTracks * sizeof(struct ModTrack)))
+					{
+						if (msyn->TrackSetBuf = db3_malloc(m->NumTracks * sizeof(uint16_t) * 6))
+						{
+							msyn->Active.Members = msyn->TrackSetBuf;
+							msyn->Active.Slots = msyn->TrackSetBuf + m->NumTracks;
+							msyn->Armed.Members = msyn->TrackSetBuf + m->NumTracks * 2;
+							msyn->Armed.Slots = msyn->TrackSetBuf + m->NumTracks * 3;
+							msyn->Sliding.Members = msyn->TrackSetBuf + m->NumTracks * 4;
+							msyn->Sliding.Slots = msyn->TrackSetBuf + m->NumTracks * 5;
+							msyn->Mod = m;
+							msyn->MixFreq = mixfreq;
+							msyn->BufSize = bufsize;
+							msyn->Threads = 1;
+							msyn->Pool = NULL;
+							msyn->PartialAccus = NULL;
+							msyn->PartialPreMixBufs = NULL;
+							msyn->PartialEchoBusBufs = NULL;
+							msyn->EchoBus = NULL;
+							msyn->EchoBusBuf = NULL;
+							msyn->UpdateCallback = NULL;
+							msyn->Resampler = resampler;
+							msyn->Interpolation = resampler;
+							msyn->Quality = DB3_QUALITY_NORMAL;
+							msyn->MaxQuality = DB3_QUALITY_NORMAL;
+							msyn->Governor = FALSE;
+							oneshot_init(&msyn->OneShots);
+
+							if (msynth_alloc_voices(msyn))
+							{
+								if (msynth_resampler_table(msyn, resampler))
+								{
+									mixer_init(&msyn->Mixer);
+									msynth_reset(msyn, TRUE);
+									generate_panoramizer_phase_table(msyn->PanPhaseTable, mixfreq);
+									DB3_SetVolume(msyn, 0);
+									DB3_SetPos(msyn, 0, 0, 0);
+									return (void*)msyn;
+								}
+
+								msynth_free_voices(msyn);
+							}
+
+							db3_free(msyn->TrackSetBuf);
+						}
+
+						db3_free(msyn->Tracks);
+					}
+
+					db3_free(msyn->PreMixBuf);
+				}
+
+				db3_free(msyn->Accumulator);
+			}
+
+			db3_free(msyn);
+		}
+	}
+
+	return NULL;
+}
+
+
+/****** libdigibooster3/DB3_SetCallback() ***********************************
+*
+* NAME
+*   DB3_SetCallback() -- Sets a position update callback function for a
+*   synthesizer.
+*
+* SYNOPSIS
+*   void DB3_SetCallback(void *engine, void(*callback)(void*, struct
+*   UpdateEvent*), void *userdata);
+*
+* FUNCTION
+*   This function is provided for players that want to know exact time of
+*   position changes in a module. Useful for example for displaying current
+*   pattern/row number, scrolling pattern display or synchronizing something
+*   to the music. Using this callback it is possible to get position change
+*   timing with single downmix frame accuracy. The callback gets number of
+*   row, pattern, song order and delay, measured in downmix frames relative
+*   to the start of last module fragment rendered with ModSynth_Mix(). To get
+*   realtime trigger, audio interrupts or timers may be used, depending on
+*   features available on host. To convert the delay to seconds one just
+*   divides delay in frames by mixing frequency.
+*
+* INPUTS
+*   engine - an opaque pointer to the module synthesizer created with
+*     DB3_NewEngine(). NULL is safe, the function does nothing in the case.
+*
+*   callback - a callback function defined as:
+*
+*     void callback(void *udata, struct UpdateEvent *uevent);
+*
+*     where:
+*       udata - may be anything. This is just a pointer passed as userdata to
+*         DB3_SetCallback(), untouched.
+*       uevent - pointer to a read-only UpdateEvent structure:
+*         From "libdigibooster3.h":
+*
+*         struct UpdateEvent
+*         {
+*           int32_t ue_Order;     // number of order in the playlist
+*           int32_t ue_Pattern;   // ordinal number of pattern
+*           int32_t ue_Row;       // number of row (position) in the pattern
+*           int32_t ue_Delay;     // event delay in sample frames
+*           int32_t ue_Tempo;     // current module tempo ("CIA tempo"), BPM
+*           int32_t ue_Speed;     // current module speed (ticks per row)
+*           int32_t ue_SeqHalted; // TRUE if sequencer is halted
+*         };
+*
+*     NULL callback is safe and is considered as turning the callback feature
+*     off. Callback may be turned on and off (or changed) as needed.
+*
+*   userdata - any value, just passed to the callback as described above.
+*
+* RESULT
+*   None.
+*
+* EXAMPLE
+*   A step by step instruction how to get realtime position change triggers
+*   using Amiga timers:
+*   - Be prepared that one call to ModSynth_Mix() will call your callback
+*     more than one time.
+*   - In the callback convert delay from samples to timer units (usually
+*     EClocks or CPU clocks). Prepare a timer request for every callback.
+*   - Get current system clock.
+*   - Push the rendered buffer to audio hardware.
+*   - Add current clock to requests and sent them all to timer (WAITECLOCK or
+*     WAITCPUCLOCK unit).
+*   - while buffer is playing, wait for timer requests to be replied and take
+*     desired actions.
+*   There may be some additional delay if an event occurs just a few frames
+*   after buffer start (adding time and sending requests takes some CPU
+*   cycles). It may be compensated by using triple buffering and sending time
+*   requests one buffer earlier (a buffer length in frames should be added to the
+*   delay before conversion to timer units).
+*
+* SEE ALSO
+*   DB3_Mix()
+*
+*****************************************************************************
+*
+*/
+
+void DB3_SetCallback(void *msyn0, void(*callback)(void*, struct UpdateEvent*), void *userdata)
+{
+	struct ModSynth *msyn = (struct ModSynth*)msyn0;
+
+	msyn->UserData = userdata;
+	msyn->UpdateCallback = callback;
+}
+
+
+/****** libdigibooster3/DB3_SetVolume() *************************************
+*
+* NAME
+*   DB3_SetVolume() -- sets the current master volume level.
+*
+* SYNOPSIS
+*   void DB3_SetVolume(void *engine, int16_t level);
+*
+* FUNCTION
+*   The function sets the master volume level in decibels. 0 dB level is
+*   defined in the following way: if one assumes full amplitude on all the
+*   tracks in the module, the final downmix will have full amplitude too.
+*   Then 0 dB and below is overdrive-safe. Master volume above 0 dB may cause
+*   overdrive, which is then saturated. The allowed range is from -84 dB to
+*   +24 dB including.
+*
+*  Master volume level operates inside the internal 32-bit mixer. Then
+*  adjusting volume with this function gives less quantization noise than
+*  scaling the output 16-bit stream.
+*
+* INPUTS
+*   engine - an opaque pointer to the module synthesizer created with
+*     DB3_NewEngine(). Must not be NULL.
+*   level - master volume level in decibels. Must be inside <-84, +24> range.
+*
+* RESULT
+*   None.
+*
+*****************************************************************************
+*
+*/
+
+void DB3_SetVolume(void *msyn0, int16_t level)
+{
+	struct ModSynth *msyn = (struct ModSynth*)msyn0;
+
+	if (msyn->BoostMultiplier = msynth_boost_multiplier(level, msyn->Mod->NumTracks))
+	{
+		msyn->BoostLimit = 0x7FFFFFFF / msyn->BoostMultiplier;
+	}
+	else msyn->BoostLimit = 0x7FFFFFFF;
+}
+
+
+/****** libdigibooster3/DB3_SetPos() ****************************************
+*
+* NAME
+*   DB3_SetPos() -- Sets the current sequencer position.
+*
+* SYNOPSIS
+*   void DB3_SetPos(void *modsynth, uint32_t song, uint32_t order, uint32_t
+*   row);
+*
+* FUNCTION
+*
+* INPUTS
+*   engine - an opaque pointer to the module synthesizer created with
+*     DB3_NewEngine(). Must not be NULL.
+*   song - number of song in the module. Starting from 0.
+*   order - number of playlist order in the song. Starting from 0.
+*   row - number of row in the pattern selected with order. Starting from 0.
+*
+* RESULT
+*   None.
+*
+* NOTES
+*   All three parameters *must* specify a valid position inside the module.
+*   If not, the sequencer will read random data and probably crash.
+*
+*****************************************************************************
+*
+*/
+
+void DB3_SetPos(void *msyn0, uint32_t song, uint32_t order, uint32_t row)
+{
+	struct ModSynth *msyn = (struct ModSynth*)msyn0;
+
+	msyn->Song = song;
+	msyn->Order = order;
+	msyn->Pattern = msyn->Mod->Songs[song]->PlayList[order];
+	msyn->Row = row;
+	msyn->Tick = 0;
+}
+
+
+/****** libdigibooster3/DB3_Mix() *******************************************
+*
+* NAME
+*   DB3_Mix() -- Mixes down a next chunk of module.
+*
+* SYNOPSIS
+*   uint32_t DB3_Mix(void *engine, uint32_t frames, int16_t *output);
+*
+* FUNCTION
+*   Synthetises and mixes frame chunk of module sound. Mixed frames are
+*   stored in 'output'. If a position callback is defined, it is called for
+*   every module position change within rendered audio frames range.
+*   Following calls to this function need not to use the same number of
+*   audio frames.
+*
+* INPUTS
+*   engine - a blackbox pointer to the synthesizer engine.
+*   frames - number of audio frames to render. Must not be higher than buffer
+*     size declared in DB3_NewEngine(), will be clipped if higher. Passing 0
+*     is OK (function returns immediately).
+*   output - buffer for rendered frames. Note that frames are stereo, so the
+*     buffer must have at least (4 * frames) bytes. It must point to a valid
+*     buffer.
+*
+* RESULT
+*   Number of valid frames in the buffer. It may be less than 'frames' in
+*   case the sequencer has been stopped.
+*
+* SEE ALSO
+*   DB3_NewEngine(), DB3_SetCallback()
+*
+*****************************************************************************
+*
+*/
+
+uint32_t DB3_Mix(void *msyn0, uint32_t frames, int16_t *out)
+{
+	struct ModSynth *msyn = (struct ModSynth*)msyn0;
+	uint32_t frame_counter;
+
+	frame_counter = msynth_render(msyn, frames);
+	msynth_accumulator_flush(msyn, frames, out);
+	return frame_counter;
+}
+
+
+/****** libdigibooster3/DB3_MixInt32() **************************************
+*
+* NAME
+*   DB3_MixInt32() -- Mixes down a next chunk of module to 32-bit integers.
+*
+* SYNOPSIS
+*   uint32_t DB3_MixInt32(void *engine, uint32_t frames, int32_t *output,
+*   uint32_t layout);
+*
+* FUNCTION
+*   Works the same as DB3_Mix(), but produces 32-bit samples, so the
+*   precision of the internal mixer is not lost. Full scale of output is
+*   full 32-bit range. Saturation happens at the same master volume levels
+*   as for DB3_Mix(), but output of DB3_Mix() shifted 16 bits left is only
+*   an approximation of this function output.
+*
+* INPUTS
+*   engine - a blackbox pointer to the synthesizer engine.
+*   frames - number of audio frames to render. Must not be higher than buffer
+*     size declared in DB3_NewEngine(). Passing 0 is OK (function returns
+*     immediately).
+*   output - buffer for rendered frames. It must have at least (8 * frames)
+*     bytes.
+*   layout - DB3_LAYOUT_INTERLEAVED for stereo frames (left, right, left,
+*     right...). DB3_LAYOUT_PLANAR for left channel samples in the first
+*     half of the buffer, and right channel in the second half, starting
+*     from output[frames].
+*
+* RESULT
+*   Number of valid frames in the buffer. It may be less than 'frames' in
+*   case the sequencer has been stopped.
+*
+* SEE ALSO
+*   DB3_Mix(), DB3_MixFloat()
+*
+*****************************************************************************
+*
+*/
+
+uint32_t DB3_MixInt32(void *msyn0, uint32_t frames, int32_t *out, uint32_t layout)
+{
+	struct ModSynth *msyn = (struct ModSynth*)msyn0;
+	uint32_t frame_counter;
+
+	frame_counter = msynth_render(msyn, frames);
+
+	if (layout == DB3_LAYOUT_PLANAR)
+	{
+		msyn->Mixer.FlushInt32Planar(msyn->Accumulator, out, out + frames, frames, msyn->BoostMultiplier, msyn->BoostLimit);
+	}
+	else msyn->Mixer.FlushInt32(msyn->Accumulator, out, frames, msyn->BoostMultiplier, msyn->BoostLimit);
+
+	return frame_counter;
+}
+
+
+/****** libdigibooster3/DB3_MixFloat() **************************************
+*
+* NAME
+*   DB3_MixFloat() -- Mixes down a next chunk of module to floats.
+*
+* SYNOPSIS
+*   uint32_t DB3_MixFloat(void *engine, uint32_t frames, float *output,
+*   uint32_t layout);
+*
+* FUNCTION
+*   Works the same as DB3_Mix(), but produces floating point samples. Full
+*   scale is <-1.0, +1.0> range. The output is not saturated, so with master
+*   volume above 0 dB it may exceed full scale.
+*
+* INPUTS
+*   engine - a blackbox pointer to the synthesizer engine.
+*   frames - number of audio frames to render. Must not be higher than buffer
+*     size declared in DB3_NewEngine(). Passing 0 is OK (function returns
+*     immediately).
+*   output - buffer for rendered frames. It must have at least (8 * frames)
+*     bytes.
+*   layout - DB3_LAYOUT_INTERLEAVED or DB3_LAYOUT_PLANAR, see DB3_MixInt32().
+*
+* RESULT
+*   Number of valid frames in the buffer. It may be less than 'frames' in
+*   case the sequencer has been stopped.
+*
+* SEE ALSO
+*   DB3_Mix(), DB3_MixInt32()
+*
+*****************************************************************************
+*
+*/
+
+uint32_t DB3_MixFloat(void *msyn0, uint32_t frames, float *out, uint32_t layout)
+{
+	struct ModSynth *msyn = (struct ModSynth*)msyn0;
+	uint32_t frame_counter;
+	float scale;
+
+	// 16-bit output is (accumulator * BoostMultiplier) >> 16, then full scale is 2^31.
+
+	scale = (float)((double)msyn->BoostMultiplier / 2147483648.0);
+	frame_counter = msynth_render(msyn, frames);
+
+	if (layout == DB3_LAYOUT_PLANAR)
+	{
+		msyn->Mixer.FlushFloatPlanar(msyn->Accumulator, out, out + frames, frames, scale);
+	}
+	else msyn->Mixer.FlushFloat(msyn->Accumulator, out, frames, scale);
+
+	return frame_counter;
+}
+
+
+/****** libdigibooster3/DB3_MixAdd() ****************************************
+*
+* NAME
+*   DB3_MixAdd() -- Mixes down a next chunk of module adding it to a bus.
+*
+* SYNOPSIS
+*   uint32_t DB3_MixAdd(void *engine, uint32_t frames, int32_t *bus,
+*   uint32_t gain);
+*
+* FUNCTION
+*   Works the same as DB3_Mix(), but rendered frames are multiplied by
+*   'gain' and added to a 32-bit bus owned by the caller, without
+*   saturation. It allows for layering several modules (each one played by
+*   its own engine) into one output. The bus uses the scale of DB3_Mix()
+*   output, so a frame rendered with unity gain adds exactly the same value
+*   as DB3_Mix() would output, as long as it is not saturated. There is 16
+*   bits of headroom above 16-bit full scale. When all layers are added,
+*   the bus is converted to 16-bit output with DB3_FlushBus().
+*
+* INPUTS
+*   engine - a blackbox pointer to the synthesizer engine.
+*   frames - number of audio frames to render. Must not be higher than buffer
+*     size declared in DB3_NewEngine(). Passing 0 is OK (function returns
+*     immediately).
+*   bus - 32-bit stereo interleaved bus of at least (8 * frames) bytes. It
+*     must be cleared before the first layer is added.
+*   gain - linear gain as 16.16 fixed point number, 0x10000 is unity gain.
+*     It is applied on top of the master volume set with DB3_SetVolume().
+*
+* RESULT
+*   Number of valid frames added to the bus. It may be less than 'frames'
+*   in case the sequencer has been stopped, remaining frames are unchanged.
 *
-*     where:
-*       udata - may be anything. This is just a pointer passed as userdata to
-*         DB3_SetCallback(), untouched.
-*       uevent - pointer to a read-only UpdateEvent structure:
-*         From "libdigibooster3.h":
+* SEE ALSO
+*   DB3_Mix(), DB3_FlushBus()
 *
-*         struct UpdateEvent
-*         {
-*           int32_t ue_Order;     // number of order in the playlist
-*           int32_t ue_Pattern;   // ordinal number of pattern
-*           int32_t ue_Row;       // number of row (position) in the pattern
-*           int32_t ue_Delay;     // event delay in sample frames
-*           int32_t ue_Tempo;     // current module tempo ("CIA tempo"), BPM
-*           int32_t ue_Speed;     // current module speed (ticks per row)
-*           int32_t ue_SeqHalted; // TRUE if sequencer is halted
-*         };
+*****************************************************************************
 *
-*     NULL callback is safe and is considered as turning the callback feature
-*     off. Callback may be turned on and off (or changed) as needed.
+*/
+
+uint32_t DB3_MixAdd(void *msyn0, uint32_t frames, int32_t *bus, uint32_t gain)
+{
+	struct ModSynth *msyn = (struct ModSynth*)msyn0;
+	uint32_t frame_counter;
+	int64_t multiplier;
+
+	// Master volume and the gain are joined into a single multiplier.
+
+	multiplier = (int64_t)msyn->BoostMultiplier * gain >> 16;
+	if (multiplier > 0x7FFFFFFF) multiplier = 0x7FFFFFFF;
+	frame_counter = msynth_render(msyn, frames);
+	msyn->Mixer.MixAdd(msyn->Accumulator, bus, frame_counter, (int32_t)multiplier);
+	return frame_counter;
+}
+
+
+/****** libdigibooster3/DB3_FlushBus() **************************************
 *
-*   userdata - any value, just passed to the callback as described above.
+* NAME
+*   DB3_FlushBus() -- Converts a bus of layered modules to 16-bit output.
+*
+* SYNOPSIS
+*   void DB3_FlushBus(int32_t *bus, uint32_t frames, int16_t *output);
+*
+* FUNCTION
+*   Saturates frames of a bus filled with DB3_MixAdd() to 16 bits and
+*   stores them in 'output'. Then the bus is cleared, so it is ready for
+*   the next chunk of layers.
+*
+* INPUTS
+*   bus - 32-bit stereo interleaved bus.
+*   frames - number of frames to convert.
+*   output - buffer for converted frames, at least (4 * frames) bytes.
 *
 * RESULT
 *   None.
 *
-* EXAMPLE
-*   A step by step instruction how to get realtime position change triggers
-*   using Amiga timers:
-*   - Be prepared that one call to ModSynth_Mix() will call your callback
-*     more than one time.
-*   - In the callback convert delay from samples to timer units (usually
-*     EClocks or CPU clocks). Prepare a timer request for every callback.
-*   - Get current system clock.
-*   - Push the rendered buffer to audio hardware.
-*   - Add current clock to requests and sent them all to timer (WAITECLOCK or
-*     WAITCPUCLOCK unit).
-*   - while buffer is playing, wait for timer requests to be replied and take
-*     desired actions.
-*   There may be some additional delay if an event occurs just a few frames
-*   after buffer start (adding time and sending requests takes some CPU
-*   cycles). It may be compensated by using triple buffering and sending time
-*   requests one buffer earlier (a buffer length in frames should be added to the
-*   delay before conversion to timer units).
+* SEE ALSO
+*   DB3_MixAdd()
+*
+*****************************************************************************
+*
+*/
+
+void DB3_FlushBus(int32_t *bus, uint32_t frames, int16_t *out)
+{
+	mixer_flush_bus(bus, out, frames);
+}
+
+
+/****** libdigibooster3/DB3_SetTrackMute() *********************************
+*
+* NAME
+*   DB3_SetTrackMute() -- mutes or unmutes a track.
+*
+* SYNOPSIS
+*   void DB3_SetTrackMute(void *engine, uint32_t track, int mute);
+*
+* FUNCTION
+*   Mutes or unmutes a single track of the module. A muted track is still
+*   played by the sequencer, so it continues properly when unmuted. Its
+*   audio is not rendered however, so muting tracks reduces CPU load. The
+*   only exception are tracks with their own echo parameters, these are
+*   rendered to keep the echo state. A muted track with standard echo is not
+*   mixed into the echo shared by such tracks.
+*
+* INPUTS
+*   engine - an opaque pointer to the module synthesizer created with
+*     DB3_NewEngine(). Must not be NULL.
+*   track - number of track, counted from 0. Invalid numbers are ignored.
+*   mute - TRUE to mute the track, FALSE to unmute it.
+*
+* RESULT
+*   None.
 *
 * SEE ALSO
-*   DB3_Mix()
+*   DB3_SetTrackSolo()
 *
 *****************************************************************************
 *
 */
 
-void DB3_SetCallback(void *msyn0, void(*callback)(void*, struct UpdateEvent*), void *userdata)
+void DB3_SetTrackMute(void *msyn0, uint32_t track, int mute)
 {
 	struct ModSynth *msyn = (struct ModSynth*)msyn0;
 
-	msyn->UserData = userdata;
-	msyn->UpdateCallback = callback;
+	if (track < msyn->Mod->NumTracks)
+	{
+		msyn->Tracks[track].UserMute = mute ? TRUE : FALSE;
+		msynth_update_mutes(msyn);
+	}
 }
 
 
-/****** libdigibooster3/DB3_SetVolume() *************************************
+/****** libdigibooster3/DB3_SetTrackSolo() *********************************
 *
 * NAME
-*   DB3_SetVolume() -- sets the current master volume level.
+*   DB3_SetTrackSolo() -- sets or clears solo state of a track.
 *
 * SYNOPSIS
-*   void DB3_SetVolume(void *engine, int16_t level);
+*   void DB3_SetTrackSolo(void *engine, uint32_t track, int solo);
 *
 * FUNCTION
-*   The function sets the master volume level in decibels. 0 dB level is
-*   defined in the following way: if one assumes full amplitude on all the
-*   tracks in the module, the final downmix will have full amplitude too.
-*   Then 0 dB and below is overdrive-safe. Master volume above 0 dB may cause
-*   overdrive, which is then saturated. The allowed range is from -84 dB to
-*   +24 dB including.
-*
-*  Master volume level operates inside the internal 32-bit mixer. Then
-*  adjusting volume with this function gives less quantization noise than
-*  scaling the output 16-bit stream.
+*   When any track has solo state set, only tracks with solo are heard, all
+*   other tracks are muted. Solo may be set for many tracks at once. A track
+*   muted with DB3_SetTrackMute() stays muted, even if it has solo set.
+*   Muting by solo works the same as with DB3_SetTrackMute().
 *
 * INPUTS
 *   engine - an opaque pointer to the module synthesizer created with
 *     DB3_NewEngine(). Must not be NULL.
-*   level - master volume level in decibels. Must be inside <-84, +24> range.
+*   track - number of track, counted from 0. Invalid numbers are ignored.
+*   solo - TRUE to set solo for the track, FALSE to clear it.
 *
 * RESULT
 *   None.
 *
+* SEE ALSO
+*   DB3_SetTrackMute()
+*
 *****************************************************************************
 *
 */
 
-void DB3_SetVolume(void *msyn0, int16_t level)
+void DB3_SetTrackSolo(void *msyn0, uint32_t track, int solo)
 {
 	struct ModSynth *msyn = (struct ModSynth*)msyn0;
 
-	if (msyn->BoostMultiplier = msynth_boost_multiplier(level, msyn->Mod->NumTracks))
+	if (track < msyn->Mod->NumTracks)
 	{
-		msyn->BoostLimit = 0x7FFFFFFF / msyn->BoostMultiplier;
+		struct ModTrack *mt = &msyn->Tracks[track];
+
+		solo = solo ? TRUE : FALSE;
+
+		if (mt->Solo != solo)
+		{
+			mt->Solo = solo;
+			if (solo) msyn->SoloTracks++;
+			else msyn->SoloTracks--;
+			msynth_update_mutes(msyn);
+		}
 	}
-	else msyn->BoostLimit = 0x7FFFFFFF;
 }
 
 
-/****** libdigibooster3/DB3_SetPos() ****************************************
+/****** libdigibooster3/DB3_SetThreads() ***********************************
 *
 * NAME
-*   DB3_SetPos() -- Sets the current sequencer position.
+*   DB3_SetThreads() -- sets number of threads used for rendering.
 *
 * SYNOPSIS
-*   void DB3_SetPos(void *modsynth, uint32_t song, uint32_t order, uint32_t
-*   row);
+*   uint32_t DB3_SetThreads(void *engine, uint32_t threads);
 *
 * FUNCTION
+*   By default an engine renders audio in the thread calling DB3_Mix().
+*   This function enables a pool of worker threads, tracks are distributed
+*   between the calling thread and workers then. The sequencer still runs
+*   in the calling thread. Rendered audio is always exactly the same,
+*   regardless of number of threads used. Threads are useful for modules
+*   with many tracks, rendered at high mixing frequencies. Threads are
+*   available only on platforms with POSIX threads (Linux build).
 *
 * INPUTS
 *   engine - an opaque pointer to the module synthesizer created with
 *     DB3_NewEngine(). Must not be NULL.
-*   song - number of song in the module. Starting from 0.
-*   order - number of playlist order in the song. Starting from 0.
-*   row - number of row in the pattern selected with order. Starting from 0.
+*   threads - number of threads including the calling one, 1 disables the
+*     worker pool. Maximum is 64.
 *
 * RESULT
-*   None.
+*   Number of threads really used. It is 1, if threads are not available,
+*   or could not be created.
 *
 * NOTES
-*   All three parameters *must* specify a valid position inside the module.
-*   If not, the sequencer will read random data and probably crash.
+*   Must not be called concurrently with DB3_Mix() for the same engine.
 *
 *****************************************************************************
 *
 */
 
-void DB3_SetPos(void *msyn0, uint32_t song, uint32_t order, uint32_t row)
+uint32_t DB3_SetThreads(void *msyn0, uint32_t threads)
 {
 	struct ModSynth *msyn = (struct ModSynth*)msyn0;
 
-	msyn->Song = song;
-	msyn->Order = order;
-	msyn->Pattern = msyn->Mod->Songs[song]->PlayList[order];
-	msyn->Row = row;
-	msyn->Tick = 0;
+	msynth_free_threads(msyn);
+
+	if ((threads > 1) && (threads <= POOL_MAX_THREADS))
+	{
+		uint32_t others = threads - 1;
+
+		if (msyn->PartialAccus = db3_malloc(others * msyn->BufSize << 3))
+		{
+			if (msyn->PartialPreMixBufs = db3_malloc(others * msyn->BufSize << 2))
+			{
+				if (msyn->PartialEchoBusBufs = db3_malloc(others * msyn->BufSize << 3))
+				{
+					if (msyn->Pool = pool_new(threads))
+					{
+						msyn->Threads = threads;
+						return threads;
+					}
+				}
+			}
+		}
+
+		msynth_free_threads(msyn);
+	}
+
+	return 1;
 }
 
 
-/****** libdigibooster3/DB3_Mix() *******************************************
+/****** libdigibooster3/DB3_SetQuality() ************************************
 *
 * NAME
-*   DB3_Mix() -- Mixes down a next chunk of module.
+*   DB3_SetQuality() -- selects quality tier of rendering.
 *
 * SYNOPSIS
-*   uint32_t DB3_Mix(void *engine, uint32_t frames, int16_t *output);
+*   uint32_t DB3_SetQuality(void *engine, uint32_t quality);
 *
 * FUNCTION
-*   Synthetises and mixes frame chunk of module sound. Mixed frames are
-*   stored in 'output'. If a position callback is defined, it is called for
-*   every module position change within rendered audio frames range.
-*   Following calls to this function need not to use the same number of
-*   audio frames.
+*   Selects one of quality tiers, which trade quality for speed:
+*     DB3_QUALITY_PREVIEW - nearest neighbour resampler, no phase shift in
+*       panning, echo bypassed. The fastest.
+*     DB3_QUALITY_NORMAL - the resampler selected with DB3_NewEngineEx(),
+*       full panning and echo. The default.
+*     DB3_QUALITY_MASTER - sinc resampler, full panning and echo. The
+*       slowest, for offline rendering.
+*   The tier is applied at once, including instruments being played.
+*   Phase shift of panning changes at the next tick. Echo resumes from its
+*   state at the bypass.
+*
+*   When DB3_QUALITY_GOVERNOR flag is added, the selected tier is the
+*   highest one. Then the engine measures how long every DB3_Mix() call
+*   takes, relative to the real time of rendered audio. If the average
+*   goes above 75%, the tier is stepped down. If it stays below 25% for 2
+*   seconds, the tier is stepped back up. It keeps real time streams from
+*   underruns on a slow or busy machine. The governor is available only on
+*   Linux, the flag is ignored elsewhere.
 *
 * INPUTS
-*   engine - a blackbox pointer to the synthesizer engine.
-*   frames - number of audio frames to render. Must not be higher than buffer
-*     size declared in DB3_NewEngine(), will be clipped if higher. Passing 0
-*     is OK (function returns immediately).
-*   output - buffer for rendered frames. Note that frames are stereo, so the
-*     buffer must have at least (4 * frames) bytes. It must point to a valid
-*     buffer.
+*   engine - an opaque pointer to the module synthesizer created with
+*     DB3_NewEngine(). Must not be NULL.
+*   quality - one of DB3_QUALITY_xxx values, optionally with
+*     DB3_QUALITY_GOVERNOR flag.
 *
 * RESULT
-*   Number of valid frames in the buffer. It may be less than 'frames' in
-*   case the sequencer has been stopped.
+*   The tier selected. It is DB3_QUALITY_NORMAL instead of the master one,
+*   if sinc coefficients could not be allocated.
+*
+* NOTES
+*   Must not be called concurrently with DB3_Mix() for the same engine.
+*   The output of the governed engine depends on the machine speed, so it
+*   should not be used for offline rendering.
 *
 * SEE ALSO
-*   DB3_NewEngine(), DB3_SetCallback()
+*   DB3_GetQuality(), DB3_NewEngineEx()
 *
 *****************************************************************************
 *
 */
 
-uint32_t DB3_Mix(void *msyn0, uint32_t frames, int16_t *out)
+uint32_t DB3_SetQuality(void *msyn0, uint32_t quality)
 {
 	struct ModSynth *msyn = (struct ModSynth*)msyn0;
-	uint32_t frame_counter = 0;
-	unsigned long frames_left = frames;
-	int32_t *accu = msyn->Accumulator;
-	int stop = 0;
+	int tier = quality & DB3_QUALITY_MASK;
+
+	if (tier > DB3_QUALITY_MASTER) tier = DB3_QUALITY_MASTER;
+	if ((tier == DB3_QUALITY_MASTER) && !msynth_resampler_table(msyn, DB3_RESAMPLER_SINC)) tier = DB3_QUALITY_NORMAL;
+	msyn->MaxQuality = tier;
+#ifdef MSYNTH_GOVERNOR
+	msyn->Governor = (quality & DB3_QUALITY_GOVERNOR) ? TRUE : FALSE;
+#endif
+	msyn->GovernorLoad = 0;
+	msynth_set_tier(msyn, tier);
+	return tier;
+}
 
-	msynth_accumulator_clear(msyn, frames);
 
-	while (!stop && frames_left)
-	{
-		uint32_t frame_chunk;
-		int16_t track;
+/****** libdigibooster3/DB3_GetQuality() ************************************
+*
+* NAME
+*   DB3_GetQuality() -- returns quality tier in use.
+*
+* SYNOPSIS
+*   uint32_t DB3_GetQuality(void *engine);
+*
+* FUNCTION
+*   Returns the current quality tier of the engine. It is the tier set with
+*   DB3_SetQuality(), or a lower one selected by the governor.
+*
+* INPUTS
+*   engine - an opaque pointer to the module synthesizer created with
+*     DB3_NewEngine(). Must not be NULL.
+*
+* RESULT
+*   One of DB3_QUALITY_xxx values.
+*
+* SEE ALSO
+*   DB3_SetQuality()
+*
+*****************************************************************************
+*
+*/
 
-		if (msyn->TickSamplesHi == 0) stop = msynth_next_tick(msyn, frame_counter);
-		frame_chunk = msyn->TickSamplesHi;
-		if (frame_chunk > frames_left) frame_chunk = frames_left;
+uint32_t DB3_GetQuality(void *msyn0)
+{
+	struct ModSynth *msyn = (struct ModSynth*)msyn0;
 
-		// Resampling and mixing.
+	return msyn->Quality;
+}
 
-		for (track = 0; track < msyn->Mod->NumTracks; track++)
-		{
-			msynth_mix_track_in(msyn, track, accu, frame_chunk);
-		}
 
-		accu += frame_chunk << 1;              // shift beacuse 'accu' is stereo.
-		frames_left -= frame_chunk;
-		msyn->TickSamplesHi -= frame_chunk;
-		frame_counter += frame_chunk;
-	}
+/****** libdigibooster3/DB3_SetOneShotCache() *******************************
+*
+* NAME
+*   DB3_SetOneShotCache() -- sets memory budget of the one-shot cache.
+*
+* SYNOPSIS
+*   void DB3_SetOneShotCache(void *engine, uint32_t bytes);
+*
+* FUNCTION
+*   Notes of instruments without loop, repeated with the same pitch, sample
+*   offset and direction, are resampled to the same data. With the cache
+*   enabled, the first such note is stored when played, then following
+*   ones are copied from the cache instead of being interpolated again. It
+*   speeds up modules using drums and other one-shot samples, when played
+*   with cubic or sinc interpolation. Notes resampled linearly or with the
+*   nearest neighbour are rendered directly, as it is not slower. The output
+*   is exactly the same with and without the cache.
+*
+*   Least recently used notes are dropped, when a new one does not fit in
+*   the budget. Notes being played are kept.
+*
+* INPUTS
+*   engine - an opaque pointer to the module synthesizer created with
+*     DB3_NewEngine(). Must not be NULL.
+*   bytes - memory budget of the cache. 0 disables the cache, it is the
+*     default.
+*
+* RESULT
+*   None.
+*
+* NOTES
+*   Must not be called concurrently with DB3_Mix() for the same engine.
+*   A note takes about 2 bytes per output frame, so the budget of 4 MB
+*   holds about 40 seconds of notes at 48 kHz.
+*
+* SEE ALSO
+*   DB3_GetOneShotStats(), DB3_NewEngineEx(), DB3_SetQuality()
+*
+*****************************************************************************
+*
+*/
 
-	msynth_accumulator_flush(msyn, frames, out);
-	return frame_counter;
+void DB3_SetOneShotCache(void *msyn0, uint32_t bytes)
+{
+	struct ModSynth *msyn = (struct ModSynth*)msyn0;
+
+	oneshot_trim(&msyn->OneShots, bytes);
+}
+
+
+/****** libdigibooster3/DB3_GetOneShotStats() *******************************
+*
+* NAME
+*   DB3_GetOneShotStats() -- returns one-shot cache counters.
+*
+* SYNOPSIS
+*   void DB3_GetOneShotStats(void *engine, uint32_t *hits, uint32_t *misses);
+*
+* FUNCTION
+*   Returns numbers of notes played from the one-shot cache (hits), and
+*   notes which could be cached, but have been resampled (misses), since
+*   the engine has been created. A miss stores the note in the cache, if it
+*   fits in the budget.
+*
+* INPUTS
+*   engine - an opaque pointer to the module synthesizer created with
+*     DB3_NewEngine(). Must not be NULL.
+*   hits - pointer to a variable for the number of hits. May be NULL.
+*   misses - pointer to a variable for the number of misses. May be NULL.
+*
+* RESULT
+*   None.
+*
+* SEE ALSO
+*   DB3_SetOneShotCache()
+*
+*****************************************************************************
+*
+*/
+
+void DB3_GetOneShotStats(void *msyn0, uint32_t *hits, uint32_t *misses)
+{
+	struct ModSynth *msyn = (struct ModSynth*)msyn0;
+
+	if (hits) *hits = msyn->OneShots.Hits;
+	if (misses) *misses = msyn->OneShots.Misses;
 }
 
 
@@ -2377,17 +3964,24 @@ void DB3_DisposeEngine(void *msyn0)
 	{
 		int16_t track;
 
-		// Dispose all DSP chains.
+		// Dispose all DSP chains. Instrument chains consist of voice objects.
 
 		for (track = 0; track < msyn->Mod->NumTracks; track++)
 		{
 			struct ModTrack *mt = &msyn->Tracks[track];
 			msynth_dsp_dispose_chain(&mt->DSPTrackChain);
-			msynth_dsp_dispose_chain(&mt->DSPInstrChain);
 		}
 
-		// Free tables.
+		// Stop threads, free the echo bus, voice objects, tables and cached notes.
 
+		msynth_free_threads(msyn);
+		if (msyn->EchoBus) msyn->EchoBus->dsp_dispose(msyn->EchoBus);
+		if (msyn->EchoBusBuf) db3_free(msyn->EchoBusBuf);
+		msynth_free_voices(msyn);
+		oneshot_dispose(&msyn->OneShots);
+		if (msyn->ResamplerTables[DB3_RESAMPLER_CUBIC]) db3_free(msyn->ResamplerTables[DB3_RESAMPLER_CUBIC]);
+		if (msyn->ResamplerTables[DB3_RESAMPLER_SINC]) db3_free(msyn->ResamplerTables[DB3_RESAMPLER_SINC]);
+		db3_free(msyn->TrackSetBuf);
 		db3_free(msyn->Tracks);
 		db3_free(msyn->PreMixBuf);
 		db3_free(msyn->Accumulator);
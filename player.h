@@ -34,6 +34,9 @@
 #include "musicmodule.h"
 #include "lists.h"
 #include "dsp.h"
+#include "mixer.h"
+#include "pool.h"
+#include "oneshot.h"
 
 
 /* Sequencer modes. */
@@ -77,17 +80,54 @@ struct EnvInterp
 };
 
 
+// A compact set of tracks, so per-tick and per-mix loops need not to walk all the tracks of a
+// module. Order of members is not defined, removal moves the last member into the gap.
+
+struct TrackSet
+{
+	uint16_t *Members;              // numbers of member tracks
+	uint16_t *Slots;                // position of every track in Members, TRACKSET_NONE if not a member
+	int Count;                      // number of members
+};
+
+#define TRACKSET_NONE     0xFFFF
+
+
+// Render plan of a track, compiled from its DSP chains whenever their topology changes: an
+// instrument is set, echo is switched, or the quality tier changes. Rendering dispatches on it
+// without walking the chains.
+
+#define PLAN_IDLE         0    // no instrument, nothing to render
+#define PLAN_VOICE        1    // the instrument chain is rendered by the fused voice renderer
+#define PLAN_PULL         2    // the output object is pulled, then mixed
+
+struct RenderPlan
+{
+	int Kind;                       // PLAN_xxx
+	struct DSPObject *Output;       // object pulled for PLAN_PULL, the panoramizer for PLAN_VOICE
+	struct DSPObject *Echo;         // echo object of the track chain, NULL if none
+	int Bus;                        // TRUE if the track is mixed into the echo bus, not the accumulator
+};
+
+
 struct ModTrack
 {
 	int Instr;                      // a currently set instrument number (from 1!)
 	int IsOn;                       // TRUE if channel active
-	int Muted;                      // TRUE if to be ignored at mixer
+	int Muted;                      // TRUE if to be ignored at mixer (result of UserMute and solo)
+	int UserMute;                   // set with DB3_SetTrackMute()
+	int Solo;                       // set with DB3_SetTrackSolo()
 
 	struct MinList DSPInstrChain;   // a chain of DSP objects for instrument
 	struct MinList DSPTrackChain;   // a chain of DSP objects for track
+	struct RenderPlan Plan;         // compiled from the chains with msynth_plan_track()
 
 	int16_t GainL;                  // final tick gain (after all effects), left
 	int16_t GainR;                  // final tick gain (after all effects), right
+	uint32_t Step;                  // resampler ratio of the instrument chain
+	int32_t PanPhase;               // panning of the panoramizer of the instrument chain
+	uint32_t Dirty;                 // VOICE_DIRTY_xxx, parameters not passed to the chain yet
+	uint32_t RenderPos;             // frames of the current mixing block rendered so far
 	int32_t Volume;                 // speed prescaled, <0, 64>
 	int32_t Panning;                // speed prescaled, <-128, +128>
 	int32_t Pitch;                  // speed prescaled, <96, 768>
@@ -111,9 +151,11 @@ struct ModTrack
 	int32_t Retrigger;              // retrigger period in ticks (0 for no retrigger)
 	int32_t TrigOffset;             // apply at next trigger
 	int PlayBackwards;              // E3x command handling
+	int OneShotPending;             // the note triggered is to be connected to the one-shot cache
 	struct OldValues Old;           // old values for parameter reuse
 
 	int EchoType;                   // Type of echo for this track (off/standard/variable)
+	int EchoBus;                    // TRUE if standard echo is on, the track is mixed into the echo bus
 	int EchoDelay;                  // 0 to 255, 2 ms (tracker units)
 	int EchoFeedback;               // 0 to 255
 	int EchoMix;                    // 0 dry, 255 wet
@@ -121,11 +163,43 @@ struct ModTrack
 };
 
 
+// Instrument chain objects of a track. They are created with the engine and rebound to every
+// instrument set on the track, so instrument changes do not allocate memory.
+
+struct VoiceObjects
+{
+	struct DSPObject *Wavetable;
+	struct DSPObject *ZeroPadder;
+	struct DSPObject *Resampler;
+	struct DSPObject *Panoramizer;
+};
+
+
+// Tracks are not rendered tick by tick. A track is rendered in one pass up to the point, where
+// sequencer changes its parameters. Positions of ticks started in a mixing block are stored, as
+// they determine the point where a track stops after its instrument has ended.
+
+#define MSYNTH_MAX_TICK_STARTS     256
+
+// Voice parameters changed in the current tick. They are passed to the DSP stages using them at
+// once, after the track is rendered with old values.
+
+#define VOICE_DIRTY_RATIO          0x01
+#define VOICE_DIRTY_PANNING        0x02
+#define VOICE_DIRTY_GAINS          0x04
+
+// Values of ModTrack Step and PanPhase fields meaning nothing is set yet.
+
+#define MSYNTH_STEP_UNSET          0xFFFFFFFF
+#define MSYNTH_PAN_UNSET           0x7FFFFFFF
+
+
 struct ModSynth
 {
 	uint32_t MixFreq;               // mixdown frequency
 	struct DB3Module *Mod;          // the module played
 	struct ModTrack *Tracks;        // table of tracks
+	struct VoiceObjects *Voices;    // instrument chain objects of every track
 	int Mode;                       // sequencer mode (row/pattern/song/song_once)
 	int Pattern;                    // current pattern
 	int Song;                       // current song
@@ -151,6 +225,25 @@ struct ModSynth
 	uint8_t OldGlobalVolSlide;      // (Hxx)
 	int16_t *PreMixBuf;             // buffer for single track data before mixing
 	int32_t *Accumulator;           // mixdown accumulator (32-bit, stereo)
+	struct MixKernels Mixer;        // mixing kernels selected for the host CPU
+
+	struct TrackSet Active;         // tracks being on (IsOn), these are mixed and have envelopes processed
+	struct TrackSet Armed;          // tracks with an instrument set, these are processed by triggers
+	struct TrackSet Sliding;        // tracks with slides, modulations or values not settled to current speed
+	uint16_t *TrackSetBuf;          // memory for all track sets
+	int ClearSpeed;                 // speed used in msynth_clear_slides() to scale values back
+	int SoloTracks;                 // number of tracks with solo set
+
+	uint32_t BlockPos;              // sequencer position in the current mixing block (in frames)
+	uint32_t TickStarts[MSYNTH_MAX_TICK_STARTS];  // block positions of ticks started in the block
+	int TickCount;                  // number of entries in TickStarts
+
+	uint32_t BufSize;               // maximum frames per mix, as passed to DB3_NewEngine()
+	int Threads;                    // number of rendering threads, set with DB3_SetThreads()
+	struct WorkerPool *Pool;        // rendering threads, NULL if rendering is single threaded
+	int32_t *PartialAccus;          // accumulators for threads 1 to Threads - 1
+	int16_t *PartialPreMixBufs;     // PreMixBufs for threads 1 to Threads - 1
+	int32_t *PartialEchoBusBufs;    // echo buses for threads 1 to Threads - 1
 
 	void(*UpdateCallback)(void*, struct UpdateEvent*);  // update callback pointer
 	void *UserData;                 // user data pointer passed to UpdateCallback
@@ -171,6 +264,45 @@ struct ModSynth
 	int ManualUpdate;               // send (one) tracker position update being in HALTED mode
 
 	int16_t PanPhaseTable[128];     // panning phase table
+	int Resampler;                  // DB3_RESAMPLER_xxx, set with DB3_NewEngineEx()
+	int16_t *ResamplerTables[DB3_RESAMPLER_NEAREST + 1];  // polyphase coefficients for cubic and sinc, made when needed
+
+	int Quality;                    // DB3_QUALITY_xxx tier in use
+	int MaxQuality;                 // tier set with DB3_SetQuality(), the governor does not go above it
+	int Governor;                   // TRUE if the governor changes tiers
+	int Interpolation;              // DB3_RESAMPLER_xxx of the tier
+	int EchoBypass;                 // TRUE if track echoes are skipped in the tier
+	uint32_t GovernorLoad;          // average render time relative to real time, 8.8 fixed point
+	uint32_t GovernorHold;          // frames rendered since the tier change, or the load left the middle band
+	struct OneShotCache OneShots;   // resampled notes of instruments without loop
+
+	struct DSPObject *EchoBus;      // echo shared by tracks with standard echo, made when needed
+	int32_t *EchoBusBuf;            // the echo bus (32-bit, stereo), made with EchoBus
+	int EchoBusTracks;              // number of tracks mixed into the echo bus
+	uint32_t EchoBusPos;            // block position the echo bus is processed to
+};
+
+
+// CPU governor. It measures render time of every mixing call with a monotonic clock, available
+// on Linux only. The tier is stepped down, when the average load is above the high threshold,
+// and up, when it stays below the low one for the hold time.
+
+#if (defined TARGET_LINUX)
+#define MSYNTH_GOVERNOR
+#endif
+
+#define MSYNTH_GOVERNOR_HIGH       192      // 75% of real time
+#define MSYNTH_GOVERNOR_LOW        64       // 25% of real time
+#define MSYNTH_GOVERNOR_DOWN_HOLD  8        // 1/8 s after a change before stepping down
+#define MSYNTH_GOVERNOR_UP_HOLD    2        // 2 s before stepping up
+
+
+// Parameters of a rendering job running on the worker pool.
+
+struct RenderJob
+{
+	struct ModSynth *Synth;
+	uint32_t End;                   // tracks are rendered up to this block position
 };
 
 
@@ -179,9 +311,9 @@ struct ModSynth
 int msynth_instrument(struct ModSynth *msyn, struct ModTrack *mt, int instr);
 void msynth_pitch(struct ModSynth *msyn, struct ModTrack *mt, uint16_t pitch);
 void msynth_defvolume(struct ModSynth *msyn, struct ModTrack *mt);
-void msynth_trigger(struct DB3Module *m, struct ModTrack *mt);
+void msynth_trigger(struct ModSynth *msyn, struct ModTrack *mt);
 void msynth_reset(struct ModSynth *msyn, int unmute);
 void msynth_reset_track(struct ModTrack *mt);
-void msynth_dsp_set_instr_attrs(struct ModTrack *mt, struct DSPTag *tags);
+void msynth_dsp_set_instr_attrs(struct ModSynth *msyn, struct ModTrack *mt, struct DSPTag *tags);
 
 #endif      /* DIGIBOOSTER3_MODSYNTH_H */
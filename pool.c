@@ -0,0 +1,214 @@
+/*-----------------*/
+/* libdigibooster3 */
+/*-----------------*/
+
+/*
+  Copyright (c) 2014, Grzegorz Kraszewski
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+     list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+
+  This software is provided by the copyright holders and contributors "as is" and
+  any express or implied warranties, including, but not limited to the implied
+  warranties of merchantability and fitness for a particular purpose are
+  disclaimed. In no event shall the copyright owner or contributors be liable for
+  any direct, indirect, incidental, special, exemplary, or consequential damages
+  (including, but not limited to, procurement of substitute goods or services;
+  loss of use, data, or profits; or business interruption) however caused and
+  on any theory of liability, whether in contract  strict liability or tort
+  (including negligence or otherwise) arising in any way out of the use of this
+  software, even if advised of the possibility of such damage.
+*/
+
+/* Worker thread pool. The calling thread takes part in every job, so a pool of N threads starts */
+/* N - 1 worker threads.                                                                          */
+
+#include "libdigibooster3.h"
+#include "pool.h"
+
+#ifdef POOL_PTHREADS
+
+#include <pthread.h>
+
+
+struct PoolWorker
+{
+	struct WorkerPool *Pool;
+	pthread_t Thread;
+	int Number;                      // thread number passed to jobs
+};
+
+
+struct WorkerPool
+{
+	pthread_mutex_t Lock;
+	pthread_cond_t Start;            // signalled when a new job is posted
+	pthread_cond_t Done;             // signalled when the last worker finishes a job
+	PoolJob *Job;
+	void *Context;
+	uint32_t Generation;             // incremented for every job
+	int Pending;                     // workers still running current job
+	int Quit;                        // TRUE when the pool is disposed
+	int Threads;                     // including the calling thread
+	int Started;                     // number of worker threads successfully created
+	struct PoolWorker Workers[POOL_MAX_THREADS];
+};
+
+
+//==============================================================================================
+// pool_worker()
+//==============================================================================================
+
+static void* pool_worker(void *arg)
+{
+	struct PoolWorker *pw = (struct PoolWorker*)arg;
+	struct WorkerPool *pool = pw->Pool;
+	uint32_t generation = 0;
+
+	pthread_mutex_lock(&pool->Lock);
+
+	for (;;)
+	{
+		PoolJob *job;
+		void *context;
+
+		while ((pool->Generation == generation) && !pool->Quit) pthread_cond_wait(&pool->Start, &pool->Lock);
+		if (pool->Quit) break;
+		generation = pool->Generation;
+		job = pool->Job;
+		context = pool->Context;
+		pthread_mutex_unlock(&pool->Lock);
+
+		job(context, pw->Number);
+
+		pthread_mutex_lock(&pool->Lock);
+		if (--pool->Pending == 0) pthread_cond_signal(&pool->Done);
+	}
+
+	pthread_mutex_unlock(&pool->Lock);
+	return NULL;
+}
+
+
+//==============================================================================================
+// pool_new()
+//==============================================================================================
+
+// Returns NULL if 'threads' is out of range, or threads cannot be created.
+
+struct WorkerPool *pool_new(int threads)
+{
+	struct WorkerPool *pool;
+
+	if ((threads < 2) || (threads > POOL_MAX_THREADS)) return NULL;
+
+	if (pool = db3_malloc(sizeof(struct WorkerPool)))
+	{
+		int i;
+
+		pthread_mutex_init(&pool->Lock, NULL);
+		pthread_cond_init(&pool->Start, NULL);
+		pthread_cond_init(&pool->Done, NULL);
+		pool->Generation = 0;
+		pool->Pending = 0;
+		pool->Quit = FALSE;
+		pool->Threads = threads;
+		pool->Started = 0;
+
+		for (i = 1; i < threads; i++)
+		{
+			struct PoolWorker *pw = &pool->Workers[pool->Started];
+
+			pw->Pool = pool;
+			pw->Number = i;
+			if (pthread_create(&pw->Thread, NULL, pool_worker, pw)) break;
+			pool->Started++;
+		}
+
+		if (pool->Started == threads - 1) return pool;
+
+		pool_dispose(pool);
+	}
+
+	return NULL;
+}
+
+
+//==============================================================================================
+// pool_run()
+//==============================================================================================
+
+// Runs 'job' on all threads of the pool and waits until all of them finish.
+
+void pool_run(struct WorkerPool *pool, PoolJob *job, void *context)
+{
+	pthread_mutex_lock(&pool->Lock);
+	pool->Job = job;
+	pool->Context = context;
+	pool->Pending = pool->Threads - 1;
+	pool->Generation++;
+	pthread_cond_broadcast(&pool->Start);
+	pthread_mutex_unlock(&pool->Lock);
+
+	job(context, 0);
+
+	pthread_mutex_lock(&pool->Lock);
+	while (pool->Pending) pthread_cond_wait(&pool->Done, &pool->Lock);
+	pthread_mutex_unlock(&pool->Lock);
+}
+
+
+//==============================================================================================
+// pool_dispose()
+//==============================================================================================
+
+void pool_dispose(struct WorkerPool *pool)
+{
+	if (pool)
+	{
+		int i;
+
+		pthread_mutex_lock(&pool->Lock);
+		pool->Quit = TRUE;
+		pthread_cond_broadcast(&pool->Start);
+		pthread_mutex_unlock(&pool->Lock);
+
+		for (i = 0; i < pool->Started; i++) pthread_join(pool->Workers[i].Thread, NULL);
+
+		pthread_cond_destroy(&pool->Done);
+		pthread_cond_destroy(&pool->Start);
+		pthread_mutex_destroy(&pool->Lock);
+		db3_free(pool);
+	}
+}
+
+#else   /* POOL_PTHREADS */
+
+//==============================================================================================
+// Single threaded platforms.
+//==============================================================================================
+
+struct WorkerPool *pool_new(UNUSED int threads)
+{
+	return NULL;
+}
+
+
+void pool_run(UNUSED struct WorkerPool *pool, PoolJob *job, void *context)
+{
+	job(context, 0);
+}
+
+
+void pool_dispose(UNUSED struct WorkerPool *pool)
+{
+}
+
+#endif  /* POOL_PTHREADS */
@@ -0,0 +1,57 @@
+/*-----------------*/
+/* libdigibooster3 */
+/*-----------------*/
+
+/*
+  Copyright (c) 2014, Grzegorz Kraszewski
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+     list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+
+  This software is provided by the copyright holders and contributors "as is" and
+  any express or implied warranties, including, but not limited to the implied
+  warranties of merchantability and fitness for a particular purpose are
+  disclaimed. In no event shall the copyright owner or contributors be liable for
+  any direct, indirect, incidental, special, exemplary, or consequential damages
+  (including, but not limited to, procurement of substitute goods or services;
+  loss of use, data, or profits; or business interruption) however caused and
+  on any theory of liability, whether in contract  strict liability or tort
+  (including negligence or otherwise) arising in any way out of the use of this
+  software, even if advised of the possibility of such damage.
+*/
+
+#ifndef LIBDIGIBOOSTER3_POOL_H
+#define LIBDIGIBOOSTER3_POOL_H
+
+/* Worker thread pool used for parallel rendering. */
+
+// Threads are available only on platforms with POSIX threads. On other platforms pool_new()
+// always fails and the library works in a single thread.
+
+#if (defined TARGET_LINUX)
+#define POOL_PTHREADS
+#endif
+
+// Maximum number of threads in a pool, including the calling thread.
+
+#define POOL_MAX_THREADS             64
+
+struct WorkerPool;
+
+// A job is called once for every thread in the pool, 'thread' is the thread number from 0 to
+// number of threads - 1. Thread 0 is the thread calling pool_run().
+
+typedef void PoolJob(void *context, int thread);
+
+struct WorkerPool *pool_new(int threads);
+void pool_run(struct WorkerPool *pool, PoolJob *job, void *context);
+void pool_dispose(struct WorkerPool *pool);
+
+#endif      /* LIBDIGIBOOSTER3_POOL_H */
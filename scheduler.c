@@ -0,0 +1,536 @@
+/*-----------------*/
+/* libdigibooster3 */
+/*-----------------*/
+
+/*
+  Copyright (c) 2014, Grzegorz Kraszewski
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+  1. Redistributions of source code must retain the above copyright notice, this
+     list of conditions and the following disclaimer.
+  2. Redistributions in binary form must reproduce the above copyright notice,
+     this list of conditions and the following disclaimer in the documentation
+     and/or other materials provided with the distribution.
+
+  This software is provided by the copyright holders and contributors "as is" and
+  any express or implied warranties, including, but not limited to the implied
+  warranties of merchantability and fitness for a particular purpose are
+  disclaimed. In no event shall the copyright owner or contributors be liable for
+  any direct, indirect, incidental, special, exemplary, or consequential damages
+  (including, but not limited to, procurement of substitute goods or services;
+  loss of use, data, or profits; or business interruption) however caused and
+  on any theory of liability, whether in contract  strict liability or tort
+  (including negligence or otherwise) arising in any way out of the use of this
+  software, even if advised of the possibility of such damage.
+*/
+
+/* Scheduler rendering many engines with a shared, fixed pool of worker threads. Every engine is */
+/* attached as a stream with a queue of fixed size blocks. Workers render blocks ahead, the most  */
+/* urgent stream first, and readers take rendered blocks from queues.                             */
+
+#include "libdigibooster3.h"
+#include "player.h"
+
+#ifdef POOL_PTHREADS
+#include <pthread.h>
+#include <time.h>
+#endif
+
+
+struct Scheduler;
+
+struct SchedStream
+{
+	struct MinNode Node;
+	struct Scheduler *Sched;
+	void *Engine;
+	int16_t *Blocks;                 // ring of Depth blocks, BlockFrames stereo frames each
+	uint32_t *Lengths;               // number of frames rendered in every block
+	uint32_t Head;                   // the oldest rendered block
+	uint32_t Count;                  // number of rendered blocks in the queue
+	uint64_t Deadline;               // time (ns) when the queue runs dry
+	uint64_t BlockTime;              // playing time of one block (ns)
+	int Home;                        // worker rendering this stream normally
+	int Busy;                        // a worker renders a block now
+	int Ended;                       // the engine has stopped, no more blocks
+};
+
+
+struct Scheduler
+{
+	struct MinList Streams;
+	uint32_t BlockFrames;
+	uint32_t Depth;                  // queue length in blocks
+	int Workers;                     // number of worker threads
+	int NextHome;                    // for assigning streams to workers in turn
+#ifdef POOL_PTHREADS
+	pthread_mutex_t Lock;
+	pthread_cond_t Work;             // signalled when a queue has free space
+	pthread_cond_t Done;             // signalled when a block is rendered
+	int Quit;
+	pthread_t Threads[POOL_MAX_THREADS];
+#endif
+};
+
+
+#ifdef POOL_PTHREADS
+
+//==============================================================================================
+// sched_now()
+//==============================================================================================
+
+static uint64_t sched_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+//==============================================================================================
+// sched_pick()
+//==============================================================================================
+
+// Selects a stream to render next by worker 'worker'. Streams having a free block in the queue
+// are considered. Streams of the worker itself go first, so engine data stay in the cache of one
+// core. When the worker has nothing to do, it steals the most urgent stream of another worker.
+// The stolen stream becomes the worker's own. Called with the lock held.
+
+static struct SchedStream* sched_pick(struct Scheduler *sch, int worker)
+{
+	struct SchedStream *ss, *own = NULL, *other = NULL;
+
+	ITERATE_LIST(&sch->Streams, struct SchedStream*, ss)
+	{
+		if (ss->Busy || ss->Ended || (ss->Count == sch->Depth)) continue;
+
+		if (ss->Home == worker)
+		{
+			if (!own || (ss->Deadline < own->Deadline)) own = ss;
+		}
+		else
+		{
+			if (!other || (ss->Deadline < other->Deadline)) other = ss;
+		}
+	}
+
+	if (own) return own;
+	if (other) other->Home = worker;
+	return other;
+}
+
+
+//==============================================================================================
+// sched_worker()
+//==============================================================================================
+
+struct SchedWorker
+{
+	struct Scheduler *Sched;
+	int Number;
+};
+
+
+static void* sched_worker(void *arg)
+{
+	struct SchedWorker *sw = (struct SchedWorker*)arg;
+	struct Scheduler *sch = sw->Sched;
+	int worker = sw->Number;
+
+	db3_free(sw);
+	pthread_mutex_lock(&sch->Lock);
+
+	while (!sch->Quit)
+	{
+		struct SchedStream *ss;
+
+		if (ss = sched_pick(sch, worker))
+		{
+			uint32_t slot = (ss->Head + ss->Count) % sch->Depth;
+			uint32_t frames;
+
+			// The slot is not visible to the reader until Count is incremented, so the block is
+			// rendered without the lock.
+
+			ss->Busy = TRUE;
+			pthread_mutex_unlock(&sch->Lock);
+			frames = DB3_Mix(ss->Engine, sch->BlockFrames, ss->Blocks + slot * sch->BlockFrames * 2);
+			pthread_mutex_lock(&sch->Lock);
+			ss->Lengths[slot] = frames;
+			ss->Count++;
+			ss->Deadline += ss->BlockTime;
+			if (frames < sch->BlockFrames) ss->Ended = TRUE;
+			ss->Busy = FALSE;
+			pthread_cond_broadcast(&sch->Done);
+		}
+		else pthread_cond_wait(&sch->Work, &sch->Lock);
+	}
+
+	pthread_mutex_unlock(&sch->Lock);
+	return NULL;
+}
+
+#endif  /* POOL_PTHREADS */
+
+
+/****** libdigibooster3/DB3_NewScheduler() **********************************
+*
+* NAME
+*   DB3_NewScheduler() -- creates a scheduler for many engines.
+*
+* SYNOPSIS
+*   void* DB3_NewScheduler(uint32_t threads, uint32_t blockframes,
+*   uint32_t depth);
+*
+* FUNCTION
+*   Creates a scheduler, which renders audio of many engines with a fixed
+*   pool of worker threads. Engines are attached to the scheduler as streams
+*   with DB3_AddStream(). Workers render audio in blocks of fixed size ahead
+*   of time, and put them into queues of streams. A stream with the least
+*   amount of queued audio is rendered first. Every stream is rendered by
+*   the same worker thread, unless other workers are idle. Rendered blocks
+*   are taken from queues with DB3_ReadStream().
+*
+* INPUTS
+*   threads - number of worker threads, at most 64. Typically the number of
+*     processor cores. When 0, there are no workers and every block is
+*     rendered in the thread calling DB3_ReadStream().
+*   blockframes - number of frames in one block. Must not be higher than
+*     'bufsize' of any engine attached.
+*   depth - number of blocks queued for every stream, at least 1.
+*
+* RESULT
+*   An opaque pointer to the scheduler, or NULL if out of memory, or threads
+*   can't be created.
+*
+* NOTES
+*   Worker threads are available only on platforms with POSIX threads (Linux
+*   build). On other platforms only 'threads' = 0 is accepted.
+*
+* SEE ALSO
+*   DB3_DisposeScheduler(), DB3_AddStream(), DB3_ReadStream()
+*
+*****************************************************************************
+*
+*/
+
+void* DB3_NewScheduler(uint32_t threads, uint32_t blockframes, uint32_t depth)
+{
+	struct Scheduler *sch;
+
+	#ifdef POOL_PTHREADS
+	if (threads > POOL_MAX_THREADS) return NULL;
+	#else
+	if (threads > 0) return NULL;
+	#endif
+
+	if ((blockframes == 0) || (depth == 0)) return NULL;
+
+	if (sch = db3_malloc(sizeof(struct Scheduler)))
+	{
+		INIT_LIST(&sch->Streams);
+		sch->BlockFrames = blockframes;
+		sch->Depth = depth;
+		sch->Workers = 0;
+		sch->NextHome = 0;
+
+		#ifdef POOL_PTHREADS
+		pthread_mutex_init(&sch->Lock, NULL);
+		pthread_cond_init(&sch->Work, NULL);
+		pthread_cond_init(&sch->Done, NULL);
+		sch->Quit = FALSE;
+
+		while ((uint32_t)sch->Workers < threads)
+		{
+			struct SchedWorker *sw;
+
+			if (!(sw = db3_malloc(sizeof(struct SchedWorker)))) break;
+			sw->Sched = sch;
+			sw->Number = sch->Workers;
+
+			if (pthread_create(&sch->Threads[sch->Workers], NULL, sched_worker, sw))
+			{
+				db3_free(sw);
+				break;
+			}
+
+			sch->Workers++;
+		}
+
+		if ((uint32_t)sch->Workers < threads)
+		{
+			DB3_DisposeScheduler(sch);
+			return NULL;
+		}
+		#endif
+
+		return sch;
+	}
+
+	return NULL;
+}
+
+
+/****** libdigibooster3/DB3_AddStream() *************************************
+*
+* NAME
+*   DB3_AddStream() -- attaches an engine to a scheduler.
+*
+* SYNOPSIS
+*   void* DB3_AddStream(void *scheduler, void *engine);
+*
+* FUNCTION
+*   Attaches an engine to a scheduler and allocates the queue of blocks.
+*   Worker threads start rendering the engine immediately.
+*
+* INPUTS
+*   scheduler - scheduler created with DB3_NewScheduler().
+*   engine - engine created with DB3_NewEngine(). Its 'bufsize' must be at
+*     least 'blockframes' of the scheduler.
+*
+* RESULT
+*   An opaque pointer to the stream, or NULL if out of memory or engine
+*   buffer is too short.
+*
+* NOTES
+*   The engine must not be used directly (for example with DB3_Mix() or
+*   DB3_SetPos()), until it is detached with DB3_RemoveStream(). Callbacks
+*   of the engine are called from worker threads.
+*
+* SEE ALSO
+*   DB3_RemoveStream(), DB3_ReadStream()
+*
+*****************************************************************************
+*
+*/
+
+void* DB3_AddStream(void *sched0, void *engine)
+{
+	struct Scheduler *sch = (struct Scheduler*)sched0;
+	struct ModSynth *msyn = (struct ModSynth*)engine;
+	struct SchedStream *ss;
+
+	if (msyn->BufSize < sch->BlockFrames) return NULL;
+
+	if (ss = db3_malloc(sizeof(struct SchedStream)))
+	{
+		ss->Sched = sch;
+		ss->Engine = engine;
+		ss->BlockTime = (uint64_t)sch->BlockFrames * 1000000000ULL / msyn->MixFreq;
+
+		if (ss->Blocks = db3_malloc(sch->Depth * sch->BlockFrames << 2))
+		{
+			if (ss->Lengths = db3_malloc(sch->Depth * sizeof(uint32_t)))
+			{
+				#ifdef POOL_PTHREADS
+				pthread_mutex_lock(&sch->Lock);
+				ss->Deadline = sched_now();
+				#endif
+
+				ss->Home = sch->NextHome;
+				if (++sch->NextHome >= sch->Workers) sch->NextHome = 0;
+				DB3AddTail(&sch->Streams, &ss->Node);
+
+				#ifdef POOL_PTHREADS
+				pthread_cond_broadcast(&sch->Work);
+				pthread_mutex_unlock(&sch->Lock);
+				#endif
+
+				return ss;
+			}
+
+			db3_free(ss->Blocks);
+		}
+
+		db3_free(ss);
+	}
+
+	return NULL;
+}
+
+
+/****** libdigibooster3/DB3_ReadStream() ************************************
+*
+* NAME
+*   DB3_ReadStream() -- takes one rendered block from a stream.
+*
+* SYNOPSIS
+*   uint32_t DB3_ReadStream(void *stream, int16_t *out, int wait);
+*
+* FUNCTION
+*   Copies the oldest rendered block from the queue of the stream to the
+*   buffer. The format is the same as for DB3_Mix(). The free slot of the
+*   queue is rendered again by a worker thread. If there is no block ready,
+*   the function waits for it, or returns 0 immediately, depending on 'wait'.
+*
+* INPUTS
+*   stream - stream created with DB3_AddStream().
+*   out - buffer for 'blockframes' stereo frames of the scheduler.
+*   wait - TRUE to wait until a block is rendered.
+*
+* RESULT
+*   Number of frames copied. It is 'blockframes' of the scheduler, except of
+*   the last block of a module played once. Then 0 is returned. 0 is also
+*   returned when 'wait' is FALSE and there is no block ready.
+*
+* NOTES
+*   Only one thread may read a stream at a time. Different streams may be
+*   read concurrently.
+*
+* SEE ALSO
+*   DB3_AddStream()
+*
+*****************************************************************************
+*
+*/
+
+uint32_t DB3_ReadStream(void *stream, int16_t *out, UNUSED int wait)
+{
+	struct SchedStream *ss = (struct SchedStream*)stream;
+	struct Scheduler *sch = ss->Sched;
+	uint32_t frames = 0;
+
+	#ifdef POOL_PTHREADS
+	if (sch->Workers > 0)
+	{
+		int ready;
+
+		pthread_mutex_lock(&sch->Lock);
+		while (wait && (ss->Count == 0) && !ss->Ended) pthread_cond_wait(&sch->Done, &sch->Lock);
+		ready = (ss->Count > 0);
+		pthread_mutex_unlock(&sch->Lock);
+
+		// Workers never write to the head block, while it is in the queue, so it is copied
+		// without the lock.
+
+		if (ready)
+		{
+			frames = ss->Lengths[ss->Head];
+			db3_memcpy(out, ss->Blocks + ss->Head * sch->BlockFrames * 2, frames << 2);
+			pthread_mutex_lock(&sch->Lock);
+			if (++ss->Head == sch->Depth) ss->Head = 0;
+			ss->Count--;
+			ss->Deadline = sched_now() + ss->Count * ss->BlockTime;
+			pthread_cond_broadcast(&sch->Work);
+			pthread_mutex_unlock(&sch->Lock);
+		}
+
+		return frames;
+	}
+	#endif
+
+	// No workers, the block is rendered here.
+
+	if (!ss->Ended)
+	{
+		frames = DB3_Mix(ss->Engine, sch->BlockFrames, out);
+		if (frames < sch->BlockFrames) ss->Ended = TRUE;
+	}
+
+	return frames;
+}
+
+
+/****** libdigibooster3/DB3_RemoveStream() **********************************
+*
+* NAME
+*   DB3_RemoveStream() -- detaches an engine from a scheduler.
+*
+* SYNOPSIS
+*   void DB3_RemoveStream(void *stream);
+*
+* FUNCTION
+*   Detaches the engine from its scheduler, waiting for a block being
+*   rendered, if any. Then frees the queue. Blocks remaining in the queue are
+*   lost. The engine may be used directly or disposed then.
+*
+* INPUTS
+*   stream - stream created with DB3_AddStream(). NULL is safe.
+*
+* SEE ALSO
+*   DB3_AddStream()
+*
+*****************************************************************************
+*
+*/
+
+void DB3_RemoveStream(void *stream)
+{
+	struct SchedStream *ss = (struct SchedStream*)stream;
+
+	if (ss)
+	{
+		#ifdef POOL_PTHREADS
+		struct Scheduler *sch = ss->Sched;
+
+		pthread_mutex_lock(&sch->Lock);
+		while (ss->Busy) pthread_cond_wait(&sch->Done, &sch->Lock);
+		DB3Remove(&ss->Node);
+		pthread_mutex_unlock(&sch->Lock);
+		#else
+		DB3Remove(&ss->Node);
+		#endif
+
+		db3_free(ss->Lengths);
+		db3_free(ss->Blocks);
+		db3_free(ss);
+	}
+}
+
+
+/****** libdigibooster3/DB3_DisposeScheduler() ******************************
+*
+* NAME
+*   DB3_DisposeScheduler() -- stops worker threads and frees the scheduler.
+*
+* SYNOPSIS
+*   void DB3_DisposeScheduler(void *scheduler);
+*
+* FUNCTION
+*   Stops worker threads, removes all streams still attached and frees the
+*   scheduler. Engines are not disposed.
+*
+* INPUTS
+*   scheduler - scheduler created with DB3_NewScheduler(). NULL is safe.
+*
+* SEE ALSO
+*   DB3_NewScheduler()
+*
+*****************************************************************************
+*
+*/
+
+void DB3_DisposeScheduler(void *sched0)
+{
+	struct Scheduler *sch = (struct Scheduler*)sched0;
+
+	if (sch)
+	{
+		struct SchedStream *ss;
+
+		#ifdef POOL_PTHREADS
+		int i;
+
+		pthread_mutex_lock(&sch->Lock);
+		sch->Quit = TRUE;
+		pthread_cond_broadcast(&sch->Work);
+		pthread_mutex_unlock(&sch->Lock);
+
+		for (i = 0; i < sch->Workers; i++) pthread_join(sch->Threads[i], NULL);
+		#endif
+
+		while (ss = (struct SchedStream*)sch->Streams.mlh_Head, ss->Node.mln_Succ) DB3_RemoveStream(ss);
+
+		#ifdef POOL_PTHREADS
+		pthread_cond_destroy(&sch->Done);
+		pthread_cond_destroy(&sch->Work);
+		pthread_mutex_destroy(&sch->Lock);
+		#endif
+
+		db3_free(sch);
+	}
+}